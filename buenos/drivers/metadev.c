@@ -40,6 +40,7 @@
 #include "kernel/assert.h"
 #include "kernel/kmalloc.h"
 #include "kernel/interrupt.h"
+#include "vm/tlb.h"
 
 /**@name Metadevices
  *
@@ -257,13 +258,14 @@ void cpustatus_interrupt_handle(device_t *dev){
 
   spinlock_acquire(&cpu->slock);
 
-  /* If you really want to do something with inter-cpu interrupts,
-     do it here. */
-
   /* Clear the interrupt */
   iobase->command = CPU_COMMAND_CLEAR_IRQ;
 
   spinlock_release(&cpu->slock);
+
+  /* The interrupt is cleared first, so that a request made while the
+     earlier ones are handled raises it again. */
+  tlb_shootdown_handle();
 }
 
 /**
@@ -43,8 +43,9 @@
  * @{
  */
 
-/* import assembler function for clock handling */
+/* import assembler functions for clock handling */
 extern void _timer_set_ticks(uint32_t ticks);
+extern uint32_t _timer_get_ticks(void);
 
 /**
  * Sets timer interrupt (hw interrupt 5) to fire after ticks.
@@ -62,4 +63,17 @@ void timer_set_ticks(uint32_t ticks)
   _interrupt_set_state(intr_status);
 }
 
+/**
+ * Returns the number of ticks counted by the timer of this CPU. The
+ * count wraps around, so only differences of two counts are useful.
+ *
+ * @return The current tick count.
+ *
+ */
+
+uint32_t timer_get_ticks(void)
+{
+  return _timer_get_ticks();
+}
+
 /** @} */
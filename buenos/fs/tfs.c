@@ -62,6 +62,10 @@ typedef struct {
   /* Pointer to gbd device performing tfs */
   gbd_t          *disk;
 
+  /* Block after the last one allocated, where the search for free
+     blocks starts next time. */
+  uint32_t       next_block;
+
   /* lock for mutual exclusion of fs-operations (we support only
      one operation at a time in any case) */
   semaphore_t    *lock;
@@ -150,6 +154,7 @@ fs_t * tfs_init(gbd_t *disk)
 
   tfs->totalblocks = MIN(disk->total_blocks(disk), 8*TFS_BLOCK_SIZE);
   tfs->disk        = disk;
+  tfs->next_block  = 0;
 
   /* save the semaphore to the tfs_t */
   tfs->lock = sem;
@@ -330,24 +335,38 @@ int tfs_create(fs_t *fs, char *filename, int size)
 
 
   /* ...find space for inode... */
-  tfs->buffer_md[index].inode = bitmap_findnset(tfs->buffer_bat,
-                                                tfs->totalblocks);
+  tfs->buffer_md[index].inode = bitmap_findnset_range(tfs->buffer_bat,
+                                                      tfs->totalblocks, 1,
+                                                      tfs->next_block);
   if((int)tfs->buffer_md[index].inode == -1) {
     semaphore_V(tfs->lock);
     return VFS_ERROR;
   }
+  tfs->next_block = tfs->buffer_md[index].inode + 1;
 
-  /* ...and the rest of the blocks. Mark found block numbers in
-     inode.*/
+  /* ...and the rest of the blocks, in one run right after it if there
+     is room. Mark found block numbers in inode.*/
   tfs->buffer_inode->filesize = size;
+  r = -1;
+  if(numblocks > 0) {
+    r = bitmap_findnset_range(tfs->buffer_bat, tfs->totalblocks,
+                              numblocks, tfs->next_block);
+  }
   for(i=0; i<numblocks; i++) {
-    tfs->buffer_inode->block[i] = bitmap_findnset(tfs->buffer_bat,
-                                                  tfs->totalblocks);
-    if((int)tfs->buffer_inode->block[i] == -1) {
-      /* Disk full. No free block found. */
-      semaphore_V(tfs->lock);
-      return VFS_ERROR;
+    if(r != -1) {
+      tfs->buffer_inode->block[i] = r + i;
+    } else {
+      tfs->buffer_inode->block[i] = bitmap_findnset_range(tfs->buffer_bat,
+                                                          tfs->totalblocks,
+                                                          1,
+                                                          tfs->next_block);
+      if((int)tfs->buffer_inode->block[i] == -1) {
+        /* Disk full. No free block found. */
+        semaphore_V(tfs->lock);
+        return VFS_ERROR;
+      }
     }
+    tfs->next_block = tfs->buffer_inode->block[i] + 1;
   }
 
   /* Mark rest of the blocks in inode as unused. */
@@ -783,8 +802,7 @@ int tfs_getfree(fs_t *fs)
 {
   tfs_t *tfs = (tfs_t *)fs->internal;
   gbd_request_t req;
-  int allocated = 0;
-  uint32_t i;
+  int allocated;
   int r;
 
   semaphore_P(tfs->lock);
@@ -799,9 +817,7 @@ int tfs_getfree(fs_t *fs)
     return VFS_ERROR;
   }
 
-  for(i=0;i<tfs->totalblocks;i++) {
-    allocated += bitmap_get(tfs->buffer_bat,i);
-  }
+  allocated = bitmap_count(tfs->buffer_bat, tfs->totalblocks);
 
   semaphore_V(tfs->lock);
   return (tfs->totalblocks - allocated)*TFS_BLOCK_SIZE;
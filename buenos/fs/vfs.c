@@ -40,6 +40,7 @@
 #include "drivers/device.h"
 #include "fs/tfs.h"
 #include "fs/filesystems.h"
+#include "vm/pagecache.h"
 
 /** @name Virtual Filesystem
  *
@@ -56,6 +57,9 @@ typedef struct {
 
   /* Name of the mountpoint. */
   char mountpoint[VFS_NAME_LENGTH];
+
+  /* Disk the filesystem is on, or NULL if not known. */
+  gbd_t *disk;
 } vfs_entry_t;
 
 /* Open file information */
@@ -110,6 +114,8 @@ static int vfs_ops;
    when halting the system. */
 static int vfs_usable = 0;
 
+static int vfs_mount_disk(fs_t *fs, char *name, gbd_t *disk);
+
 /**
  * Initializes Virtual Filesystem layer. This function is called
  * before virtual memory is enabled.
@@ -128,6 +134,7 @@ void vfs_init(void)
   /* Clear table of mounted filesystems. */
   for(i=0; i<CONFIG_MAX_FILESYSTEMS; i++) {
     vfs_table.filesystems[i].filesystem = NULL;
+    vfs_table.filesystems[i].disk = NULL;
   }
 
   /* Clear table of open files. */
@@ -225,7 +232,7 @@ int vfs_mount_fs(gbd_t *disk, char *volumename)
     return VFS_INVALID_PARAMS;
   }
 
-  if((ret=vfs_mount(filesystem, volumename)) == VFS_OK) {
+  if((ret=vfs_mount_disk(filesystem, volumename, disk)) == VFS_OK) {
     kprintf("VFS: Mounted filesystem volume [%s]\n",
             volumename);
   } else {
@@ -406,6 +413,13 @@ static void vfs_end_op()
  *
  */
 int vfs_mount(fs_t *fs, char *name)
+{
+  return vfs_mount_disk(fs, name, NULL);
+}
+
+/* Mount `fs` at `name`, like vfs_mount, and remember that it is on
+   `disk`, if not NULL. */
+static int vfs_mount_disk(fs_t *fs, char *name, gbd_t *disk)
 {
   int i;
   int row;
@@ -443,6 +457,7 @@ int vfs_mount(fs_t *fs, char *name)
 
   stringcopy(vfs_table.filesystems[row].mountpoint, name, VFS_NAME_LENGTH);
   vfs_table.filesystems[row].filesystem = fs;
+  vfs_table.filesystems[row].disk = disk;
 
   semaphore_V(vfs_table.sem);
   vfs_end_op();
@@ -493,8 +508,10 @@ int vfs_unmount(char *name)
     }
   }
 
+  pagecache_invalidate(fs, -1);
   fs->unmount(fs);
   vfs_table.filesystems[row].filesystem = NULL;
+  vfs_table.filesystems[row].disk = NULL;
 
   semaphore_V(openfile_table.sem);
   semaphore_V(vfs_table.sem);
@@ -502,6 +519,30 @@ int vfs_unmount(char *name)
   return VFS_OK;
 }
 
+/**
+ * Tells whether a filesystem on given disk is mounted.
+ *
+ * @param disk The disk.
+ *
+ * @return 1 if a filesystem mounted with vfs_mount_fs is on the
+ * disk, 0 if not.
+ *
+ */
+int vfs_disk_mounted(gbd_t *disk)
+{
+  int row, mounted = 0;
+
+  semaphore_P(vfs_table.sem);
+  for (row = 0; row < CONFIG_MAX_FILESYSTEMS; row++) {
+    if (vfs_table.filesystems[row].filesystem != NULL &&
+        vfs_table.filesystems[row].disk == disk) {
+      mounted = 1;
+    }
+  }
+  semaphore_V(vfs_table.sem);
+  return mounted;
+}
+
 /**
  * Opens the file identified by pathname for reading and writing. A path name
  * is a volume name followed by a file name (for instance, [disk1]halt).
@@ -761,6 +802,95 @@ int vfs_read(openfile_t file, void *buffer, int bufsize)
   return ret;
 }
 
+/**
+ * Reads at most bufsize bytes from given offset in given open file to
+ * given buffer. The seek position of the file is not used or changed,
+ * so this may be called concurrently on the same file.
+ *
+ * @param file Open file
+ *
+ * @param buffer Buffer to read from the file
+ *
+ * @param bufsize maximum number of bytes to read.
+ *
+ * @param offset Absolute position in the file to read from.
+ *
+ * @return Number of bytes read. Zero indicates end of file and
+ * negative values are errors.
+ *
+ */
+int vfs_read_at(openfile_t file, void *buffer, int bufsize, int offset)
+{
+  openfile_entry_t *openfile;
+  fs_t *fs;
+  int fileid, ret;
+
+  if (bufsize < 0 || buffer == NULL || offset < 0) {
+    return VFS_INVALID_PARAMS;
+  }
+
+  if (vfs_start_op() != VFS_OK)
+    return VFS_UNUSABLE;
+
+  semaphore_P(openfile_table.sem);
+
+  openfile = vfs_verify_open(file);
+  if (openfile == NULL) {
+    semaphore_V(openfile_table.sem);
+    vfs_end_op();
+    return VFS_NOT_OPEN;
+  }
+
+  fs = openfile->filesystem;
+  fileid = openfile->fileid;
+
+  semaphore_V(openfile_table.sem);
+
+  ret = fs->read(fs, fileid, buffer, bufsize, offset);
+
+  vfs_end_op();
+  return ret;
+}
+
+/**
+ * Finds out which file of which filesystem given open file is. Two
+ * open files refer to the same file exactly when this gives the same
+ * filesystem and fileid for both.
+ *
+ * @param file Open file
+ *
+ * @param fs Where to store the filesystem of the file.
+ *
+ * @param fileid Where to store the filesystem's id of the file.
+ *
+ * @return VFS_OK, or negative (VFS_*) on error.
+ *
+ */
+int vfs_identify(openfile_t file, fs_t **fs, int *fileid)
+{
+  openfile_entry_t *openfile;
+
+  if (vfs_start_op() != VFS_OK)
+    return VFS_UNUSABLE;
+
+  semaphore_P(openfile_table.sem);
+
+  openfile = vfs_verify_open(file);
+  if (openfile == NULL) {
+    semaphore_V(openfile_table.sem);
+    vfs_end_op();
+    return VFS_NOT_OPEN;
+  }
+
+  *fs = openfile->filesystem;
+  *fileid = openfile->fileid;
+
+  semaphore_V(openfile_table.sem);
+
+  vfs_end_op();
+  return VFS_OK;
+}
+
 /**
  * Writes datasize bytes from given buffer to given open file.
  * The write is started from current seek position and after writing, the
@@ -809,6 +939,64 @@ int vfs_write(openfile_t file, void *buffer, int datasize)
     semaphore_P(openfile_table.sem);
     openfile->seek_position += ret;
     semaphore_V(openfile_table.sem);
+
+    /* Cached pages of the file may now be out of date. */
+    pagecache_invalidate(fs, fileid);
+  }
+
+  vfs_end_op();
+  return ret;
+}
+
+/**
+ * Writes datasize bytes from given buffer to given offset in given
+ * open file. The seek position of the file is not used or changed,
+ * so this may be called concurrently on the same file.
+ *
+ * @param file Open file
+ *
+ * @param buffer Buffer to be written to file.
+ *
+ * @param datasize Number of bytes to write.
+ *
+ * @param offset Absolute position in the file to write to.
+ *
+ * @return Number of bytes written. All bytes are written unless error
+ * prevented to do that. Negative values are specific error conditions.
+ *
+ */
+int vfs_write_at(openfile_t file, void *buffer, int datasize, int offset)
+{
+  openfile_entry_t *openfile;
+  fs_t *fs;
+  int fileid, ret;
+
+  if (datasize < 0 || buffer == NULL || offset < 0) {
+    return VFS_INVALID_PARAMS;
+  }
+
+  if (vfs_start_op() != VFS_OK)
+    return VFS_UNUSABLE;
+
+  semaphore_P(openfile_table.sem);
+
+  openfile = vfs_verify_open(file);
+  if (openfile == NULL) {
+    semaphore_V(openfile_table.sem);
+    vfs_end_op();
+    return VFS_NOT_OPEN;
+  }
+
+  fs = openfile->filesystem;
+  fileid = openfile->fileid;
+
+  semaphore_V(openfile_table.sem);
+
+  ret = fs->write(fs, fileid, buffer, datasize, offset);
+
+  if(ret > 0) {
+    /* Cached pages of the file may now be out of date. */
+    pagecache_invalidate(fs, fileid);
   }
 
   vfs_end_op();
@@ -895,6 +1083,12 @@ int vfs_remove(const char *pathname)
 
   ret = fs->remove(fs, filename);
 
+  /* The fileid of the removed file may be reused by a new file, so forget
+     every cached page of the filesystem. */
+  if (ret == VFS_OK) {
+    pagecache_invalidate(fs, -1);
+  }
+
   semaphore_V(vfs_table.sem);
 
   vfs_end_op();
@@ -145,13 +145,17 @@ void vfs_deinit(void);
 int vfs_mount_fs(gbd_t *disk, char *volumename);
 int vfs_mount(fs_t *fs, char *name);
 int vfs_unmount(char *name);
+int vfs_disk_mounted(gbd_t *disk);
 
 openfile_t vfs_open(const char *pathname);
 int vfs_close(openfile_t file);
 int vfs_seek(openfile_t file, int seek_position);
 int vfs_tell(openfile_t file);
 int vfs_read(openfile_t file, void *buffer, int bufsize);
+int vfs_read_at(openfile_t file, void *buffer, int bufsize, int offset);
+int vfs_identify(openfile_t file, fs_t **fs, int *fileid);
 int vfs_write(openfile_t file, void *buffer, int datasize);
+int vfs_write_at(openfile_t file, void *buffer, int datasize, int offset);
 
 int vfs_create(const char *pathname, int size);
 int vfs_remove(const char *pathname);
@@ -48,7 +48,9 @@
 #include "kernel/interrupt.h"
 #include "kernel/kmalloc.h"
 #include "kernel/panic.h"
+#include "kernel/percpu.h"
 #include "kernel/scheduler.h"
+#include "kernel/slab.h"
 #include "kernel/synch.h"
 #include "kernel/thread.h"
 #include "lib/debug.h"
@@ -56,7 +58,12 @@
 #include "net/network.h"
 #include "proc/process.h"
 #include "vm/vm.h"
+#include "vm/swap.h"
 #include "proc/usr_sem.h"
+#include "proc/futex.h"
+#include "proc/usr_barrier.h"
+#include "proc/usr_event.h"
+#include "proc/usr_shm.h"
 
 /**
  * Fallback function for system startup. This function is executed
@@ -123,6 +130,9 @@ void init_startup_thread(uint32_t arg)
   kprintf("Mounting filesystems\n");
   vfs_mount_all();
 
+  kprintf("Initializing swap\n");
+  swap_init();
+
   kprintf("Initializing networking\n");
   network_init();
 
@@ -201,6 +211,9 @@ void init(void)
   kprintf("Detected %i CPUs\n", numcpus);
   KERNEL_ASSERT(numcpus <= CONFIG_MAX_CPUS);
 
+  kwrite("Initializing per-CPU data\n");
+  percpu_init();
+
   kwrite("Initializing interrupt handling\n");
   interrupt_init(numcpus);
 
@@ -210,6 +223,9 @@ void init(void)
   kwrite("Initializing user process system\n");
   process_init();
 
+  kwrite("Initializing kernel object caches\n");
+  kmem_init();
+
   kwrite("Initializing sleep queue\n");
   sleepq_init();
 
@@ -219,6 +235,16 @@ void init(void)
   kwrite("Initializing user semaphores\n");
   usr_sem_init();
 
+  kwrite("Initializing futexes\n");
+  futex_init();
+
+  kwrite("Initializing user barriers and events\n");
+  usr_barrier_init();
+  usr_event_init();
+
+  kwrite("Initializing shared memory segments\n");
+  usr_shm_init();
+
   kwrite("Initializing device drivers\n");
   device_init();
 
@@ -37,19 +37,23 @@
 #ifndef BUENOS_CONFIG_H
 #define BUENOS_CONFIG_H
 
-/* Define the maximum number of threads supported by the kernel
- * Range from 2 (idle + init) to 256 (ASID size)
+/* Define the maximum number of threads supported by the kernel.
+ * Each thread costs a 64 byte thread table entry; stacks are only
+ * allocated for threads that exist.
+ * Range from 2 (idle + init) to 65536
  */
-#define CONFIG_MAX_THREADS 32
+#define CONFIG_MAX_THREADS 4096
 
-/* Size of the stack of a kernel thread */
+/* Size of the stack of a kernel thread.  Stacks are allocated one
+ * page at a time from the page pool, so this must equal PAGE_SIZE.
+ */
 #define CONFIG_THREAD_STACKSIZE 4096
 
 /* Define the maximum number of CPUs supported by the kernel
  * Range from 1 to 32
  * CONFIG_MAX_THREADS should be the same or greater
  */
-#define CONFIG_MAX_CPUS 4
+#define CONFIG_MAX_CPUS 32
 
 /* Define the length of scheduling interval (timeslice) in
  * processor cycles.
@@ -106,9 +110,10 @@
  */
 #define CONFIG_MAX_GNDS 4
 
-/* Defines the number of pages allocated for userland stacks.
- * Range from 1 to 1000
+/* Defines the number of pages a userland stack may grow to.  The
+ * pages are only allocated when first touched.
+ * Range from 1 to 8192
  */
-#define CONFIG_USERLAND_STACK_SIZE 1
+#define CONFIG_USERLAND_STACK_SIZE 256
 
 #endif /* BUENOS_CONFIG_H */
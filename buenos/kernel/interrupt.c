@@ -42,8 +42,10 @@
 #include "kernel/interrupt.h"
 #include "drivers/polltty.h"
 #include "kernel/thread.h"
+#include "kernel/percpu.h"
 #include "lib/libc.h"
 #include "vm/tlb.h"
+#include "proc/process.h"
 
 /* Interrupt vector addresses (only these three should be ever used) */
 #define INTERRUPT_VECTOR_ADDRESS1 0x80000000
@@ -51,19 +53,17 @@
 #define INTERRUPT_VECTOR_ADDRESS3 0x80000200
 #define INTERRUPT_VECTOR_LENGTH  8
 
-extern TID_t scheduler_current_thread[CONFIG_MAX_CPUS];
-
-/* Pointers to interrupt stack for each processor */
-uint32_t interrupt_stacks[CONFIG_MAX_CPUS];
+/* The TLB refill vector (ADDRESS1) has room for code up to the general
+   exception vector (ADDRESS2). */
+#define INTERRUPT_REFILL_MAX_LENGTH \
+  ((INTERRUPT_VECTOR_ADDRESS2 - INTERRUPT_VECTOR_ADDRESS1) / 4)
 
 /* Table for the registered interrupt handlers */
 static interrupt_entry_t interrupt_handlers[CONFIG_MAX_DEVICES];
 
-/* Bool for checking whether we are in an interrupt or not */
-bool _is_in_interrupt = false;
-
+/* Check whether the calling CPU is in an interrupt or not */
 bool is_in_interrupt() {
-  return _is_in_interrupt;
+  return percpu_this()->in_interrupt;
 }
 
 /** Initializes interrupt handling. Allocates interrupt stacks for
@@ -78,6 +78,7 @@ void interrupt_init(int num_cpus) {
   uint32_t *iv_area2 = (uint32_t *)INTERRUPT_VECTOR_ADDRESS2;
   uint32_t *iv_area3 = (uint32_t *)INTERRUPT_VECTOR_ADDRESS3;
   uint32_t ret;
+  uint32_t refill_length;
 
   if (num_cpus < 1 || num_cpus > CONFIG_MAX_CPUS)
     KERNEL_PANIC("Too few or many CPUs found");
@@ -87,18 +88,26 @@ void interrupt_init(int num_cpus) {
     ret = (uint32_t)kmalloc(PAGE_SIZE);
     if (ret == 0)
       KERNEL_PANIC("Unable to allocate interrupt stacks");
-    interrupt_stacks[i] = ret+PAGE_SIZE-4;
+    percpu_area[i].interrupt_stack = ret+PAGE_SIZE-4;
   }
 
   /* Copy the interrupt vector code to its positions.All vectors
-   * will contain the same code.
+   * will contain the same code, except the TLB refill vector, which
+   * gets the fast refill handler from vm/_tlb.S.
    */
   for(i = 0 ; i < INTERRUPT_VECTOR_LENGTH ; i++) {
-    iv_area1[i] = ((uint32_t *) &_cswitch_vector_code)[i];
     iv_area2[i] = ((uint32_t *) &_cswitch_vector_code)[i];
     iv_area3[i] = ((uint32_t *) &_cswitch_vector_code)[i];
   }
 
+  refill_length = ((uint32_t) &_tlb_refill_code_end -
+                   (uint32_t) &_tlb_refill_code) / 4;
+  if (refill_length > INTERRUPT_REFILL_MAX_LENGTH)
+    KERNEL_PANIC("TLB refill handler does not fit its vector");
+  for(i = 0 ; i < (int) refill_length ; i++) {
+    iv_area1[i] = ((uint32_t *) &_tlb_refill_code)[i];
+  }
+
   /* Initialize the handler table to empty */
   for (i=0; i<CONFIG_MAX_DEVICES; i++) {
     interrupt_handlers[i].device = NULL;
@@ -155,12 +164,15 @@ void interrupt_register(uint32_t irq,
  */
 void interrupt_handle(uint32_t cause) {
   int this_cpu, i;
+  percpu_t *cpu;
 
   if(cause & INTERRUPT_CAUSE_SOFTWARE_0) {
     _interrupt_clear_sw0();
   }
 
   this_cpu = _interrupt_getcpu();
+  cpu = &percpu_area[this_cpu];
+  cpu->interrupt_count++;
 
   /* Exceptions should be handled elsewhere: */
   if((cause  & 0x0000007c) != 0) {
@@ -168,7 +180,7 @@ void interrupt_handle(uint32_t cause) {
     KERNEL_PANIC("Exception in interrupt_handle");
   }
 
-  _is_in_interrupt = true;
+  cpu->in_interrupt = true;
   /* Call appropiate interrupt handlers.  Handlers cannot be
    * unregistered, so after the first empty * entry all others are
    * also empty.
@@ -183,17 +195,34 @@ void interrupt_handle(uint32_t cause) {
     if ((cause & interrupt_handlers[i].irq) != 0)
       interrupt_handlers[i].handler(interrupt_handlers[i].device);
   }
-  _is_in_interrupt = false;
+  cpu->in_interrupt = false;
 
   /* Timer interrupt (HW5) or requested context switch (SW0)
    * Also call scheduler if we're running the idle thread.
    */
   if((cause & (INTERRUPT_CAUSE_SOFTWARE_0 |
                INTERRUPT_CAUSE_HARDWARE_5)) ||
-     scheduler_current_thread[this_cpu] == IDLE_THREAD_TID) {
+     cpu->current_thread == IDLE_THREAD_TID) {
     scheduler_schedule();
     /* Set the TLB's address space identifier to that of the newly scheduled
-       thread. */
-    _tlb_set_asid(thread_get_current_thread());
+       thread.  Threads of a multi-threaded process share the ASID of their
+       pagetable, and threads without one use ASID 0. */
+    thread_table_t *entry = thread_get_current_thread_entry();
+    if (entry->pagetable != NULL) {
+      tlb_activate(entry->pagetable);
+    } else {
+      cpu->pagetable = NULL;
+      _tlb_set_asid(0);
+    }
+
+    /* The idle thread itself only waits for interrupts, so an idle CPU
+       zeroes pages here, before returning to it. */
+    if (cpu->current_thread == IDLE_THREAD_TID) {
+      pagepool_zero_idle();
+    }
   }
+
+  /* A thread interrupted in userland does not go back there if its process
+     has exited meanwhile. */
+  process_check_interrupted();
 }
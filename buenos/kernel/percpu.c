@@ -0,0 +1,28 @@
+#include "kernel/percpu.h"
+#include "kernel/assert.h"
+#include "kernel/interrupt.h"
+#include "lib/libc.h"
+
+/* The per-CPU blocks of all CPUs. */
+percpu_t percpu_area[CONFIG_MAX_CPUS];
+
+/* Clear the per-CPU blocks.  Called once, before interrupt_init(). */
+void percpu_init(void)
+{
+  /* The block layout must match what cswitch.S and vm/_tlb.S expect.
+     If you hit this error, you have added fields to percpu_t without
+     shrinking its padding or raising PERCPU_SHIFT. */
+  KERNEL_ASSERT(sizeof(percpu_t) == PERCPU_SIZE);
+  KERNEL_ASSERT((uint32_t) &((percpu_t *) 0)->pagetable == PERCPU_PAGETABLE);
+  KERNEL_ASSERT((uint32_t) &((percpu_t *) 0)->tlb_refill_count
+                == PERCPU_TLB_REFILLS);
+
+  memoryset(percpu_area, 0, sizeof(percpu_area));
+}
+
+/* Return the block of the calling CPU.  Interrupts should be disabled, or the
+   thread may move to another CPU while using the block. */
+percpu_t *percpu_this(void)
+{
+  return &percpu_area[_interrupt_getcpu()];
+}
@@ -0,0 +1,59 @@
+#ifndef BUENOS_KERNEL_PERCPU_H
+#define BUENOS_KERNEL_PERCPU_H
+
+/* Each CPU has its own block in `percpu_area`, indexed by CPU number.  The
+   blocks are 1 << PERCPU_SHIFT bytes and aligned to that size, so that no two
+   CPUs write to the same cache line.  cswitch.S relies on the shift and on the
+   offsets below. */
+#define PERCPU_SHIFT 7
+#define PERCPU_SIZE (1 << PERCPU_SHIFT)
+
+#define PERCPU_CURRENT_THREAD 0
+#define PERCPU_INTERRUPT_STACK 4
+#define PERCPU_PAGETABLE 20
+#define PERCPU_TLB_REFILLS 24
+
+#ifndef __ASSEMBLER__
+
+#include "lib/types.h"
+#include "kernel/config.h"
+#include "vm/pagepool.h"
+
+typedef struct {
+  /* Thread currently running on this CPU (offset PERCPU_CURRENT_THREAD). */
+  int current_thread;
+  /* Top of this CPU's interrupt stack (offset PERCPU_INTERRUPT_STACK). */
+  uint32_t interrupt_stack;
+  /* Whether this CPU is running interrupt handlers. */
+  bool in_interrupt;
+
+  /* Statistics. */
+  uint32_t interrupt_count;
+  uint32_t schedule_count;
+
+  /* Pagetable of the address space active on this CPU, or NULL
+     (offset PERCPU_PAGETABLE).  Walked by the TLB refill handler. */
+  struct pagetable_struct_t *pagetable;
+  /* TLB refills done by the refill handler (offset PERCPU_TLB_REFILLS). */
+  uint32_t tlb_refill_count;
+
+  /* Timer ticks and TLB refills at the last call to scheduler_schedule(),
+     from which the running thread is charged for its use of the CPU. */
+  uint32_t schedule_ticks;
+  uint32_t schedule_refills;
+
+  /* Free pages cached by this CPU. */
+  pagepool_magazine_t page_magazine;
+
+  /* pad to PERCPU_SIZE bytes */
+  uint32_t dummy_alignment_fill[2];
+} __attribute__ ((aligned (PERCPU_SIZE))) percpu_t;
+
+extern percpu_t percpu_area[CONFIG_MAX_CPUS];
+
+void percpu_init(void);
+percpu_t *percpu_this(void);
+
+#endif /* __ASSEMBLER__ */
+
+#endif /* BUENOS_KERNEL_PERCPU_H */
@@ -41,6 +41,7 @@
 #include "kernel/interrupt.h"
 #include "lib/libc.h"
 #include "kernel/config.h"
+#include "kernel/percpu.h"
 #include "drivers/timer.h"
 
 /** @name Scheduler
@@ -53,9 +54,6 @@
 extern spinlock_t thread_table_slock;
 extern thread_table_t thread_table[CONFIG_MAX_THREADS];
 
-/** Currently running thread on each CPU */
-TID_t scheduler_current_thread[CONFIG_MAX_CPUS];
-
 /** List of threads ready to be run. */
 static struct {
   TID_t head; /* the first thread in ready to run queue, negative if none */
@@ -63,12 +61,12 @@ static struct {
 } scheduler_ready_to_run = {-1, -1};
 
 /**
- * Initializes the scheduler current thread table to 0 for each processor.
+ * Initializes the current thread of each processor to the idle thread.
  */
 void scheduler_init(void) {
   int i;
   for (i=0; i<CONFIG_MAX_CPUS; i++)
-    scheduler_current_thread[i] = 0;
+    percpu_area[i].current_thread = IDLE_THREAD_TID;
 }
 
 /**
@@ -187,21 +185,31 @@ void scheduler_schedule(void)
 {
   TID_t t;
   thread_table_t *current_thread;
-  int this_cpu;
+  percpu_t *cpu;
+  uint32_t ticks;
 
-  this_cpu = _interrupt_getcpu();
+  cpu = percpu_this();
+  cpu->schedule_count++;
 
   spinlock_acquire(&thread_table_slock);
 
-  current_thread = &(thread_table[scheduler_current_thread[this_cpu]]);
+  current_thread = &(thread_table[cpu->current_thread]);
+
+  /* Charge the thread for its time on this CPU.  All CPUs share the idle
+     thread, which is why this is done with the lock held. */
+  ticks = timer_get_ticks();
+  current_thread->cpu_ticks += ticks - cpu->schedule_ticks;
+  current_thread->tlb_refills += cpu->tlb_refill_count - cpu->schedule_refills;
+  cpu->schedule_ticks = ticks;
+  cpu->schedule_refills = cpu->tlb_refill_count;
 
   if(current_thread->state == THREAD_DYING) {
-    current_thread->state = THREAD_FREE;
+    thread_release(cpu->current_thread);
   } else if(current_thread->sleeps_on != 0) {
     current_thread->state = THREAD_SLEEPING;
   } else {
-    if(scheduler_current_thread[this_cpu] != IDLE_THREAD_TID)
-      scheduler_add_to_ready_list(scheduler_current_thread[this_cpu]);
+    if(cpu->current_thread != IDLE_THREAD_TID)
+      scheduler_add_to_ready_list(cpu->current_thread);
     current_thread->state = THREAD_READY;
   }
 
@@ -210,7 +218,7 @@ void scheduler_schedule(void)
 
   spinlock_release(&thread_table_slock);
 
-  scheduler_current_thread[this_cpu] = t;
+  cpu->current_thread = t;
 
   /* Schedule timer interrupt to occur after thread timeslice is spent */
   timer_set_ticks(_get_rand(CONFIG_SCHEDULER_TIMESLICE) +
@@ -39,6 +39,7 @@
 #include "kernel/sleepq.h"
 #include "kernel/config.h"
 #include "kernel/assert.h"
+#include "kernel/slab.h"
 #include "lib/libc.h"
 
 /** @name Semaphores
@@ -54,6 +55,9 @@ static semaphore_t semaphore_table[CONFIG_MAX_SEMAPHORES];
 /** Lock which must be held before accessing the semaphore_table */
 static spinlock_t semaphore_table_slock;
 
+/** Semaphores created when the table is full come from this cache */
+static kmem_cache_t *semaphore_cache;
+
 /**
  * Initializes semaphore subsystem. Sets all system semaphores
  * as unreserved (non-existing).
@@ -66,15 +70,20 @@ void semaphore_init(void)
   spinlock_reset(&semaphore_table_slock);
   for(i = 0; i < CONFIG_MAX_SEMAPHORES; i++)
     semaphore_table[i].creator = -1;
+
+  semaphore_cache = kmem_cache_create("semaphore", sizeof(semaphore_t), 0);
+  KERNEL_ASSERT(semaphore_cache != NULL);
 }
 
 /**
  * Creates a semaphore. The actual creation is done by reserving
- * a semaphore from the semaphore table.
+ * a semaphore from the semaphore table, or from the semaphore cache
+ * if the table is full and virtual memory is initialized.
  *
  * @param value Initial value of the created semaphore
  *
- * @return Pointer to the created semaphore
+ * @return Pointer to the created semaphore, or NULL if none could be
+ * reserved
  *
  * @see semaphore_destroy
  */
@@ -82,6 +91,7 @@ void semaphore_init(void)
 semaphore_t *semaphore_create(int value)
 {
   interrupt_status_t intr_status;
+  semaphore_t *sem;
   static int next = 0;
   int i;
   int sem_id;
@@ -105,26 +115,45 @@ semaphore_t *semaphore_create(int value)
   _interrupt_set_state(intr_status);
 
   if (i == CONFIG_MAX_SEMAPHORES) {
-    /* semaphore table does not have any free semaphores, creation fails */
-    return NULL;
+    /* semaphore table does not have any free semaphores, so take one from the
+       cache.  This fails before vm_init. */
+    sem = kmem_cache_alloc(semaphore_cache);
+    if (sem == NULL) {
+      return NULL;
+    }
+    sem->creator = thread_get_current_thread();
+  } else {
+    sem = &semaphore_table[sem_id];
   }
 
-  semaphore_table[sem_id].value = value;
-  spinlock_reset(&semaphore_table[sem_id].slock);
+  sem->value = value;
+  spinlock_reset(&sem->slock);
 
-  return &semaphore_table[sem_id];
+  return sem;
 }
 
 /**
  * Free given semaphore. Semaphore sem is freed for later
- * re-creation by semaphore_create.
+ * re-creation by semaphore_create. The caller may have just been
+ * woken by a semaphore_V still holding the semaphore's lock, so the
+ * lock is taken once before freeing.
  *
  * @param sem Semaphore to free (destroy)
  */
 
 void semaphore_destroy(semaphore_t *sem)
 {
+  interrupt_status_t intr_status;
+
+  intr_status = _interrupt_disable();
+  spinlock_acquire(&sem->slock);
+  spinlock_release(&sem->slock);
+  _interrupt_set_state(intr_status);
+
   sem->creator = -1;
+  if (sem < semaphore_table || sem >= semaphore_table + CONFIG_MAX_SEMAPHORES) {
+    kmem_cache_free(semaphore_cache, sem);
+  }
 }
 
 /**
@@ -0,0 +1,344 @@
+/*
+ * Slab allocator for kernel objects
+ *
+ * Copyright (C) 2003 Juha Aatrokoski, Timo Lilja,
+ *   Leena Salmela, Teemu Takanen, Aleksi Virtanen.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above
+ *    copyright notice, this list of conditions and the following
+ *    disclaimer in the documentation and/or other materials provided
+ *    with the distribution.
+ * 3. The name of the author may not be used to endorse or promote
+ *    products derived from this software without specific prior
+ *    written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR ``AS IS'' AND ANY EXPRESS
+ * OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY
+ * DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE
+ * GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY,
+ * WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING
+ * NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ *
+ */
+
+#include "kernel/slab.h"
+#include "kernel/spinlock.h"
+#include "kernel/interrupt.h"
+#include "kernel/assert.h"
+#include "kernel/config.h"
+#include "vm/pagepool.h"
+#include "lib/libc.h"
+
+/** @name Slab allocator
+ *
+ * This module implements object caches for kernel structures that are
+ * allocated and freed after vm_init. Each cache hands out objects of
+ * one size, carved from one-page slabs taken from the page pool. Each
+ * CPU keeps a few free objects of every cache, so that most
+ * allocations and frees do not take the cache's lock.
+ *
+ * @{
+ */
+
+/** A slab is one page. This header is at its start, and the objects
+ *  follow. Free objects are linked through their first word. */
+typedef struct kmem_slab_struct {
+  /* Links in the cache's list of partially used slabs. */
+  struct kmem_slab_struct *next;
+  struct kmem_slab_struct *prev;
+  /* First free object of the slab. */
+  void *free;
+  /* Number of objects allocated from the slab. */
+  int in_use;
+} kmem_slab_t;
+
+/** Free objects cached by one CPU. */
+typedef struct {
+  int count;
+  void *objects[KMEM_CPU_CACHE_SIZE];
+} kmem_cpu_cache_t;
+
+/** An object cache. */
+struct kmem_cache_struct {
+  const char *name;
+  /* Object size, rounded up to the alignment.  Zero in unused entries. */
+  int size;
+  /* Offset of the first object in a slab, and objects per slab. */
+  int offset;
+  int per_slab;
+
+  spinlock_t slock;
+  /* Slabs with both used and free objects.  Full slabs are on no list; they
+     are found from their objects when those are freed. */
+  kmem_slab_t *partial;
+  /* One wholly free slab is kept to avoid going back and forth to the page
+     pool, the others are returned to it. */
+  kmem_slab_t *empty;
+
+  kmem_cpu_cache_t cpu[CONFIG_MAX_CPUS];
+
+  /* Statistics. */
+  uint32_t slab_count;
+  uint32_t refills;
+  uint32_t drains;
+};
+
+/** Table of all caches. */
+static kmem_cache_t kmem_caches[KMEM_MAX_CACHES];
+
+/** Lock which must be held when taking an entry of kmem_caches. */
+static spinlock_t kmem_caches_slock;
+
+/**
+ * Clears the cache table. Called once, before any cache is created.
+ */
+void kmem_init(void)
+{
+  memoryset(kmem_caches, 0, sizeof(kmem_caches));
+  spinlock_reset(&kmem_caches_slock);
+}
+
+/**
+ * Creates an object cache. Caches are never destroyed. May be called
+ * before vm_init, as no memory is taken until the first allocation.
+ *
+ * @param name Name of the cache, for debugging. Not copied.
+ *
+ * @param size Size of the objects.
+ *
+ * @param align Alignment of the objects, a power of two, or 0 for the
+ * default of 4.
+ *
+ * @return The cache, or NULL if the cache table is full.
+ */
+kmem_cache_t *kmem_cache_create(const char *name, int size, int align)
+{
+  interrupt_status_t intr_status;
+  kmem_cache_t *cache = NULL;
+  int i;
+
+  if (align < (int) sizeof(void *)) {
+    align = sizeof(void *);
+  }
+  KERNEL_ASSERT((align & (align - 1)) == 0);
+  KERNEL_ASSERT(size > 0);
+
+  intr_status = _interrupt_disable();
+  spinlock_acquire(&kmem_caches_slock);
+  for (i = 0; i < KMEM_MAX_CACHES; i++) {
+    if (kmem_caches[i].size == 0) {
+      cache = &kmem_caches[i];
+      memoryset(cache, 0, sizeof(kmem_cache_t));
+      cache->size = (size + align - 1) & ~(align - 1);
+      break;
+    }
+  }
+  spinlock_release(&kmem_caches_slock);
+  _interrupt_set_state(intr_status);
+
+  if (cache == NULL) {
+    return NULL;
+  }
+
+  cache->name = name;
+  cache->offset = (sizeof(kmem_slab_t) + align - 1) & ~(align - 1);
+  cache->per_slab = (PAGE_SIZE - cache->offset) / cache->size;
+  KERNEL_ASSERT(cache->per_slab > 0);
+  spinlock_reset(&cache->slock);
+  return cache;
+}
+
+/**
+ * Takes a slab out of the partial list of its cache. The cache lock
+ * must be held.
+ *
+ * @param cache Cache of the slab.
+ *
+ * @param slab Slab to unlink.
+ */
+static void kmem_slab_unlink(kmem_cache_t *cache, kmem_slab_t *slab)
+{
+  if (slab->prev != NULL) {
+    slab->prev->next = slab->next;
+  } else {
+    cache->partial = slab->next;
+  }
+  if (slab->next != NULL) {
+    slab->next->prev = slab->prev;
+  }
+}
+
+/**
+ * Puts a slab first in the partial list of its cache. The cache lock
+ * must be held.
+ *
+ * @param cache Cache of the slab.
+ *
+ * @param slab Slab to link.
+ */
+static void kmem_slab_link(kmem_cache_t *cache, kmem_slab_t *slab)
+{
+  slab->prev = NULL;
+  slab->next = cache->partial;
+  if (cache->partial != NULL) {
+    cache->partial->prev = slab;
+  }
+  cache->partial = slab;
+}
+
+/**
+ * Takes one object from the slabs of a cache, getting a new slab if
+ * none has free objects. The cache lock must be held.
+ *
+ * @param cache Cache to take the object from.
+ *
+ * @return The object, or NULL if out of memory.
+ */
+static void *kmem_slab_get(kmem_cache_t *cache)
+{
+  kmem_slab_t *slab = cache->partial;
+  uint32_t page;
+  void *object;
+  int i;
+
+  if (slab == NULL) {
+    if (cache->empty != NULL) {
+      slab = cache->empty;
+      cache->empty = NULL;
+    } else {
+      page = pagepool_get_phys_page();
+      if (page == 0) {
+        return NULL;
+      }
+      slab = (kmem_slab_t *) ADDR_PHYS_TO_KERNEL(page);
+      slab->in_use = 0;
+      slab->free = NULL;
+      for (i = cache->per_slab - 1; i >= 0; i--) {
+        object = (uint8_t *) slab + cache->offset + i * cache->size;
+        *(void **) object = slab->free;
+        slab->free = object;
+      }
+      cache->slab_count++;
+    }
+    kmem_slab_link(cache, slab);
+  }
+
+  object = slab->free;
+  slab->free = *(void **) object;
+  slab->in_use++;
+  if (slab->free == NULL) {
+    kmem_slab_unlink(cache, slab);
+  }
+  return object;
+}
+
+/**
+ * Returns an object to its slab. A slab left wholly free is kept as
+ * the cache's empty slab, or returned to the page pool if the cache
+ * already has one. The cache lock must be held.
+ *
+ * @param cache Cache the object was allocated from.
+ *
+ * @param object The object to return.
+ */
+static void kmem_slab_put(kmem_cache_t *cache, void *object)
+{
+  kmem_slab_t *slab = (kmem_slab_t *) ((uint32_t) object & PAGE_SIZE_MASK);
+
+  if (slab->free == NULL) {
+    /* The slab was full, and now has a free object. */
+    kmem_slab_link(cache, slab);
+  }
+  *(void **) object = slab->free;
+  slab->free = object;
+  slab->in_use--;
+
+  if (slab->in_use == 0) {
+    kmem_slab_unlink(cache, slab);
+    if (cache->empty == NULL) {
+      cache->empty = slab;
+    } else {
+      pagepool_free_phys_page(ADDR_KERNEL_TO_PHYS((uint32_t) slab));
+      cache->slab_count--;
+    }
+  }
+}
+
+/**
+ * Allocates an object from given cache. The contents of the object
+ * are undefined.
+ *
+ * @param cache Cache to allocate from.
+ *
+ * @return The object, or NULL if out of memory.
+ */
+void *kmem_cache_alloc(kmem_cache_t *cache)
+{
+  interrupt_status_t intr_status;
+  kmem_cpu_cache_t *cpu;
+  void *object = NULL;
+
+  intr_status = _interrupt_disable();
+  cpu = &cache->cpu[_interrupt_getcpu()];
+
+  if (cpu->count == 0) {
+    spinlock_acquire(&cache->slock);
+    while (cpu->count < KMEM_CPU_CACHE_BATCH) {
+      object = kmem_slab_get(cache);
+      if (object == NULL) {
+        break;
+      }
+      cpu->objects[cpu->count++] = object;
+    }
+    cache->refills++;
+    spinlock_release(&cache->slock);
+  }
+
+  object = cpu->count > 0 ? cpu->objects[--cpu->count] : NULL;
+
+  _interrupt_set_state(intr_status);
+  return object;
+}
+
+/**
+ * Frees an object allocated from given cache.
+ *
+ * @param cache Cache the object was allocated from.
+ *
+ * @param object The object to free.
+ */
+void kmem_cache_free(kmem_cache_t *cache, void *object)
+{
+  interrupt_status_t intr_status;
+  kmem_cpu_cache_t *cpu;
+
+  KERNEL_ASSERT(object != NULL);
+
+  intr_status = _interrupt_disable();
+  cpu = &cache->cpu[_interrupt_getcpu()];
+
+  if (cpu->count == KMEM_CPU_CACHE_SIZE) {
+    spinlock_acquire(&cache->slock);
+    while (cpu->count > KMEM_CPU_CACHE_SIZE - KMEM_CPU_CACHE_BATCH) {
+      kmem_slab_put(cache, cpu->objects[--cpu->count]);
+    }
+    cache->drains++;
+    spinlock_release(&cache->slock);
+  }
+  cpu->objects[cpu->count++] = object;
+
+  _interrupt_set_state(intr_status);
+}
+
+/** @} */
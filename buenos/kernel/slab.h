@@ -0,0 +1,56 @@
+/*
+ * Slab allocator for kernel objects
+ *
+ * Copyright (C) 2003 Juha Aatrokoski, Timo Lilja,
+ *   Leena Salmela, Teemu Takanen, Aleksi Virtanen.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above
+ *    copyright notice, this list of conditions and the following
+ *    disclaimer in the documentation and/or other materials provided
+ *    with the distribution.
+ * 3. The name of the author may not be used to endorse or promote
+ *    products derived from this software without specific prior
+ *    written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR ``AS IS'' AND ANY EXPRESS
+ * OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY
+ * DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE
+ * GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY,
+ * WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING
+ * NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ *
+ */
+
+#ifndef BUENOS_KERNEL_SLAB_H
+#define BUENOS_KERNEL_SLAB_H
+
+#include "lib/types.h"
+
+/* Object caches for kernel structures that come and go after vm_init, when
+   kmalloc can no longer be used.  Each cache hands out objects of one size,
+   carved from one-page slabs taken from the page pool.  Every CPU keeps a few
+   free objects of each cache, so that most allocations and frees do not take
+   the cache's lock. */
+#define KMEM_MAX_CACHES 16
+#define KMEM_CPU_CACHE_SIZE 6
+#define KMEM_CPU_CACHE_BATCH 3
+
+typedef struct kmem_cache_struct kmem_cache_t;
+
+void kmem_init(void);
+kmem_cache_t *kmem_cache_create(const char *name, int size, int align);
+void *kmem_cache_alloc(kmem_cache_t *cache);
+void kmem_cache_free(kmem_cache_t *cache, void *object);
+
+#endif /* BUENOS_KERNEL_SLAB_H */
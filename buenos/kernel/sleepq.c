@@ -197,17 +197,23 @@ void sleepq_wake(void *resource)
 }
 
 
-/** Wake all threads waiting for given resource from the sleep
- * queue. If such threads exists, they are removed from the sleep
- * queue and placed on the scheduler's ready-to-run list.
+/** Wake at most 'count' threads waiting for given resource from the
+ * sleep queue. If such threads exists, they are removed from the
+ * sleep queue and placed on the scheduler's ready-to-run list in the
+ * order they went to sleep.
  *
  * @param resource Wake threads waiting for this resource
+ *
+ * @param count Maximum number of threads to wake, negative for all
+ *
+ * @return The number of threads woken
  */
-void sleepq_wake_all(void *resource)
+int sleepq_wake_n(void *resource, int count)
 {
   uint32_t hash;
   interrupt_status_t intr_state;
   TID_t first, prev, wake;
+  int woken = 0;
 
   hash = SLEEPQ_HASH(resource);
 
@@ -218,8 +224,8 @@ void sleepq_wake_all(void *resource)
   prev = -1;
   first = sleepq_hashtable[hash];
 
-  /* Traverse the whole linked list in order to wake up all threads */
-  while (first > 0) {
+  /* Traverse the linked list until enough threads have been woken */
+  while (first > 0 && (count < 0 || woken < count)) {
 
     /* Find the next entry actually waiting for 'resource', since
      * multiple resources may hash to the same index.
@@ -255,11 +261,25 @@ void sleepq_wake_all(void *resource)
       }
 
       spinlock_release(&thread_table_slock);
+      woken++;
     }
   }
 
   spinlock_release(&sleepq_slock);
   _interrupt_set_state(intr_state);
+
+  return woken;
+}
+
+/** Wake all threads waiting for given resource from the sleep
+ * queue. If such threads exists, they are removed from the sleep
+ * queue and placed on the scheduler's ready-to-run list.
+ *
+ * @param resource Wake threads waiting for this resource
+ */
+void sleepq_wake_all(void *resource)
+{
+  sleepq_wake_n(resource, -1);
 }
 
 /** @} */
@@ -42,5 +42,6 @@ void sleepq_init(void);
 void sleepq_add(void *resource);
 void sleepq_wake(void *resource);
 void sleepq_wake_all(void *resource);
+int sleepq_wake_n(void *resource, int count);
 
 #endif /* BUENOS_KERNEL_SLEEPQ_H */
@@ -43,6 +43,9 @@
 #include "kernel/config.h"
 #include "kernel/interrupt.h"
 #include "kernel/idle.h"
+#include "kernel/percpu.h"
+#include "drivers/yams.h"
+#include "vm/pagepool.h"
 
 /** @name Thread library
  *
@@ -57,11 +60,12 @@ spinlock_t thread_table_slock;
 /** The table containing all threads in the system, whether active or not. */
 thread_table_t thread_table[CONFIG_MAX_THREADS];
 
-/* Thread stack areas for kernel threads */
-char thread_stack_areas[CONFIG_THREAD_STACKSIZE * CONFIG_MAX_THREADS];
+/** Head of the list of THREAD_FREE entries, linked through 'next'. */
+static TID_t thread_free_list;
 
-/* Import running thread id table from scheduler */
-extern TID_t scheduler_current_thread[CONFIG_MAX_CPUS];
+/* Stack area for the idle thread.  All other threads get their stack
+   from the page pool when they are created. */
+static char thread_idle_stack[CONFIG_THREAD_STACKSIZE];
 
 /** Initializes the threading system. Does this by setting all thread
  *  table entry states to THREAD_FREE. Called only once before any
@@ -78,26 +82,39 @@ void thread_table_init(void)
      the end of thread_table_t definition in kernel/thread.h */
   KERNEL_ASSERT(sizeof(thread_table_t) == 64);
 
+  /* Stacks are single pages from the page pool. */
+  KERNEL_ASSERT(CONFIG_THREAD_STACKSIZE == PAGE_SIZE);
+
   spinlock_reset(&thread_table_slock);
 
-  /* Init all entries to 'NULL' */
+  /* Init all entries to 'NULL', and chain all but the idle thread
+     into the free list in TID order. */
   for (i=0; i<CONFIG_MAX_THREADS; i++) {
-    /* Set context pointers to the top of the stack*/
-    thread_table[i].context =
-      ((context_t *)
-       (thread_stack_areas
-        +CONFIG_THREAD_STACKSIZE*i + CONFIG_THREAD_STACKSIZE -
-        sizeof(context_t)));
+    thread_table[i].context      = NULL;
     thread_table[i].user_context = NULL;
     thread_table[i].state        = THREAD_FREE;
     thread_table[i].sleeps_on    = 0;
     thread_table[i].pagetable    = NULL;
     thread_table[i].process_id   = -1;
-    thread_table[i].next         = -1;
+    thread_table[i].next         = (i+1 < CONFIG_MAX_THREADS) ? i+1 : -1;
+    thread_table[i].stack        = 0;
+    thread_table[i].cpu_ticks     = 0;
+    thread_table[i].tlb_refills   = 0;
+    thread_table[i].page_faults   = 0;
+    thread_table[i].syscalls      = 0;
+    thread_table[i].bytes_read    = 0;
+    thread_table[i].bytes_written = 0;
   }
-
+  thread_free_list = IDLE_THREAD_TID + 1;
+
+  /* Set context pointer to the top of the stack */
+  thread_table[IDLE_THREAD_TID].stack = (uint32_t) thread_idle_stack;
+  thread_table[IDLE_THREAD_TID].context =
+    (context_t *) (thread_idle_stack + CONFIG_THREAD_STACKSIZE -
+                   sizeof(context_t));
+  thread_table[IDLE_THREAD_TID].next = -1;
   thread_table[IDLE_THREAD_TID].context->cpu_regs[MIPS_REGISTER_SP] =
-    (uint32_t) thread_stack_areas + CONFIG_THREAD_STACKSIZE -4 -
+    (uint32_t) thread_idle_stack + CONFIG_THREAD_STACKSIZE -4 -
     sizeof(context_t);
   thread_table[IDLE_THREAD_TID].context->pc =
     (uint32_t) _idle_thread_wait_loop;
@@ -117,14 +134,16 @@ void thread_table_init(void)
  * @param func Function pointer to the threads 'main' function.
  * @param arg Argument to pass to 'func' (meaning defined by 'func').
  *
+ * The stack of the thread is allocated from the page pool, so threads
+ * can only be created after vm_init().
+ *
  * @return The thread ID of the created thread, or negative if
- * creation failed (thread table is full).
+ * creation failed (thread table is full or out of memory).
  */
 TID_t thread_create(void (*func)(uint32_t), uint32_t arg)
 {
-  static TID_t next_tid = 0;
-  TID_t i, tid = -1;
-
+  TID_t i, tid;
+  uint32_t stack;
 
   interrupt_status_t intr_status;
 
@@ -132,19 +151,8 @@ TID_t thread_create(void (*func)(uint32_t), uint32_t arg)
 
   spinlock_acquire(&thread_table_slock);
 
-  /* Find the first free thread table entry starting from 'next_tid' */
-  for (i=0; i<CONFIG_MAX_THREADS; i++) {
-    TID_t t = (i + next_tid) % CONFIG_MAX_THREADS;
-
-    if(t == IDLE_THREAD_TID)
-      continue;
-
-    if (thread_table[t].state
-        == THREAD_FREE) {
-      tid = t;
-      break;
-    }
-  }
+  /* Take the first entry off the free list */
+  tid = thread_free_list;
 
   /* Is the thread table full? */
   if (tid < 0) {
@@ -153,15 +161,30 @@ TID_t thread_create(void (*func)(uint32_t), uint32_t arg)
     return tid;
   }
 
-  next_tid = (tid+1) % CONFIG_MAX_THREADS;
-
+  KERNEL_ASSERT(thread_table[tid].state == THREAD_FREE);
+  thread_free_list = thread_table[tid].next;
   thread_table[tid].state = THREAD_NONREADY;
 
   spinlock_release(&thread_table_slock);
   _interrupt_set_state(intr_status);
 
-  thread_table[tid].context      = (context_t *) (thread_stack_areas
-                                                  +CONFIG_THREAD_STACKSIZE*tid + CONFIG_THREAD_STACKSIZE -
+  stack = pagepool_get_phys_page();
+  if (stack == 0) {
+    /* Out of memory, put the entry back. */
+    intr_status = _interrupt_disable();
+    spinlock_acquire(&thread_table_slock);
+    thread_table[tid].state = THREAD_FREE;
+    thread_table[tid].next = thread_free_list;
+    thread_free_list = tid;
+    spinlock_release(&thread_table_slock);
+    _interrupt_set_state(intr_status);
+    return -1;
+  }
+  stack = ADDR_PHYS_TO_KERNEL(stack);
+
+  thread_table[tid].stack        = stack;
+  thread_table[tid].context      = (context_t *) (stack
+                                                  + CONFIG_THREAD_STACKSIZE -
                                                   sizeof(context_t));
 
   for (i=0; i< (int) sizeof(context_t)/4; i++) {
@@ -173,14 +196,19 @@ TID_t thread_create(void (*func)(uint32_t), uint32_t arg)
   thread_table[tid].sleeps_on    = 0;
   thread_table[tid].process_id   = -1;
   thread_table[tid].next         = -1;
+  thread_table[tid].cpu_ticks     = 0;
+  thread_table[tid].tlb_refills   = 0;
+  thread_table[tid].page_faults   = 0;
+  thread_table[tid].syscalls      = 0;
+  thread_table[tid].bytes_read    = 0;
+  thread_table[tid].bytes_written = 0;
 
   /* Make sure that we always have a valid back reference on context chain */
   thread_table[tid].context->prev_context = thread_table[tid].context;
 
   /* set stack pointer to the end of stack */
   thread_table[tid].context->cpu_regs[MIPS_REGISTER_SP] =
-    (uint32_t)thread_stack_areas
-    + (CONFIG_THREAD_STACKSIZE * tid)
+    stack
     + CONFIG_THREAD_STACKSIZE-4-
     sizeof(context_t); /* to the end of stack */
 
@@ -206,6 +234,29 @@ TID_t thread_create(void (*func)(uint32_t), uint32_t arg)
 }
 
 
+/** Release the thread table entry and stack of a dead thread. Called
+ * by the scheduler once the thread has switched away for the last
+ * time, so nothing runs on its stack anymore. The thread table
+ * spinlock must be held and interrupts disabled.
+ *
+ * @param t The ID of the dead thread.
+ */
+void thread_release(TID_t t)
+{
+  KERNEL_ASSERT(t != IDLE_THREAD_TID);
+
+  pagepool_free_phys_page(ADDR_KERNEL_TO_PHYS(thread_table[t].stack));
+  thread_table[t].stack   = 0;
+  thread_table[t].context = NULL;
+  thread_table[t].pagetable  = NULL;
+  thread_table[t].process_id = -1;
+
+  thread_table[t].state = THREAD_FREE;
+  thread_table[t].next  = thread_free_list;
+  thread_free_list = t;
+}
+
+
 /** Run a thread. The given thread is added to the scheduler's
  * ready-to-run list. This is really just a wrapper for
  * scheduler_add_ready().
@@ -249,7 +300,7 @@ TID_t thread_get_current_thread(void)
 
   intr_status = _interrupt_disable();
 
-  t = scheduler_current_thread[_interrupt_getcpu()];
+  t = percpu_this()->current_thread;
 
   _interrupt_set_state(intr_status);
 
@@ -271,7 +322,7 @@ thread_table_t *thread_get_current_thread_entry(void)
 
   intr_status = _interrupt_disable();
 
-  t = scheduler_current_thread[_interrupt_getcpu()];
+  t = percpu_this()->current_thread;
 
   _interrupt_set_state(intr_status);
 
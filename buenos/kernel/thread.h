@@ -72,17 +72,31 @@ typedef struct {
 
   /* PID. */
   process_id_t process_id;
-  /* pointer to the next thread in list (<0 = end of list) */
+  /* pointer to the next thread in list (<0 = end of list); the ready
+     list for runnable threads, the free list for THREAD_FREE ones */
   TID_t next;
+  /* bottom of this thread's kernel stack */
+  uint32_t stack;
+
+  /* resources used by this thread, added to its process when it exits: timer
+     ticks and TLB refills while it ran, charged by the scheduler, page faults
+     handled, syscalls made and bytes read and written through them */
+  uint32_t cpu_ticks;
+  uint32_t tlb_refills;
+  uint32_t page_faults;
+  uint32_t syscalls;
+  uint32_t bytes_read;
+  uint32_t bytes_written;
 
   /* pad to 64 bytes */
-  uint32_t dummy_alignment_fill[9];
+  uint32_t dummy_alignment_fill[2];
 } thread_table_t;
 
 /* function prototypes */
 void thread_table_init(void);
 TID_t thread_create(void (*func)(uint32_t), uint32_t arg);
 void thread_run(TID_t t);
+void thread_release(TID_t t);
 
 TID_t thread_get_current_thread(void);
 thread_table_t *thread_get_current_thread_entry(void);
@@ -45,6 +45,67 @@
 #include "kernel/panic.h"
 #include "kernel/assert.h"
 
+/* Number of leading zero bits in x, which must not be zero.  GCC has a
+   builtin for this, but without MIPS32 it calls libgcc, which the kernel
+   is not linked with. */
+static int bitmap_clz(uint32_t x)
+{
+#if defined(__GNUC__) && !(defined(__mips) && __mips < 32)
+  return __builtin_clz(x);
+#else
+  int n = 0;
+
+  if ((x & 0xffff0000) == 0) { n += 16; x <<= 16; }
+  if ((x & 0xff000000) == 0) { n += 8; x <<= 8; }
+  if ((x & 0xf0000000) == 0) { n += 4; x <<= 4; }
+  if ((x & 0xc0000000) == 0) { n += 2; x <<= 2; }
+  if ((x & 0x80000000) == 0) { n += 1; }
+  return n;
+#endif
+}
+
+/* Index of the lowest zero bit in word, which must not be all ones.
+   ~word & (word + 1) leaves only that bit set. */
+static int bitmap_word_ffz(uint32_t word)
+{
+  return 31 - bitmap_clz(~word & (word + 1));
+}
+
+/* Number of set bits in word. */
+static int bitmap_word_popcount(uint32_t word)
+{
+  word = word - ((word >> 1) & 0x55555555);
+  word = (word & 0x33333333) + ((word >> 2) & 0x33333333);
+  word = (word + (word >> 4)) & 0x0f0f0f0f;
+  return (word * 0x01010101) >> 24;
+}
+
+/* Finds the first bit from start on, below l, that differs from value.
+   Returns its position, or -1 if there is none. */
+static int bitmap_find(bitmap_t *bitmap, int l, int start, int value)
+{
+  uint32_t flip = value ? 0 : 0xffffffff;
+  uint32_t word;
+  int i, pos;
+
+  if (start >= l) {
+    return -1;
+  }
+
+  /* The bits below start are made to look like value. */
+  i = start / 32;
+  word = (bitmap[i] ^ flip) | ((1U << (start % 32)) - 1);
+  while (word == 0xffffffff) {
+    if (++i >= (l + 31) / 32) {
+      return -1;
+    }
+    word = bitmap[i] ^ flip;
+  }
+
+  pos = i * 32 + bitmap_word_ffz(word);
+  return pos < l ? pos : -1;
+}
+
 /**
  * Calculates the memory size in bytes needed to store a given number
  * of bits in a bitmap. The size of the bitmap will be a multiple of
@@ -129,6 +190,81 @@ void bitmap_set(bitmap_t *bitmap, int pos, int value)
 }
 
 
+/**
+ * Counts the ones in the bitmap.
+ *
+ * @param bitmap The bitmap
+ *
+ * @param l Length of bitmap in bits
+ *
+ * @return Number of bits set.
+ */
+int bitmap_count(bitmap_t *bitmap, int l)
+{
+  int i, count = 0;
+
+  KERNEL_ASSERT(l >= 0);
+
+  for (i = 0; i < l / 32; i++) {
+    count += bitmap_word_popcount(bitmap[i]);
+  }
+  if (l % 32 != 0) {
+    count += bitmap_word_popcount(bitmap[i] & ((1U << (l % 32)) - 1));
+  }
+  return count;
+}
+
+/**
+ * Sets a range of bits in the bitmap, a word at a time.
+ *
+ * @param bitmap The bitmap
+ *
+ * @param pos The index of the first bit to set
+ *
+ * @param count The number of bits to set
+ *
+ * @param value The new value of the bits. Valid values are 0 and 1.
+ */
+void bitmap_setrange(bitmap_t *bitmap, int pos, int count, int value)
+{
+  uint32_t mask;
+  int n;
+
+  KERNEL_ASSERT(pos >= 0 && count >= 0);
+  if (value != 0 && value != 1) {
+    KERNEL_PANIC("bit value other than 0 or 1");
+  }
+
+  while (count > 0) {
+    n = MIN(32 - pos % 32, count);
+    mask = (n == 32 ? 0xffffffff : (1U << n) - 1) << (pos % 32);
+    if (value) {
+      bitmap[pos / 32] |= mask;
+    } else {
+      bitmap[pos / 32] &= ~mask;
+    }
+    pos += n;
+    count -= n;
+  }
+}
+
+/**
+ * Finds the first zero at or after a given position.
+ *
+ * @param bitmap The bitmap
+ *
+ * @param l Length of bitmap in bits
+ *
+ * @param start Position to start looking from
+ *
+ * @return Position of the zero. Negative if there is none.
+ */
+int bitmap_findzero(bitmap_t *bitmap, int l, int start)
+{
+  KERNEL_ASSERT(l >= 0 && start >= 0);
+  return bitmap_find(bitmap, l, start, 1);
+}
+
 /**
  * Finds first zero and sets it to one.
  *
@@ -141,35 +277,66 @@ void bitmap_set(bitmap_t *bitmap, int pos, int value)
 
 int bitmap_findnset(bitmap_t *bitmap, int l)
 {
-  int i,j;
+  int pos;
 
   KERNEL_ASSERT(l >= 0);
 
-  /* Loop through words until a one with at least one free bit is found. */
-  for (i = 0; i < bitmap_sizeof(l)/4; i++) {
-    if (bitmap[i] != 0xffffffff) {
-      /* At least one bit in this word is zero */
-      int basepos=i*32; /* Bit position of the first bit in this word. */
-
-      /* Loop through the bits in the word until the free bit is found.*/
-      for (j = 0; j < 32; j++) {
-        if (bitmap_get(bitmap, basepos+j) == 0) {
-          if (basepos+j >= l) {
-            /* we are in the last word in the bitmap, but
-               it is not fully in use and the first "free"
-               bit is in unused portion -> return "not found". */
-            return -1;
-          }
-
-          bitmap_set(bitmap, basepos+j, 1);
-          return (basepos+j);
-        }
-      }
-    }
+  pos = bitmap_find(bitmap, l, 0, 1);
+  if (pos >= 0) {
+    bitmap_set(bitmap, pos, 1);
   }
+  return pos;
+}
 
-  /* No free slots found */
+/* Finds count consecutive zeros starting between start and end, and below
+   l.  Returns the position of the first, or -1. */
+static int bitmap_findrange(bitmap_t *bitmap, int l, int start, int end,
+                            int count)
+{
+  int pos = start, one;
+
+  while ((pos = bitmap_find(bitmap, MIN(end, l), pos, 1)) >= 0) {
+    if (pos + count > l) {
+      return -1;
+    }
+    one = bitmap_find(bitmap, pos + count, pos, 0);
+    if (one < 0) {
+      return pos;
+    }
+    pos = one;
+  }
   return -1;
 }
 
+/**
+ * Finds count consecutive zeros and sets them to one. The search
+ * starts from a hint, usually where the previous one ended, and wraps
+ * around to the start of the bitmap.
+ *
+ * @param bitmap The bitmap
+ *
+ * @param l Length of bitmap in bits
+ *
+ * @param count Number of bits to find, at least 1
+ *
+ * @param hint Position to start looking from
+ *
+ * @return Number of the first bit set. Negative if failed.
+ */
+int bitmap_findnset_range(bitmap_t *bitmap, int l, int count, int hint)
+{
+  int pos;
+
+  KERNEL_ASSERT(l >= 0 && count > 0 && hint >= 0);
+
+  pos = bitmap_findrange(bitmap, l, hint, l, count);
+  if (pos < 0) {
+    pos = bitmap_findrange(bitmap, l, 0, MIN(hint, l), count);
+  }
+  if (pos >= 0) {
+    bitmap_setrange(bitmap, pos, count, 1);
+  }
+  return pos;
+}
+
 /** @} */
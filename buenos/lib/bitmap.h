@@ -46,5 +46,9 @@ void bitmap_init(bitmap_t *bitmap, int size);
 int bitmap_get(bitmap_t *bitmap, int pos);
 void bitmap_set(bitmap_t *bitmap, int pos, int value);
 int bitmap_findnset(bitmap_t *bitmap, int l);
+int bitmap_count(bitmap_t *bitmap, int l);
+void bitmap_setrange(bitmap_t *bitmap, int pos, int count, int value);
+int bitmap_findzero(bitmap_t *bitmap, int l, int start);
+int bitmap_findnset_range(bitmap_t *bitmap, int l, int count, int hint);
 
 #endif /* BUENOS_LIB_BITMAP_H */
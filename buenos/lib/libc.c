@@ -37,6 +37,7 @@
 #include "lib/libc.h"
 #include "drivers/polltty.h"
 #include "kernel/interrupt.h"
+#include "drivers/yams.h"
 
 /* Declarations for assembler subroutines */
 extern void _hwstop(void);
@@ -166,10 +167,27 @@ char *stringcopy(char *target, const char *source, int buflen)
 }
 
 
+/* Combine the last bytes of word first with the first bytes of word second,
+   as if second followed first in memory and the result started shift bits
+   into first.  YAMS is big-endian, so lower addresses are the more
+   significant bytes. */
+#if __BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__
+#define MEMCOPY_MERGE(first, second, shift) \
+  (((first) >> (shift)) | ((second) << (32 - (shift))))
+#else
+#define MEMCOPY_MERGE(first, second, shift) \
+  (((first) << (shift)) | ((second) >> (32 - (shift))))
+#endif
+
 /**
  * Copies memory buffer of size buflen from source to target. The
  * target buffer should be at least buflen long.
  *
+ * The target is first aligned to a word.  If the source then is too,
+ * eight words are copied per iteration.  Otherwise the source is read
+ * a word at a time, and each target word is shifted together from two
+ * source words, so no unaligned access is ever made.
+ *
  * @param buflen The number of bytes to be copied.
  *
  * @param target The target buffer of the copy operation.
@@ -179,41 +197,113 @@ char *stringcopy(char *target, const char *source, int buflen)
  */
 void memcopy(int buflen, void *target, const void *source)
 {
-  int i;
-  char *t;
-  const char *s;
+  uint8_t *t = (uint8_t *) target;
+  const uint8_t *s = (const uint8_t *) source;
   uint32_t *tgt;
   const uint32_t *src;
-
-  tgt = (uint32_t *) target;
-  src = (uint32_t *) source;
-
-  if(((uint32_t)tgt % 4) != 0 || ((uint32_t)src % 4) != 0 ) {
-    t = (char *)tgt;
-    s = (const char *)src;
-
-    for(i = 0; i < buflen; i++) {
-      t[i] = s[i];
+  uint32_t prev, next;
+  int shift, words;
+
+  /* Short copies are not worth setting up the word loops for. */
+  if (buflen >= 16) {
+    while (((uint32_t) t & 3) != 0) {
+      *t++ = *s++;
+      buflen--;
+    }
+    tgt = (uint32_t *) t;
+    words = buflen / 4;
+
+    if (((uint32_t) s & 3) == 0) {
+      src = (const uint32_t *) s;
+      for (; words >= 8; words -= 8) {
+        tgt[0] = src[0];
+        tgt[1] = src[1];
+        tgt[2] = src[2];
+        tgt[3] = src[3];
+        tgt[4] = src[4];
+        tgt[5] = src[5];
+        tgt[6] = src[6];
+        tgt[7] = src[7];
+        tgt += 8;
+        src += 8;
+      }
+      for (; words > 0; words--) {
+        *tgt++ = *src++;
+      }
+      s = (const uint8_t *) src;
+    } else {
+      /* Only whole source words holding bytes to be copied are read, so
+         this never touches memory outside the source buffer's words. */
+      shift = ((uint32_t) s & 3) * 8;
+      src = (const uint32_t *) (s - shift / 8);
+      s += (buflen & ~3);
+      prev = *src++;
+      for (; words >= 4; words -= 4) {
+        next = src[0];
+        tgt[0] = MEMCOPY_MERGE(prev, next, shift);
+        prev = src[1];
+        tgt[1] = MEMCOPY_MERGE(next, prev, shift);
+        next = src[2];
+        tgt[2] = MEMCOPY_MERGE(prev, next, shift);
+        prev = src[3];
+        tgt[3] = MEMCOPY_MERGE(next, prev, shift);
+        tgt += 4;
+        src += 4;
+      }
+      for (; words > 0; words--) {
+        next = *src++;
+        *tgt++ = MEMCOPY_MERGE(prev, next, shift);
+        prev = next;
+      }
     }
 
-    return;
+    t = (uint8_t *) tgt;
+    buflen &= 3;
   }
 
-  for(i = 0; i < (buflen/4); i++) {
-    *tgt = *src;
-    tgt++;
-    src++;
+  while (buflen-- > 0) {
+    *t++ = *s++;
   }
+}
 
 
-  t = (char *)tgt;
-  s = (const char *)src;
+/**
+ * Copies one page.  Both addresses must be page aligned.  Each
+ * iteration loads eight words before storing them, so the loads are
+ * not stalled waiting for the stores.
+ *
+ * @param target The page to copy to.
+ *
+ * @param source The page to copy from.
+ *
+ */
+void memcopy_page(void *target, const void *source)
+{
+  uint32_t *tgt = (uint32_t *) target;
+  const uint32_t *src = (const uint32_t *) source;
+  uint32_t w0, w1, w2, w3, w4, w5, w6, w7;
+  int i;
 
-  for(i = 0; i < (buflen%4); i++) {
-    t[i] = s[i];
+  for (i = 0; i < PAGE_SIZE / 4; i += 8) {
+    w0 = src[0];
+    w1 = src[1];
+    w2 = src[2];
+    w3 = src[3];
+    w4 = src[4];
+    w5 = src[5];
+    w6 = src[6];
+    w7 = src[7];
+    tgt[0] = w0;
+    tgt[1] = w1;
+    tgt[2] = w2;
+    tgt[3] = w3;
+    tgt[4] = w4;
+    tgt[5] = w5;
+    tgt[6] = w6;
+    tgt[7] = w7;
+    tgt += 8;
+    src += 8;
   }
-
-  return;
 }
 
 
@@ -229,12 +319,68 @@ void memcopy(int buflen, void *target, const void *source)
  */
 void memoryset(void *target, char value, int size)
 {
+  uint8_t *t = (uint8_t *) target;
+  uint32_t *tgt;
+  uint32_t word;
+  int words;
+
+  if (size >= 16) {
+    while (((uint32_t) t & 3) != 0) {
+      *t++ = value;
+      size--;
+    }
+    word = (uint8_t) value;
+    word |= word << 8;
+    word |= word << 16;
+    tgt = (uint32_t *) t;
+
+    for (words = size / 4; words >= 8; words -= 8) {
+      tgt[0] = word;
+      tgt[1] = word;
+      tgt[2] = word;
+      tgt[3] = word;
+      tgt[4] = word;
+      tgt[5] = word;
+      tgt[6] = word;
+      tgt[7] = word;
+      tgt += 8;
+    }
+    for (; words > 0; words--) {
+      *tgt++ = word;
+    }
+
+    t = (uint8_t *) tgt;
+    size &= 3;
+  }
+
+  while (size-- > 0) {
+    *t++ = value;
+  }
+}
+
+
+/**
+ * Zeroes one page.  The address must be page aligned.
+ *
+ * @param target The page to zero.
+ *
+ */
+void memzero_page(void *target)
+{
+  uint32_t *tgt = (uint32_t *) target;
   int i;
-  char *tgt;
 
-  tgt = (char *)target;
-  for(i = 0; i < size; i++)
-    tgt[i] = value;
+  for (i = 0; i < PAGE_SIZE / 4; i += 8) {
+    tgt[0] = 0;
+    tgt[1] = 0;
+    tgt[2] = 0;
+    tgt[3] = 0;
+    tgt[4] = 0;
+    tgt[5] = 0;
+    tgt[6] = 0;
+    tgt[7] = 0;
+    tgt += 8;
+  }
 }
 
 /** Converts the initial portion of a string to an integer
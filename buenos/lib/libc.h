@@ -70,9 +70,11 @@ int strlen(const char *str);
 
 /* memory copy */
 void memcopy(int buflen, void *target, const void *source);
+void memcopy_page(void *target, const void *source);
 
 /* memory set */
 void memoryset(void *target, char value, int size);
+void memzero_page(void *target);
 
 /* convert string to integer */
 int atoi(const char *s);
@@ -40,6 +40,7 @@
 #include "kernel/thread.h"
 #include "kernel/exception.h"
 #include "vm/tlb.h"
+#include "proc/process.h"
 
 void syscall_handle(context_t *user_context);
 
@@ -115,6 +116,10 @@ void user_exception_handle(int exception)
     KERNEL_PANIC("Unknown exception");
   }
 
+  /* If another thread of the process has called exit, do not return to
+     userland. */
+  process_check_exiting();
+
   /* Interrupts are disabled by setting EXL after this point. */
   _interrupt_set_EXL();
   _interrupt_enable();
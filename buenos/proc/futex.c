@@ -0,0 +1,151 @@
+#include "proc/futex.h"
+#include "kernel/spinlock.h"
+#include "kernel/sleepq.h"
+#include "kernel/thread.h"
+#include "kernel/interrupt.h"
+#include "vm/vm.h"
+#include "vm/pagepool.h"
+#include "proc/process.h"
+#include "drivers/yams.h"
+
+/* Futexes let userland keep its synchronization state in ordinary memory and
+   only trap into the kernel when a thread actually has to sleep or someone has
+   to be woken.  Waiters are keyed by the physical address of the futex word,
+   so the same word reached through different virtual addresses (e.g. a page
+   shared between processes) is still the same futex.  The threads themselves
+   sleep in the ordinary sleep queue; the buckets here only serialize the
+   "check value, then sleep" step against concurrent wakers. */
+
+static spinlock_t futex_bucket_slock[FUTEX_HASHTABLE_SIZE];
+
+#define FUTEX_HASH(key) (((uint32_t)(key) >> 2) % FUTEX_HASHTABLE_SIZE)
+
+void futex_init() {
+  int i;
+  for (i = 0; i < FUTEX_HASHTABLE_SIZE; i++) {
+    spinlock_reset(&futex_bucket_slock[i]);
+  }
+}
+
+/* Find the kernel address of the futex word at the user address `addr` in the
+   current process, or NULL if it is not an aligned user address of the
+   process.  Going through the unmapped kernel segment means we can read the
+   word with interrupts disabled without risking a TLB exception.  A page that
+   is swapped out or not yet touched is mapped first.  The page is pinned with
+   a reference, so that it is not swapped out, and its waiters lost, until
+   `futex_unpin`. */
+static int* futex_key(int* addr) {
+  interrupt_status_t intr_status;
+  process_control_block_t *process;
+  uint32_t vaddr = (uint32_t) addr;
+  uint32_t phys;
+  pagetable_t *pagetable;
+
+  if (vaddr == 0 || vaddr >= 0x80000000 || (vaddr & 0x3) != 0) {
+    return NULL;
+  }
+
+  pagetable = thread_get_current_thread_entry()->pagetable;
+  if (pagetable == NULL) {
+    return NULL;
+  }
+  process = process_get_current_process_entry();
+
+  intr_status = _interrupt_disable();
+  if (vm_translate(pagetable, vaddr) == 0) {
+    /* Map the page like a TLB miss on it would. */
+    process_demand_page(vaddr, true);
+  }
+  /* A write to a copy-on-write page would move it away from its waiters, so
+     make it private now. */
+  process_copy_on_write(vaddr);
+  spinlock_acquire(&process->vm_slock);
+  phys = vm_translate(pagetable, vaddr);
+  if (phys != 0) {
+    pagepool_ref_phys_page(phys & PAGE_SIZE_MASK);
+  }
+  spinlock_release(&process->vm_slock);
+  _interrupt_set_state(intr_status);
+
+  if (phys == 0) {
+    return NULL;
+  }
+  return (int*) ADDR_PHYS_TO_KERNEL(phys);
+}
+
+/* Drop the reference taken by `futex_key`. */
+static void futex_unpin(int* key) {
+  pagepool_free_phys_page(ADDR_KERNEL_TO_PHYS((uint32_t) key) & PAGE_SIZE_MASK);
+}
+
+/* Sleep until woken by `futex_wake`, provided that `*addr` still equals
+   `value`.  Returns 0 after being woken, or FUTEX_ERROR_WOULD_BLOCK if the
+   value had already changed. */
+int futex_wait(int* addr, int value) {
+  interrupt_status_t intr_status;
+  spinlock_t *slock;
+  int* key = futex_key(addr);
+
+  if (key == NULL) {
+    return FUTEX_ERROR_INVALID_ADDRESS;
+  }
+  slock = &futex_bucket_slock[FUTEX_HASH(key)];
+
+  intr_status = _interrupt_disable();
+  spinlock_acquire(slock);
+
+  /* A thread of an exiting process does not go to sleep, since it would
+     not be woken. */
+  if (*key != value || !process_futex_sleep(key)) {
+    spinlock_release(slock);
+    _interrupt_set_state(intr_status);
+    futex_unpin(key);
+    return FUTEX_ERROR_WOULD_BLOCK;
+  }
+
+  sleepq_add(key);
+  spinlock_release(slock);
+  thread_switch();
+
+  process_futex_sleep(NULL);
+  _interrupt_set_state(intr_status);
+  futex_unpin(key);
+  return 0;
+}
+
+/* Wake at most `count` threads sleeping on the futex at `addr`.  Returns the
+   number of threads woken. */
+int futex_wake(int* addr, int count) {
+  interrupt_status_t intr_status;
+  spinlock_t *slock;
+  int woken;
+  int* key = futex_key(addr);
+
+  if (key == NULL) {
+    return FUTEX_ERROR_INVALID_ADDRESS;
+  }
+  slock = &futex_bucket_slock[FUTEX_HASH(key)];
+
+  intr_status = _interrupt_disable();
+  spinlock_acquire(slock);
+  woken = sleepq_wake_n(key, count);
+  spinlock_release(slock);
+  _interrupt_set_state(intr_status);
+  futex_unpin(key);
+
+  return woken;
+}
+
+/* Wake every thread sleeping on the futex with the kernel address `key`.  Used
+   to make the threads of an exiting process notice it, see `process_finish`;
+   the other threads woken see a spurious wakeup. */
+void futex_wake_key(int* key) {
+  interrupt_status_t intr_status;
+  spinlock_t *slock = &futex_bucket_slock[FUTEX_HASH(key)];
+
+  intr_status = _interrupt_disable();
+  spinlock_acquire(slock);
+  sleepq_wake_all(key);
+  spinlock_release(slock);
+  _interrupt_set_state(intr_status);
+}
@@ -0,0 +1,20 @@
+#ifndef BUENOS_PROC_FUTEX_H
+#define BUENOS_PROC_FUTEX_H
+
+#include "lib/types.h"
+
+/* Number of futex hash buckets (prime number). */
+#define FUTEX_HASHTABLE_SIZE 61
+
+#define FUTEX_ERROR_INVALID_ADDRESS -1
+#define FUTEX_ERROR_WOULD_BLOCK -2
+
+void futex_init();
+
+int futex_wait(int* addr, int value);
+
+int futex_wake(int* addr, int count);
+
+void futex_wake_key(int* key);
+
+#endif
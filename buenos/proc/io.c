@@ -31,6 +31,7 @@
 #include "proc/syscall.h"
 
 #include "proc/io.h"
+#include "kernel/thread.h"
 
 /** @name Userland I/O support.
  *
@@ -155,6 +156,9 @@ int io_read(openfile_t file, void* buffer, int length)
     }
   }
 
+  if (res > 0) {
+    thread_get_current_thread_entry()->bytes_read += res;
+  }
   return res;
 }
 
@@ -191,6 +195,9 @@ int io_write(int file, void* buffer, int length)
     }
   }
 
+  if (res > 0) {
+    thread_get_current_thread_entry()->bytes_written += res;
+  }
   return res;
 }
 
@@ -211,6 +218,8 @@ openfile_t io_open(const char* pathname)
 int io_close(openfile_t file) {
   file -= 3;
   if (!process_has_open_file(file)) return VFS_NOT_OPEN_IN_PROCESS;
+  /* The mappings of the file end with it. */
+  process_munmap_file(file);
   process_remove_file(file);
   return vfs_close(file);
 }
@@ -227,6 +236,22 @@ int io_tell(openfile_t file) {
   return vfs_tell(file);
 }
 
+/**
+ * Maps length bytes of the file identified by filehandle, starting at offset,
+ * into the address space of the process. See process_mmap.
+ *
+ * @return The address of the mapping, or NULL on error.
+ */
+void *io_mmap(openfile_t file, int offset, int length) {
+  file -= 3;
+  if (!process_has_open_file(file) || offset < 0 || length < 0) return NULL;
+  return (void *) process_mmap(file, offset, length);
+}
+
+int io_munmap(void *addr) {
+  return process_munmap((uint32_t) addr);
+}
+
 int io_create(const char* pathname, int size) {
   return vfs_create(pathname, size);
 }
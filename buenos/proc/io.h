@@ -37,6 +37,9 @@ int io_close(openfile_t file);
 int io_seek(openfile_t file, int offset);
 int io_tell(openfile_t file);
 
+void *io_mmap(openfile_t file, int offset, int length);
+int io_munmap(void *addr);
+
 int io_create(const char* pathname, int size);
 int io_remove(const char* pathname);
 
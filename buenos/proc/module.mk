@@ -4,7 +4,8 @@
 MODULE := proc
 
 
-FILES := exception.c elf.c process.c syscall.c usr_sem.c io.c
+FILES := exception.c elf.c process.c syscall.c usr_sem.c io.c futex.c \
+         usr_name.c usr_barrier.c usr_event.c usr_shm.c
 
 SRC += $(patsubst %, $(MODULE)/%, $(FILES))
 
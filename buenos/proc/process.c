@@ -34,15 +34,23 @@
 
 #include "proc/process.h"
 #include "proc/elf.h"
+#include "proc/futex.h"
+#include "proc/usr_shm.h"
+#include "proc/syscall.h"
 #include "kernel/thread.h"
 #include "kernel/assert.h"
 #include "kernel/interrupt.h"
 #include "kernel/sleepq.h"
 #include "kernel/config.h"
+#include "kernel/percpu.h"
 #include "fs/vfs.h"
 #include "drivers/yams.h"
+#include "drivers/timer.h"
 #include "vm/vm.h"
 #include "vm/pagepool.h"
+#include "vm/pagecache.h"
+#include "vm/swap.h"
+#include "vm/tlb.h"
 #include "lib/types.h"
 
 /** @name Process startup
@@ -57,6 +65,224 @@ process_control_block_t process_table[PROCESS_MAX_PROCESSES];
 /* We need a spinlock to lock accesses to the process table. */
 spinlock_t process_table_slock;
 
+/* Import thread table from thread.c, for the resources used by each thread. */
+extern thread_table_t thread_table[CONFIG_MAX_THREADS];
+
+/* Number of processes reading their program from each open file.  A forked
+   child shares the executable of its parent, so that it does not depend on
+   the path still naming the same file.  Protected by the process table
+   lock. */
+static int process_executable_refs[CONFIG_MAX_OPEN_FILES];
+
+/* Drop the reference of process `pcb` to its executable.  Returns the file if
+   that was the last reference, or -1.  Closing it may block, so it is up to
+   the caller, after releasing the process table lock, which is held. */
+static openfile_t process_drop_executable(process_control_block_t *pcb)
+{
+  openfile_t file = pcb->executable_file;
+
+  pcb->executable_file = -1;
+  if (file < 0 || --process_executable_refs[file] > 0) {
+    return -1;
+  }
+  return file;
+}
+
+/* Distance between the stack tops of two consecutive thread slots.  Each
+   stack has room to grow to CONFIG_USERLAND_STACK_SIZE pages, and one page
+   between each pair of stacks is left unmapped, so that a stack overflow faults
+   instead of silently running into the neighbouring stack. */
+#define PROCESS_STACK_STRIDE ((CONFIG_USERLAND_STACK_SIZE + 1) * PAGE_SIZE)
+
+/* Return the initial stack pointer of the thread in `slot`. */
+static uint32_t process_stack_top(int slot)
+{
+  return USERLAND_STACK_TOP - slot * PROCESS_STACK_STRIDE;
+}
+
+/* Whether the page at `page` belongs to one of the thread stacks of
+   `process`, within its stack limit.  Stack pages are mapped on first touch,
+   so this is how far a stack can grow. */
+static bool process_in_stack(process_control_block_t *process, uint32_t page)
+{
+  uint32_t top = USERLAND_STACK_TOP & PAGE_SIZE_MASK;
+  uint32_t offset;
+
+  if (page > top) {
+    return false;
+  }
+  offset = top - page;
+  return offset < PROCESS_MAX_THREADS * PROCESS_STACK_STRIDE &&
+    offset % PROCESS_STACK_STRIDE < process->stack_limit * PAGE_SIZE;
+}
+
+/* Files are mapped in windows below the stacks, the first one highest.  Like
+   the stacks, the windows are separated by an unmapped page. */
+#define PROCESS_MAPPING_STRIDE ((PROCESS_MAPPING_PAGES + 1) * PAGE_SIZE)
+#define PROCESS_MAPPINGS_TOP \
+  ((USERLAND_STACK_TOP & PAGE_SIZE_MASK) - \
+   PROCESS_MAX_THREADS * PROCESS_STACK_STRIDE)
+
+/* The heap may not grow closer to the mappings than this. */
+#define PROCESS_HEAP_LIMIT \
+  (PROCESS_MAPPINGS_TOP - PROCESS_MAX_MAPPINGS * PROCESS_MAPPING_STRIDE)
+
+/* Most pages unmapped from a process before they are freed together. */
+#define PROCESS_FREE_BATCH 16
+
+/* Return the address of the first page of the mapping in `index`. */
+static uint32_t process_mapping_start(int index)
+{
+  return PROCESS_MAPPINGS_TOP - (index + 1) * PROCESS_MAPPING_STRIDE;
+}
+
+/* Return the mapping of `process` that the page at `page` belongs to, and set
+   `*index` to the number of the page in it.  Returns NULL if the page is not
+   in a mapping. */
+static process_mapping_t *process_in_mapping(process_control_block_t *process,
+                                             uint32_t page, uint32_t *index)
+{
+  process_mapping_t *mapping;
+  uint32_t offset;
+
+  if (page < PROCESS_HEAP_LIMIT || page >= PROCESS_MAPPINGS_TOP) {
+    return NULL;
+  }
+  offset = page - PROCESS_HEAP_LIMIT;
+  mapping = &process->mappings[PROCESS_MAX_MAPPINGS - 1 -
+                               offset / PROCESS_MAPPING_STRIDE];
+  *index = offset % PROCESS_MAPPING_STRIDE / PAGE_SIZE;
+  if ((mapping->file < 0 && mapping->shm == NULL) ||
+      *index >= mapping->pages) {
+    return NULL;
+  }
+  return mapping;
+}
+
+/* Remove the mapping in `index` from `process`.  The pages of a file that
+   were written to are written back to it, and a shared memory segment loses a
+   reference.  The pages are unmapped in batches, and each batch is only
+   written back and freed when no CPU can reach its pages through the TLB
+   anymore.  If `file` is not negative, only a mapping of that file is
+   removed.  May block.  Returns 0, PROCESS_ILLEGAL_MAPPING if there is no such
+   mapping, or the error of a failed write. */
+static int process_unmap(process_control_block_t *process, int index,
+                         openfile_t file)
+{
+  interrupt_status_t intr_status;
+  process_mapping_t *mapping = &process->mappings[index];
+  pagetable_entry_t *entry;
+  uint32_t unmapped[PROCESS_FREE_BATCH], indices[PROCESS_FREE_BATCH];
+  bool dirty[PROCESS_FREE_BATCH];
+  uint32_t offset, page, i;
+  int count, written, result = 0;
+  void *shm;
+
+  intr_status = _interrupt_disable();
+  spinlock_acquire(&process->vm_slock);
+  if ((mapping->file < 0 && mapping->shm == NULL) ||
+      (file >= 0 && mapping->file != file)) {
+    spinlock_release(&process->vm_slock);
+    _interrupt_set_state(intr_status);
+    return PROCESS_ILLEGAL_MAPPING;
+  }
+  /* No more pages are faulted in.  The entry is not reused before its pages
+     are unmapped, since `pages` stays set until then. */
+  file = mapping->file;
+  shm = mapping->shm;
+  offset = mapping->offset;
+  mapping->file = -1;
+  mapping->shm = NULL;
+  spinlock_release(&process->vm_slock);
+  _interrupt_set_state(intr_status);
+
+  i = 0;
+  while (i < mapping->pages) {
+    count = 0;
+    intr_status = _interrupt_disable();
+    spinlock_acquire(&process->vm_slock);
+    for (; i < mapping->pages && count < PROCESS_FREE_BATCH; i++) {
+      page = process_mapping_start(index) + i * PAGE_SIZE;
+      if (vm_translate(process->pagetable, page) != 0) {
+        entry = vm_lookup(process->pagetable, page);
+        dirty[count] = file >= 0 &&
+          (ADDR_IS_ON_EVEN_PAGE(page) ? entry->D0 : entry->D1);
+        indices[count] = i;
+        unmapped[count++] = vm_unmap(process->pagetable, page);
+      }
+    }
+    spinlock_release(&process->vm_slock);
+    _interrupt_set_state(intr_status);
+
+    if (count == 0) {
+      continue;
+    }
+    /* Another CPU could otherwise still write to a page while it is written
+       back, or after it is freed. */
+    tlb_shootdown(process->pagetable);
+    for (int j = 0; j < count; j++) {
+      if (dirty[j]) {
+        written = vfs_write_at(file, (void *) ADDR_PHYS_TO_KERNEL(unmapped[j]),
+                               PAGE_SIZE, offset + indices[j] * PAGE_SIZE);
+        if (written < 0) {
+          result = written;
+        }
+      }
+    }
+    pagepool_free_phys_pages(unmapped, count);
+  }
+
+  if (shm != NULL) {
+    usr_shm_unref(shm);
+  }
+
+  intr_status = _interrupt_disable();
+  spinlock_acquire(&process->vm_slock);
+  mapping->pages = 0;
+  spinlock_release(&process->vm_slock);
+  _interrupt_set_state(intr_status);
+  return result;
+}
+
+/* Add the resources in `from` to those in `to`. */
+static void process_add_rusage(process_rusage_t *to, process_rusage_t *from)
+{
+  to->cpu_ticks += from->cpu_ticks;
+  to->tlb_refills += from->tlb_refills;
+  to->page_faults += from->page_faults;
+  to->pages_resident = MAX(to->pages_resident, from->pages_resident);
+  to->syscalls += from->syscalls;
+  to->bytes_read += from->bytes_read;
+  to->bytes_written += from->bytes_written;
+}
+
+/* Add the resources used so far by `thread` to those in `to`. */
+static void process_add_thread_rusage(process_rusage_t *to,
+                                      thread_table_t *thread)
+{
+  to->cpu_ticks += thread->cpu_ticks;
+  to->tlb_refills += thread->tlb_refills;
+  to->page_faults += thread->page_faults;
+  to->syscalls += thread->syscalls;
+  to->bytes_read += thread->bytes_read;
+  to->bytes_written += thread->bytes_written;
+}
+
+/* Return the slot of the calling thread in its process. */
+static int process_current_thread_slot(process_control_block_t *pcb)
+{
+  TID_t tid = thread_get_current_thread();
+
+  for (int i = 0; i < PROCESS_MAX_THREADS; i++) {
+    if (pcb->threads[i].state == PROCESS_THREAD_RUNNING &&
+        pcb->threads[i].tid == tid) {
+      return i;
+    }
+  }
+  KERNEL_PANIC("Thread not found in its process.");
+  return -1;
+}
+
 /**
  * Starts one userland process. The thread calling this function will
  * be used to run the process and will therefore never return from
@@ -71,34 +297,42 @@ spinlock_t process_table_slock;
 void process_start(process_id_t pid)
 {
   thread_table_t *my_entry;
+  process_control_block_t *pcb;
   pagetable_t *pagetable;
-  uint32_t phys_page;
   context_t user_context;
-  uint32_t stack_bottom;
   elf_info_t elf;
   openfile_t file;
   char *executable;
 
-  int i;
-
   interrupt_status_t intr_status;
 
   my_entry = thread_get_current_thread_entry();
   /* Associate the process' kernel thread with the pid. */
   my_entry->process_id = pid;
   /* Get the executable from the process in the process table. */
-  executable = process_table[pid].executable;
+  pcb = &process_table[pid];
+  executable = pcb->executable;
 
   /* If the pagetable of this thread is not NULL, we are trying to
      run a userland process for a second time in the same thread.
      This is not possible. */
   KERNEL_ASSERT(my_entry->pagetable == NULL);
 
-  pagetable = vm_create_pagetable(thread_get_current_thread());
+  do {
+    pagetable = vm_create_pagetable();
+  } while (pagetable == NULL && process_reclaim_page());
   KERNEL_ASSERT(pagetable != NULL);
 
   intr_status = _interrupt_disable();
   my_entry->pagetable = pagetable;
+  tlb_activate(pagetable);
+  spinlock_acquire(&process_table_slock);
+  /* The process starts out with this thread in slot 0. */
+  pcb->pagetable = pagetable;
+  pcb->threads[0].state = PROCESS_THREAD_RUNNING;
+  pcb->threads[0].tid = thread_get_current_thread();
+  pcb->thread_count = 1;
+  spinlock_release(&process_table_slock);
   _interrupt_set_state(intr_status);
 
   file = vfs_open((char *)executable);
@@ -109,79 +343,77 @@ void process_start(process_id_t pid)
   /* Trivial and naive sanity check for entry point: */
   KERNEL_ASSERT(elf.entry_point >= PAGE_SIZE);
 
-  /* Allocate and map stack */
-  for(i = 0; i < CONFIG_USERLAND_STACK_SIZE; i++) {
-    phys_page = pagepool_get_phys_page();
-    KERNEL_ASSERT(phys_page != 0);
-    vm_map(my_entry->pagetable, phys_page,
-           (USERLAND_STACK_TOP & PAGE_SIZE_MASK) - i*PAGE_SIZE, 1);
-  }
+  /* Make sure that the segments are in proper place.  We assume that segments
+     begin at page boundary.  (The linker script in tests directory creates
+     this kind of segments.)  They are read from the file when first touched,
+     see `process_demand_page`. */
+  KERNEL_ASSERT(elf.ro_size == 0 || elf.ro_vaddr >= PAGE_SIZE);
+  KERNEL_ASSERT(elf.rw_size == 0 || elf.rw_vaddr >= PAGE_SIZE);
+  pcb->executable_file = file;
+  /* No other process reads from a file opened just now. */
+  process_executable_refs[file] = 1;
+  pcb->ro_segment.location = elf.ro_location;
+  pcb->ro_segment.size = elf.ro_size;
+  pcb->ro_segment.pages = elf.ro_pages;
+  pcb->ro_segment.vaddr = elf.ro_vaddr;
+  pcb->rw_segment.location = elf.rw_location;
+  pcb->rw_segment.size = elf.rw_size;
+  pcb->rw_segment.pages = elf.rw_pages;
+  pcb->rw_segment.vaddr = elf.rw_vaddr;
+
+  /* Initialize heap pointer.  Set its current end to just after the program,
+     including its uninitialized data.  Heap and stack pages are mapped on
+     first touch too. */
+  uint32_t heap_end = elf.rw_vaddr + elf.rw_pages * PAGE_SIZE;
+  pcb->heap_start = heap_end;
+  pcb->heap_end = heap_end;
 
-  /* Allocate and map pages for the segments. We assume that
-     segments begin at page boundary. (The linker script in tests
-     directory creates this kind of segments) */
-  for(i = 0; i < (int)elf.ro_pages; i++) {
-    phys_page = pagepool_get_phys_page();
-    KERNEL_ASSERT(phys_page != 0);
-    vm_map(my_entry->pagetable, phys_page,
-           elf.ro_vaddr + i*PAGE_SIZE, 1);
-  }
-
-  for(i = 0; i < (int)elf.rw_pages; i++) {
-    phys_page = pagepool_get_phys_page();
-    KERNEL_ASSERT(phys_page != 0);
-    vm_map(my_entry->pagetable, phys_page,
-           elf.rw_vaddr + i*PAGE_SIZE, 1);
-  }
-
-  /* Initialize heap pointer.  Set its current end to just after the program. */
-  uint32_t heap_end = elf.rw_vaddr + elf.rw_size;
-  process_table[pid].heap_end = heap_end;
-  if (heap_end % PAGE_SIZE == 0) {
-    /* In the unlikely event that the heap should start on the first address of
-       a page, we must allocate that page. */
-    uint32_t phys_page = pagepool_get_phys_page();
-    KERNEL_ASSERT(phys_page != 0);
-    vm_map(pagetable, phys_page, heap_end, 1);
-  }
+  /* Initialize the user context. (Status register is handled by
+     thread_goto_userland) */
+  memoryset(&user_context, 0, sizeof(user_context));
+  user_context.cpu_regs[MIPS_REGISTER_SP] = process_stack_top(0);
+  user_context.pc = elf.entry_point;
 
-  /* Zero the pages. */
-  memoryset((void *)elf.ro_vaddr, 0, elf.ro_pages*PAGE_SIZE);
-  memoryset((void *)elf.rw_vaddr, 0, elf.rw_pages*PAGE_SIZE);
+  thread_goto_userland(&user_context);
 
-  stack_bottom = (USERLAND_STACK_TOP & PAGE_SIZE_MASK) -
-    (CONFIG_USERLAND_STACK_SIZE-1)*PAGE_SIZE;
-  memoryset((void *)stack_bottom, 0, CONFIG_USERLAND_STACK_SIZE*PAGE_SIZE);
+  KERNEL_PANIC("thread_goto_userland failed.");
+}
 
-  /* Copy segments */
+/* Run a new thread of an existing process.  `arg` is the pid times
+   PROCESS_MAX_THREADS plus the slot of the thread, which `process_thread_create`
+   has already filled in. */
+void process_thread_start(uint32_t arg)
+{
+  thread_table_t *my_entry;
+  process_control_block_t *pcb;
+  process_thread_t *self;
+  context_t user_context;
+  process_id_t pid = arg / PROCESS_MAX_THREADS;
+  int slot = arg % PROCESS_MAX_THREADS;
+  interrupt_status_t intr_status;
 
-  if (elf.ro_size > 0) {
-    /* Make sure that the segment is in proper place. */
-    KERNEL_ASSERT(elf.ro_vaddr >= PAGE_SIZE);
-    KERNEL_ASSERT(vfs_seek(file, elf.ro_location) == VFS_OK);
-    KERNEL_ASSERT(vfs_read(file, (void *)elf.ro_vaddr, elf.ro_size)
-                  == (int)elf.ro_size);
-  }
+  pcb = &process_table[pid];
+  self = &pcb->threads[slot];
 
-  if (elf.rw_size > 0) {
-    /* Make sure that the segment is in proper place. */
-    KERNEL_ASSERT(elf.rw_vaddr >= PAGE_SIZE);
-    KERNEL_ASSERT(vfs_seek(file, elf.rw_location) == VFS_OK);
-    KERNEL_ASSERT(vfs_read(file, (void *)elf.rw_vaddr, elf.rw_size)
-                  == (int)elf.rw_size);
-  }
+  my_entry = thread_get_current_thread_entry();
+  KERNEL_ASSERT(my_entry->pagetable == NULL);
 
+  /* Join the address space of the process.  The pagetable carries the ASID of
+     the process, so switch to it right away. */
+  intr_status = _interrupt_disable();
+  my_entry->process_id = pid;
+  my_entry->pagetable = pcb->pagetable;
+  tlb_activate(pcb->pagetable);
+  _interrupt_set_state(intr_status);
 
-  /* Set the dirty bit to zero (read-only) on read-only pages. */
-  for(i = 0; i < (int)elf.ro_pages; i++) {
-    vm_set_dirty(my_entry->pagetable, elf.ro_vaddr + i*PAGE_SIZE, 0);
-  }
+  /* Another thread may have called exit while we were being set up. */
+  process_check_exiting();
 
-  /* Initialize the user context. (Status register is handled by
-     thread_goto_userland) */
   memoryset(&user_context, 0, sizeof(user_context));
-  user_context.cpu_regs[MIPS_REGISTER_SP] = USERLAND_STACK_TOP;
-  user_context.pc = elf.entry_point;
+  user_context.cpu_regs[MIPS_REGISTER_SP] = process_stack_top(slot);
+  user_context.cpu_regs[MIPS_REGISTER_A0] = self->arg0;
+  user_context.cpu_regs[MIPS_REGISTER_A1] = self->arg1;
+  user_context.pc = self->entry;
 
   thread_goto_userland(&user_context);
 
@@ -194,9 +426,33 @@ void process_reset(process_id_t pid) {
   process_table[pid].executable[0] = '\0';
   process_table[pid].retval = 0;
   process_table[pid].parent = -1;
+  process_table[pid].executable_file = -1;
+  memoryset(&process_table[pid].ro_segment, 0, sizeof(process_segment_t));
+  memoryset(&process_table[pid].rw_segment, 0, sizeof(process_segment_t));
+  process_table[pid].heap_start = 0;
+  process_table[pid].heap_end = 0;
+  process_table[pid].stack_limit = CONFIG_USERLAND_STACK_SIZE;
+  process_table[pid].pagetable = NULL;
+  spinlock_reset(&process_table[pid].vm_slock);
+  for (int i = 0; i < PROCESS_MAX_THREADS; i++) {
+    process_table[pid].threads[i].state = PROCESS_THREAD_FREE;
+    process_table[pid].threads[i].tid = -1;
+    process_table[pid].threads[i].retval = 0;
+    process_table[pid].threads[i].futex = NULL;
+  }
+  process_table[pid].thread_count = 0;
+  process_table[pid].exiting = false;
   for (int i = 0; i < CONFIG_MAX_OPEN_FILES; i++) {
     process_table[pid].files[i] = -1;
   }
+  memoryset(&process_table[pid].rusage, 0, sizeof(process_rusage_t));
+  memoryset(&process_table[pid].rusage_children, 0, sizeof(process_rusage_t));
+  for (int i = 0; i < PROCESS_MAX_MAPPINGS; i++) {
+    process_table[pid].mappings[i].file = -1;
+    process_table[pid].mappings[i].shm = NULL;
+    process_table[pid].mappings[i].offset = 0;
+    process_table[pid].mappings[i].pages = 0;
+  }
 }
 
 /* Initialize process table and spinlock. */
@@ -262,22 +518,107 @@ process_id_t process_spawn(const char* executable)
 
 typedef struct {
   process_id_t pid_child;
+  /* The thread that called fork, and its slot in the parent process. */
+  thread_table_t* entry_parent;
+  int slot;
   semaphore_t* sem_wait;
+  /* Set by the child before it signals `sem_wait`: 0, or the error that
+     made it give up. */
+  int result;
 } fork_arg_t;
 
+/* Share the pages of the address space `from` of a forking process with the
+   child's `to`.  Writable pages become copy-on-write in both, and are copied
+   on the first write to them, see `process_copy_on_write`.  Swapped out pages
+   share their swap slot.  The files mapped by the parent are not mapped in
+   the child, so their pages are left out.  The leaves of the child's
+   pagetable are all created first, so that nothing is shared if there is no
+   memory for them, and false returned; the leaves created so far are kept
+   for the next try.  The parent's vm lock is held. */
+static bool process_share_pages(pagetable_t *to, pagetable_t *from)
+{
+  uint32_t vaddr;
+  pagetable_leaf_t *leaf;
+
+  for (uint32_t l = 0; l < PAGETABLE_LEAVES; l++) {
+    vaddr = l << (13 + PAGETABLE_LEAF_BITS);
+    if (from->leaves[l] != NULL && to->leaves[l] == NULL &&
+        !vm_create_leaf(to, vaddr)) {
+      return false;
+    }
+  }
+
+  for (uint32_t l = 0; l < PAGETABLE_LEAVES; l++) {
+    leaf = from->leaves[l];
+    if (leaf == NULL) {
+      continue;
+    }
+    for (uint32_t i = 0; i < PAGETABLE_LEAF_ENTRIES; i++) {
+      vaddr = ((l << PAGETABLE_LEAF_BITS) | i) << 13;
+      if (vaddr >= PROCESS_HEAP_LIMIT && vaddr < PROCESS_MAPPINGS_TOP) {
+        continue;
+      }
+      if (leaf->entries[i].V0 || leaf->entries[i].SWAP0) {
+        vm_share_page(to, from, vaddr);
+      }
+      if (leaf->entries[i].V1 || leaf->entries[i].SWAP1) {
+        vm_share_page(to, from, vaddr | PAGE_SIZE);
+      }
+    }
+  }
+  return true;
+}
+
+/* Give up setting up the child process of a fork, freeing what it has got so
+   far and its process slot, and make the forking thread return `error`.
+   Called by the child's thread, which dies. */
+static void process_fork_abort(fork_arg_t *fork_arg, int error)
+{
+  interrupt_status_t intr_status;
+  thread_table_t *my_entry = thread_get_current_thread_entry();
+  process_id_t pid = fork_arg->pid_child;
+  process_control_block_t *pcb = &process_table[pid];
+  openfile_t executable_file;
+
+  intr_status = _interrupt_disable();
+  spinlock_acquire(&process_table_slock);
+  my_entry->pagetable = NULL;
+  my_entry->process_id = -1;
+  if (pcb->pagetable != NULL) {
+    vm_destroy_pagetable(pcb->pagetable);
+  }
+  executable_file = process_drop_executable(pcb);
+  process_reset(pid);
+  spinlock_release(&process_table_slock);
+  _interrupt_set_state(intr_status);
+
+  if (executable_file >= 0) {
+    vfs_close(executable_file);
+  }
+
+  /* The parent's stack holding `fork_arg` is gone once it is woken. */
+  fork_arg->result = error;
+  semaphore_V(fork_arg->sem_wait);
+  thread_finish();
+}
+
 /* Setup the child process. */
 void process_fork_setup(fork_arg_t* fork_arg)
 {
   thread_table_t *my_entry;
   pagetable_t *pagetable;
-  uint32_t phys_page;
   context_t user_context;
-  process_id_t pid, pid_parent;
+  process_id_t pid;
+  process_control_block_t *pcb, *pcb_parent;
   thread_table_t* entry_parent;
+  int slot;
   semaphore_t* sem_wait;
   interrupt_status_t intr_status;
+  bool shared;
 
   pid = fork_arg->pid_child;
+  entry_parent = fork_arg->entry_parent;
+  slot = fork_arg->slot;
   sem_wait = fork_arg->sem_wait;
 
   my_entry = thread_get_current_thread_entry();
@@ -286,50 +627,49 @@ void process_fork_setup(fork_arg_t* fork_arg)
 
   KERNEL_ASSERT(my_entry->pagetable == NULL);
 
-  pagetable = vm_create_pagetable(thread_get_current_thread());
-  KERNEL_ASSERT(pagetable != NULL);
+  do {
+    pagetable = vm_create_pagetable();
+  } while (pagetable == NULL && process_reclaim_page());
+  if (pagetable == NULL) {
+    process_fork_abort(fork_arg, PROCESS_NO_MEMORY);
+  }
 
+  pcb = &process_table[pid];
+  pcb_parent = &process_table[pcb->parent];
+
+  /* The child is single-threaded, and runs in the same slot as the forking
+     thread so that its stack pointer stays valid. */
   intr_status = _interrupt_disable();
   my_entry->pagetable = pagetable;
+  tlb_activate(pagetable);
+  spinlock_acquire(&process_table_slock);
+  pcb->pagetable = pagetable;
+  pcb->threads[slot].state = PROCESS_THREAD_RUNNING;
+  pcb->threads[slot].tid = thread_get_current_thread();
+  pcb->thread_count = 1;
+  spinlock_release(&process_table_slock);
   _interrupt_set_state(intr_status);
 
-  pid_parent = process_get_current_process_entry()->parent;
-  entry_parent = thread_get_thread_entry_by_pid(pid_parent);
-
-  /* Allocate, map and copy pages for all pages in the parent thread.  Remember
-     to set the dirty bit to zero (read-only) on read-only pages. */
-  int dirty;
-  uint32_t vaddr;
-  tlb_entry_t tlb_parent;
-  uint32_t phys_page_parent;
-  for (uint32_t i = 0; i < entry_parent->pagetable->valid_count; i++) {
-    tlb_parent = entry_parent->pagetable->entries[i];
-    if (tlb_parent.V0) {
-      /* The even page has content. */
-      vaddr = tlb_parent.VPN2 << 13;
-      dirty = tlb_parent.D0;
-
-      phys_page = pagepool_get_phys_page();
-      KERNEL_ASSERT(phys_page != 0);
-      vm_map(my_entry->pagetable, phys_page, vaddr, dirty);
-      phys_page_parent = tlb_parent.PFN0 << 12;
-      memcopy(PAGE_SIZE, (void*) ADDR_PHYS_TO_KERNEL(phys_page),
-              (void*) ADDR_PHYS_TO_KERNEL(phys_page_parent));
-    }
-    if (tlb_parent.V1) {
-      /* The odd page has content. */
-      vaddr = (tlb_parent.VPN2 << 13) | PAGE_SIZE;
-      dirty = tlb_parent.D1;
-
-      phys_page = pagepool_get_phys_page();
-      KERNEL_ASSERT(phys_page != 0);
-      vm_map(my_entry->pagetable, phys_page, vaddr, dirty);
-      phys_page_parent = tlb_parent.PFN1 << 12;
-      memcopy(PAGE_SIZE, (void*) ADDR_PHYS_TO_KERNEL(phys_page),
-              (void*) ADDR_PHYS_TO_KERNEL(phys_page_parent));
-    }
+  /* Keep the other threads of the parent from changing its address space while
+     we copy it.  Pages are swapped out to make room for the pagetable if
+     needed. */
+  do {
+    intr_status = _interrupt_disable();
+    spinlock_acquire(&pcb_parent->vm_slock);
+    shared = process_share_pages(pagetable, entry_parent->pagetable);
+    spinlock_release(&pcb_parent->vm_slock);
+    _interrupt_set_state(intr_status);
+  } while (!shared && process_reclaim_page());
+
+  if (!shared) {
+    process_fork_abort(fork_arg, PROCESS_NO_MEMORY);
   }
 
+  /* The TLBs may still hold writable entries for the parent's pages, also on
+     the CPUs running its other threads.  The forking thread only returns once
+     they are gone. */
+  tlb_shootdown(entry_parent->pagetable);
+
   /* Copy the user context. */
   memcopy(sizeof(context_t), &user_context, entry_parent->user_context);
 
@@ -354,75 +694,298 @@ int process_fork()
 {
   TID_t thread;
   process_id_t pid_parent, pid_child;
+  process_control_block_t *pcb_parent;
   semaphore_t* sem_wait;
+  interrupt_status_t intr_status;
+
+  pid_parent = process_get_current_process();
+  pcb_parent = &process_table[pid_parent];
+
+  /* Create the semaphore used to wait for the child setup. */
+  sem_wait = semaphore_create(0);
+  if (sem_wait == NULL) {
+    return PROCESS_NO_MEMORY;
+  }
 
   pid_child = alloc_process_id();
   if (pid_child == PROCESS_MAX_PROCESSES) {
+    semaphore_destroy(sem_wait);
     return PROCESS_PTABLE_FULL;
   }
 
-  pid_parent = process_get_current_process();
-
   /* Copy kernel memory. */
   stringcopy(process_table[pid_child].executable,
              process_table[pid_parent].executable,
              PROCESS_MAX_FILELENGTH);
 
   process_table[pid_child].parent = pid_parent;
-  process_table[pid_child].heap_end = process_table[pid_parent].heap_end;
+  process_table[pid_child].ro_segment = pcb_parent->ro_segment;
+  process_table[pid_child].rw_segment = pcb_parent->rw_segment;
+  intr_status = _interrupt_disable();
+  spinlock_acquire(&pcb_parent->vm_slock);
+  process_table[pid_child].heap_start = pcb_parent->heap_start;
+  process_table[pid_child].heap_end = pcb_parent->heap_end;
+  process_table[pid_child].stack_limit = pcb_parent->stack_limit;
+  spinlock_release(&pcb_parent->vm_slock);
+  _interrupt_set_state(intr_status);
   memcopy(CONFIG_MAX_OPEN_FILES * sizeof(openfile_t),
           process_table[pid_child].files, process_table[pid_parent].files);
 
-  /* Create the semaphore used to wait for the child setup. */
-  sem_wait = semaphore_create(0);
+  /* The child reads the pages of the program it has not yet touched from the
+     same handle to the executable as the parent.  The parent holds its
+     reference until this call returns. */
+  intr_status = _interrupt_disable();
+  spinlock_acquire(&process_table_slock);
+  process_table[pid_child].executable_file = pcb_parent->executable_file;
+  process_executable_refs[pcb_parent->executable_file]++;
+  spinlock_release(&process_table_slock);
+  _interrupt_set_state(intr_status);
 
   /* Put the arguments to the new thread in a struct, and create it. */
   fork_arg_t fork_arg;
   fork_arg.pid_child = pid_child;
+  fork_arg.entry_parent = thread_get_current_thread_entry();
+  fork_arg.slot = process_current_thread_slot(pcb_parent);
   fork_arg.sem_wait = sem_wait;
+  fork_arg.result = 0;
 
   thread = thread_create((void (*)(uint32_t))(&process_fork_setup),
                          (uint32_t) &fork_arg);
   if (thread < 0) {
+    /* Free the child's slot.  The parent still holds the executable, so the
+       child's reference is not the last. */
+    intr_status = _interrupt_disable();
+    spinlock_acquire(&process_table_slock);
+    process_drop_executable(&process_table[pid_child]);
+    process_reset(pid_child);
+    spinlock_release(&process_table_slock);
+    _interrupt_set_state(intr_status);
+    semaphore_destroy(sem_wait);
     return PROCESS_TTABLE_FULL;
   }
   thread_run(thread);
 
   /* Wait for the child to copy all data. */
   semaphore_P(sem_wait);
+  semaphore_destroy(sem_wait);
+  if (fork_arg.result < 0) {
+    return fork_arg.result;
+  }
   return pid_child;
 }
 
-/* Stop the current process and the thread it runs in.  Sets the return value as
-   well. */
+/* Stop the current process.  The calling thread exits right away, and the
+   other threads of the process exit the next time they enter the kernel or
+   are interrupted in userland (see `process_check_exiting` and
+   `process_check_interrupted`).  Sets the return value as well. */
 void process_finish(int retval)
 {
   interrupt_status_t intr_status;
   process_id_t pid = process_get_current_process();
+  process_control_block_t *pcb = &process_table[pid];
+
+  intr_status = _interrupt_disable();
+  spinlock_acquire(&process_table_slock);
+
+  /* Save the return value so it can be read later by `process_join`.  Only the
+     first thread to call exit gets to decide it. */
+  if (!pcb->exiting) {
+    pcb->exiting = true;
+    pcb->retval = retval;
+
+    /* Wake the threads sleeping in a futex wait or a join, so that they see
+       the flag and exit too.  A thread going to sleep after this sees the
+       flag first, see `process_futex_sleep`. */
+    for (int i = 0; i < PROCESS_MAX_THREADS; i++) {
+      sleepq_wake_all(&pcb->threads[i]);
+      if (pcb->threads[i].futex != NULL) {
+        futex_wake_key(pcb->threads[i].futex);
+      }
+    }
+    for (process_id_t i = 0; i < PROCESS_MAX_PROCESSES; i++) {
+      if (process_table[i].parent == pid) {
+        sleepq_wake_all(&process_table[i]);
+      }
+    }
+  }
+
+  spinlock_release(&process_table_slock);
+  _interrupt_set_state(intr_status);
+
+  process_thread_exit(retval);
+}
+
+/* Exit the calling thread if its process is exiting.  Called before returning
+   to userland. */
+void process_check_exiting()
+{
+  process_control_block_t *pcb = process_get_current_process_entry();
+
+  if (pcb->exiting) {
+    process_thread_exit(pcb->retval);
+  }
+}
+
+/* Called at the end of every interrupt, for the thread about to be resumed.
+   If it was interrupted in userland and its process is exiting, it is
+   resumed in `process_check_exiting` instead, so that a thread that never
+   makes a syscall still exits.  The user context is never returned to, so
+   the kernel stack below it is free.  Interrupts are disabled. */
+void process_check_interrupted()
+{
+  thread_table_t *thread = thread_get_current_thread_entry();
+  context_t *context = thread->context;
+
+  if (thread->process_id < 0 || context == NULL ||
+      !(context->status & USERLAND_ENABLE_BIT) ||
+      !process_table[thread->process_id].exiting) {
+    return;
+  }
+
+  context->pc = (uint32_t) &process_check_exiting;
+  context->cpu_regs[MIPS_REGISTER_RA] = (uint32_t) &thread_finish;
+  context->cpu_regs[MIPS_REGISTER_SP] = (uint32_t) context - 4;
+  context->status = INTERRUPT_MASK_ALL | INTERRUPT_MASK_MASTER;
+}
+
+/* Record that the calling thread sleeps on the futex with the kernel address
+   `futex` in `futex_wait`, so that `process_finish` can wake it, or that it
+   no longer does if `futex` is NULL.  The record is made before the exiting
+   flag is checked, and the flag set before the records are read, so that
+   either the sleeping thread sees the flag or `process_finish` sees the
+   record.  Returns false if the process is exiting, and the thread must not
+   sleep.  Interrupts are disabled. */
+bool process_futex_sleep(int *futex)
+{
+  process_control_block_t *pcb = process_get_current_process_entry();
+  process_thread_t *self = &pcb->threads[process_current_thread_slot(pcb)];
+
+  self->futex = futex;
+  if (futex != NULL && pcb->exiting) {
+    self->futex = NULL;
+    return false;
+  }
+  return true;
+}
+
+/* Start a new thread in the current process, running the function at `entry`
+   with `arg0` and `arg1` as its arguments.  `entry` must not return.  Returns
+   the thread id, or PROCESS_THREADS_FULL or PROCESS_TTABLE_FULL on error. */
+int process_thread_create(uint32_t entry, uint32_t arg0, uint32_t arg1)
+{
+  interrupt_status_t intr_status;
+  process_id_t pid = process_get_current_process();
+  process_control_block_t *pcb = &process_table[pid];
+  TID_t thread;
+  int slot;
+
+  intr_status = _interrupt_disable();
+  spinlock_acquire(&process_table_slock);
+
+  for (slot = 0; slot < PROCESS_MAX_THREADS; slot++) {
+    if (pcb->threads[slot].state == PROCESS_THREAD_FREE) {
+      break;
+    }
+  }
+  if (slot == PROCESS_MAX_THREADS) {
+    spinlock_release(&process_table_slock);
+    _interrupt_set_state(intr_status);
+    return PROCESS_THREADS_FULL;
+  }
+
+  thread = thread_create((void (*)(uint32_t))(&process_thread_start),
+                         pid * PROCESS_MAX_THREADS + slot);
+  if (thread < 0) {
+    spinlock_release(&process_table_slock);
+    _interrupt_set_state(intr_status);
+    return PROCESS_TTABLE_FULL;
+  }
+
+  pcb->threads[slot].state = PROCESS_THREAD_RUNNING;
+  pcb->threads[slot].tid = thread;
+  pcb->threads[slot].retval = 0;
+  pcb->threads[slot].entry = entry;
+  pcb->threads[slot].arg0 = arg0;
+  pcb->threads[slot].arg1 = arg1;
+  pcb->thread_count++;
+
+  spinlock_release(&process_table_slock);
+  _interrupt_set_state(intr_status);
+
+  thread_run(thread);
+  return slot;
+}
+
+/* Stop the calling thread, saving `retval` for `process_thread_join`.  If it is
+   the last thread of its process, the process becomes a zombie. */
+void process_thread_exit(int retval)
+{
+  interrupt_status_t intr_status;
+  process_id_t pid = process_get_current_process();
+  process_control_block_t *pcb = &process_table[pid];
   thread_table_t *thread = thread_get_current_thread_entry();
+  openfile_t executable_file;
+  bool last;
+  int slot;
 
   intr_status = _interrupt_disable();
   spinlock_acquire(&process_table_slock);
 
-  /* Save the return value so it can be read later by `process_join`. */
-  process_table[pid].retval = retval;
+  slot = process_current_thread_slot(pcb);
+  pcb->threads[slot].retval = retval;
+  pcb->threads[slot].state = PROCESS_THREAD_ZOMBIE;
+  sleepq_wake_all(&pcb->threads[slot]);
+
+  /* The address space now only belongs to the remaining threads. */
+  thread->pagetable = NULL;
+  pcb->thread_count--;
+  process_add_thread_rusage(&pcb->rusage, thread);
+  last = pcb->thread_count == 0;
+
+  spinlock_release(&process_table_slock);
+  _interrupt_set_state(intr_status);
+
+  if (!last) {
+    thread_finish();
+  }
+
+  /* Write the mapped files back while the address space is still there.  This
+     may block, but nobody can join the process before it is a zombie. */
+  for (int i = 0; i < PROCESS_MAX_MAPPINGS; i++) {
+    process_unmap(pcb, i, -1);
+  }
+
+  intr_status = _interrupt_disable();
+  spinlock_acquire(&process_table_slock);
+
+  /* A process whose threads all called thread_exit returns the value of the
+     last one. */
+  if (!pcb->exiting) {
+    pcb->retval = retval;
+  }
 
   /* Make it a zombie to state that all it needs to die completely is a join
      from its parent. */
-  process_table[pid].state = PROCESS_ZOMBIE;
+  pcb->state = PROCESS_ZOMBIE;
 
   /* Destroy the pagetable!  We don't have proper virtual memory handling
      yet. */
-  vm_destroy_pagetable(thread->pagetable);
-  thread->pagetable = NULL;
+  pcb->rusage.pages_resident = pcb->pagetable->valid_count;
+  vm_destroy_pagetable(pcb->pagetable);
+  pcb->pagetable = NULL;
+
+  /* Nothing more will be read from the executable by this process.  The last
+     process reading it closes it, which may block, so that is done after
+     releasing the lock. */
+  executable_file = process_drop_executable(pcb);
 
   /* Move any `process_join` call lying in Buenos' sleep queue into the
      scheduler's ready-to-run list, so it can exit. */
-  sleepq_wake_all(&process_table[pid]);
+  sleepq_wake_all(pcb);
 
-  /* BONUS: Once your `sycall_kill` is in place, you may want to use it to kill
-     all children that haven't been joined.  Right now they just keep running
-     with a non-process parent. */
+  /* BONUS: Once your `sycall_kill` is in place, you may want to use it to
+     kill all children that haven't been joined.  Right now they just keep
+     running with a non-process parent. */
   for (process_id_t i = 0; i < PROCESS_MAX_PROCESSES; i++) {
     if (process_table[i].parent == pid) {
       process_table[i].parent = -1;
@@ -432,9 +995,60 @@ void process_finish(int retval)
   spinlock_release(&process_table_slock);
   _interrupt_set_state(intr_status);
 
+  if (executable_file >= 0) {
+    vfs_close(executable_file);
+  }
+
   thread_finish();
 }
 
+/* Wait for thread `thread` of the current process to exit, then return its
+   return value and free its slot.  Returns PROCESS_ILLEGAL_THREAD if there is
+   no such thread, if it is the calling thread, or if another thread joined it
+   first. */
+int process_thread_join(int thread)
+{
+  int retval;
+  interrupt_status_t intr_status;
+  process_control_block_t *pcb = process_get_current_process_entry();
+
+  if (thread < 0 || thread >= PROCESS_MAX_THREADS) {
+    return PROCESS_ILLEGAL_THREAD;
+  }
+
+  intr_status = _interrupt_disable();
+  spinlock_acquire(&process_table_slock);
+
+  if (thread == process_current_thread_slot(pcb)) {
+    spinlock_release(&process_table_slock);
+    _interrupt_set_state(intr_status);
+    return PROCESS_ILLEGAL_THREAD;
+  }
+
+  /* An exiting process does not wait; the caller exits on its way back to
+     userland. */
+  while (pcb->threads[thread].state == PROCESS_THREAD_RUNNING &&
+         !pcb->exiting) {
+    sleepq_add(&pcb->threads[thread]);
+    spinlock_release(&process_table_slock);
+    thread_switch();
+    spinlock_acquire(&process_table_slock);
+  }
+
+  if (pcb->threads[thread].state == PROCESS_THREAD_ZOMBIE) {
+    retval = pcb->threads[thread].retval;
+    pcb->threads[thread].state = PROCESS_THREAD_FREE;
+    pcb->threads[thread].tid = -1;
+  } else {
+    retval = PROCESS_ILLEGAL_THREAD;
+  }
+
+  spinlock_release(&process_table_slock);
+  _interrupt_set_state(intr_status);
+
+  return retval;
+}
+
 /* Wait for the child process to finish, then return its return value.  Returns
    PROCESS_ILLEGAL_JOIN if `pid` is invalid or if someone else than the parent
    tries to join.  This will also mark its process table entry as free. */
@@ -442,6 +1056,7 @@ int process_join(process_id_t pid)
 {
   int retval;
   interrupt_status_t intr_status;
+  process_control_block_t *parent;
 
   /* Only join with valid pids. */
   if (pid < 0 || pid >= PROCESS_MAX_PROCESSES ||
@@ -452,8 +1067,14 @@ int process_join(process_id_t pid)
   intr_status = _interrupt_disable();
   spinlock_acquire(&process_table_slock);
 
-  /* Wait for the child process to exit and become a zombie. */
+  /* Wait for the child process to exit and become a zombie, unless the
+     calling process is exiting itself. */
   while (process_table[pid].state != PROCESS_ZOMBIE) {
+    if (process_get_current_process_entry()->exiting) {
+      spinlock_release(&process_table_slock);
+      _interrupt_set_state(intr_status);
+      return PROCESS_ILLEGAL_JOIN;
+    }
     /* Move to Buenos' sleep queue and switch to another thread. */
     sleepq_add(&process_table[pid]);
     spinlock_release(&process_table_slock);
@@ -461,8 +1082,13 @@ int process_join(process_id_t pid)
     spinlock_acquire(&process_table_slock);
   }
 
-  /* Get the return value and prepare its slot for a future process. */
+  /* Get the return value and the resources used, and prepare its slot for a
+     future process. */
   retval = process_table[pid].retval;
+  parent = process_get_current_process_entry();
+  process_add_rusage(&parent->rusage_children, &process_table[pid].rusage);
+  process_add_rusage(&parent->rusage_children,
+                     &process_table[pid].rusage_children);
   process_reset(pid);
 
   spinlock_release(&process_table_slock);
@@ -471,35 +1097,246 @@ int process_join(process_id_t pid)
   return retval;
 }
 
-/* Allocate enough pages to make space a larger heap, or return the current
-   heap end. */
+/* Unmap the pages of `process` between the end of its heap and `old_end`, to
+   which the heap has shrunk.  They are unmapped in batches, and each batch is
+   only freed when no CPU can reach its pages through the TLB anymore.  The
+   heap may grow again meanwhile, and the pages below its new end stay. */
+static void process_shrink_heap(process_control_block_t *process,
+                                uint32_t old_end)
+{
+  uint32_t freed[PROCESS_FREE_BATCH];
+  uint32_t page, first, phys_page;
+  interrupt_status_t intr_status;
+  int count;
+
+  page = old_end & PAGE_SIZE_MASK;
+  do {
+    count = 0;
+    intr_status = _interrupt_disable();
+    spinlock_acquire(&process->vm_slock);
+    /* The page holding the start of the heap may also hold program data, and
+       stays. */
+    first = (process->heap_end & PAGE_SIZE_MASK) + PAGE_SIZE;
+    for (; page >= first && count < PROCESS_FREE_BATCH; page -= PAGE_SIZE) {
+      if (vm_translate(process->pagetable, page) != 0 ||
+          vm_swap_slot(process->pagetable, page) >= 0) {
+        phys_page = vm_unmap(process->pagetable, page);
+        if (phys_page != 0) {
+          freed[count++] = phys_page;
+        }
+      }
+    }
+    spinlock_release(&process->vm_slock);
+    _interrupt_set_state(intr_status);
+
+    if (count > 0) {
+      tlb_shootdown(process->pagetable);
+      pagepool_free_phys_pages(freed, count);
+    }
+  } while (page >= first);
+}
+
+/* Move the end of the heap, or return the current heap end.  Heap pages are
+   mapped on first touch, and returned to the page pool when the heap shrinks
+   past them. */
 uint32_t process_memlimit(uint32_t heap_end)
 {
   process_control_block_t *process;
-  uint32_t phys_page;
+  uint32_t old_end;
+  uint32_t result;
+  interrupt_status_t intr_status;
 
   process = process_get_current_process_entry();
 
+  /* All threads of the process share the heap. */
+  intr_status = _interrupt_disable();
+  spinlock_acquire(&process->vm_slock);
+
   if (heap_end == (uint32_t) NULL) {
-    return process->heap_end;
+    result = process->heap_end;
+    goto end;
+  }
+  else if (heap_end < process->heap_start) {
+    /* The heap cannot shrink into the program. */
+    result = (uint32_t) NULL;
+    goto end;
+  }
+  else if (heap_end >= PROCESS_HEAP_LIMIT) {
+    /* The heap would run into the thread stacks. */
+    result = (uint32_t) NULL;
+    goto end;
+  }
+
+  /* Only record the new end; the pages are mapped on first touch.  No page
+     above it is faulted in once it is recorded, and those that are mapped
+     are unmapped after releasing the lock. */
+  old_end = process->heap_end;
+  process->heap_end = heap_end;
+  result = heap_end;
+
+  spinlock_release(&process->vm_slock);
+  _interrupt_set_state(intr_status);
+
+  if (heap_end < old_end) {
+    process_shrink_heap(process, old_end);
+  }
+  return result;
+
+ end:
+  spinlock_release(&process->vm_slock);
+  _interrupt_set_state(intr_status);
+  return result;
+}
+
+/* Set the number of pages each thread stack of the current process may grow
+   to, or return the current limit if `pages` is 0.  The limit is at most
+   CONFIG_USERLAND_STACK_SIZE, the room between two stacks.  Lowering it only
+   stops further growth; the pages a stack has already grown to stay.  Returns
+   the limit, or 0 if `pages` is too large.  A forked child inherits it. */
+uint32_t process_stacklimit(uint32_t pages)
+{
+  process_control_block_t *process;
+  uint32_t result = 0;
+  interrupt_status_t intr_status;
+
+  process = process_get_current_process_entry();
+
+  /* Stack faults read the limit under the same lock. */
+  intr_status = _interrupt_disable();
+  spinlock_acquire(&process->vm_slock);
+  if (pages <= CONFIG_USERLAND_STACK_SIZE) {
+    if (pages != 0) {
+      process->stack_limit = pages;
+    }
+    result = process->stack_limit;
   }
-  else if (heap_end < process->heap_end) {
+  spinlock_release(&process->vm_slock);
+  _interrupt_set_state(intr_status);
+  return result;
+}
+
+/* Take a free entry of the current process' mappings for `file` or `shm`.
+   Returns the address of the mapping, or NULL if there is no free entry. */
+static uint32_t process_add_mapping(openfile_t file, void *shm,
+                                    uint32_t offset, uint32_t pages)
+{
+  process_control_block_t *process = process_get_current_process_entry();
+  interrupt_status_t intr_status;
+  process_mapping_t *mapping;
+  uint32_t result = (uint32_t) NULL;
+
+  intr_status = _interrupt_disable();
+  spinlock_acquire(&process->vm_slock);
+  for (int i = 0; i < PROCESS_MAX_MAPPINGS; i++) {
+    mapping = &process->mappings[i];
+    if (mapping->file < 0 && mapping->shm == NULL && mapping->pages == 0) {
+      mapping->file = file;
+      mapping->shm = shm;
+      mapping->offset = offset;
+      mapping->pages = pages;
+      result = process_mapping_start(i);
+      break;
+    }
+  }
+  spinlock_release(&process->vm_slock);
+  _interrupt_set_state(intr_status);
+  return result;
+}
+
+/* Map `length` bytes of the open file `file`, starting at `offset`, into the
+   address space of the current process.  Pages are read from the file when
+   first touched, and the ones written to are written back when the file is
+   unmapped, see `process_munmap`.  Pages past the end of the file read as
+   zeros, and bytes written past the end are not kept.  Returns the
+   address of the mapping, or NULL if `offset` is not a multiple of PAGE_SIZE,
+   `length` is zero or over PROCESS_MAPPING_PAGES pages, or the process already
+   has PROCESS_MAX_MAPPINGS mappings. */
+uint32_t process_mmap(openfile_t file, uint32_t offset, uint32_t length)
+{
+  if (offset % PAGE_SIZE != 0 || length == 0 ||
+      length > PROCESS_MAPPING_PAGES * PAGE_SIZE) {
     return (uint32_t) NULL;
   }
+  return process_add_mapping(file, NULL, offset,
+                             (length + PAGE_SIZE - 1) / PAGE_SIZE);
+}
 
-  /* Allocate and map the needed number of pages. */
-  for (uint32_t i = process->heap_end / PAGE_SIZE + 1;
-       i <= heap_end / PAGE_SIZE; i++) {
-    phys_page = pagepool_get_phys_page();
-    if (phys_page == 0) {
-      /* Not enough memory. */
-      return (uint32_t) NULL;
+/* Map the `pages` pages of the shared memory segment `shm` into the address
+   space of the current process.  The caller holds a reference to the segment
+   for the mapping, which is dropped when the segment is unmapped with
+   `process_munmap`.  Returns the address of the mapping, or NULL if the
+   process already has PROCESS_MAX_MAPPINGS mappings. */
+uint32_t process_map_shm(void *shm, uint32_t pages)
+{
+  KERNEL_ASSERT(pages > 0 && pages <= PROCESS_MAPPING_PAGES);
+  return process_add_mapping(-1, shm, 0, pages);
+}
+
+/* Unmap the file or shared memory segment mapped at `vaddr` in the current
+   process, writing the pages of a file that were written to back to it.
+   Returns 0, PROCESS_ILLEGAL_MAPPING if no mapping starts at `vaddr`, or a
+   negative VFS error if writing failed. */
+int process_munmap(uint32_t vaddr)
+{
+  process_control_block_t *process = process_get_current_process_entry();
+
+  for (int i = 0; i < PROCESS_MAX_MAPPINGS; i++) {
+    if (process_mapping_start(i) == vaddr) {
+      return process_unmap(process, i, -1);
     }
-    vm_map(thread_get_current_thread_entry()->pagetable, phys_page,
-           i * PAGE_SIZE, 1);
   }
-  process->heap_end = heap_end;
-  return heap_end;
+  return PROCESS_ILLEGAL_MAPPING;
+}
+
+/* Unmap every mapping of `file` in the current process, like
+   `process_munmap`.  Called before the file is closed. */
+void process_munmap_file(openfile_t file)
+{
+  process_control_block_t *process = process_get_current_process_entry();
+
+  for (int i = 0; i < PROCESS_MAX_MAPPINGS; i++) {
+    process_unmap(process, i, file);
+  }
+}
+
+/* Store the resources used by the current process in `usage` if `who` is
+   RUSAGE_SELF, or by the children it has joined if it is RUSAGE_CHILDREN.
+   Returns 0, or PROCESS_ILLEGAL_RUSAGE if `who` is neither. */
+int process_getrusage(int who, process_rusage_t *usage)
+{
+  interrupt_status_t intr_status;
+  process_control_block_t *pcb = process_get_current_process_entry();
+  process_rusage_t result;
+
+  if (who != RUSAGE_SELF && who != RUSAGE_CHILDREN) {
+    return PROCESS_ILLEGAL_RUSAGE;
+  }
+
+  intr_status = _interrupt_disable();
+  spinlock_acquire(&process_table_slock);
+
+  if (who == RUSAGE_CHILDREN) {
+    result = pcb->rusage_children;
+  } else {
+    /* The exited threads, and what the others have used so far. */
+    result = pcb->rusage;
+    for (int i = 0; i < PROCESS_MAX_THREADS; i++) {
+      if (pcb->threads[i].state == PROCESS_THREAD_RUNNING) {
+        process_add_thread_rusage(&result, &thread_table[pcb->threads[i].tid]);
+      }
+    }
+    result.pages_resident = pcb->pagetable->valid_count;
+    /* The caller's time on this CPU is charged only when it is next
+       scheduled; count it now so that short intervals can be timed. */
+    result.cpu_ticks += timer_get_ticks() - percpu_this()->schedule_ticks;
+  }
+
+  spinlock_release(&process_table_slock);
+  _interrupt_set_state(intr_status);
+
+  /* Written with interrupts enabled, since it may fault. */
+  memcopy(sizeof(process_rusage_t), usage, &result);
+  return 0;
 }
 
 bool process_add_file(openfile_t file)
@@ -562,3 +1399,451 @@ process_control_block_t *process_get_current_process_entry()
 }
 
 /** @} */
+
+/* Whether `page` belongs to `segment`. */
+static bool process_in_segment(process_segment_t *segment, uint32_t page)
+{
+  return page >= segment->vaddr &&
+    page < segment->vaddr + segment->pages * PAGE_SIZE;
+}
+
+/* Position of the clock hand of `process_reclaim_page`: the process, and the
+   address in it, to look at next.  Only moved with the swap I/O lock held. */
+static process_id_t process_clock_pid = 0;
+static uint32_t process_clock_vaddr = 0;
+
+/* Times `process_reclaim_page` picks another page when writing one to swap
+   fails, or the page is written to or unmapped meanwhile. */
+#define PROCESS_RECLAIM_TRIES 3
+
+/* Move the clock hand over the pages of `process` from where it stands, until
+   it finds a page to swap out, or reaches the end of the address space.  Only
+   pages that no other address space or cache shares are taken, and a page
+   that was used since the hand last passed gets a second chance.  The page
+   found is write-protected and stays mapped, with a reference taken for the
+   caller, who writes it out; its address is stored in `victim`.  Returns the
+   page, or 0, also if another CPU has started running the process.  Both the
+   process table lock and the process' vm lock are held. */
+static uint32_t process_clock_scan(process_control_block_t *process,
+                                   uint32_t *victim)
+{
+  pagetable_t *pagetable = process->pagetable;
+  uint32_t vaddr = process_clock_vaddr;
+  uint32_t phys_page;
+
+  while (vaddr < 0x80000000) {
+    if (vaddr >= PROCESS_HEAP_LIMIT && vaddr < PROCESS_MAPPINGS_TOP) {
+      /* Pages of mapped files are written back to the file when unmapped,
+         and never to swap. */
+      vaddr = PROCESS_MAPPINGS_TOP;
+      continue;
+    }
+    if (vm_lookup(pagetable, vaddr) == NULL) {
+      /* Nothing is mapped in the rest of the leaf. */
+      vaddr = (PAGETABLE_LEAF_INDEX(vaddr) + 1) << (13 + PAGETABLE_LEAF_BITS);
+      continue;
+    }
+
+    phys_page = vm_translate(pagetable, vaddr);
+    if (phys_page != 0 && pagepool_phys_page_refs(phys_page) == 1 &&
+        !tlb_referenced(pagetable, vaddr)) {
+      vm_write_protect(pagetable, vaddr);
+      if (!tlb_evict(pagetable, vaddr)) {
+        /* Its TLB may still let the page be written. */
+        return 0;
+      }
+      pagepool_ref_phys_page(phys_page);
+      process_clock_vaddr = vaddr + PAGE_SIZE;
+      *victim = vaddr;
+      return phys_page;
+    }
+    vaddr += PAGE_SIZE;
+  }
+  return 0;
+}
+
+/* Free a page of memory by writing a user page to swap.  The pages of all
+   processes are gone through like a clock, see `process_clock_scan`, twice at
+   most, so that a page passed over once can be taken the second time.
+   Processes running on other CPUs are skipped, since their TLBs may still
+   hold the page.  The page is written while still mapped read-only, and only
+   unmapped if it was not written to or unmapped meanwhile; a write copies it,
+   since the reference held for writing it keeps it shared.  Must be called
+   with interrupts enabled and no spinlocks held, since it waits for the disk.
+   Returns false if there is no swap, or no page could be swapped out. */
+bool process_reclaim_page(void)
+{
+  interrupt_status_t intr_status;
+  process_control_block_t *pcb;
+  pagetable_entry_t *entry;
+  pagetable_t *pagetable = NULL;
+  process_id_t pid = 0;
+  uint32_t vaddr = 0, phys_page;
+  int slot, written;
+  bool swapped;
+
+  for (int tries = 0; tries < PROCESS_RECLAIM_TRIES; tries++) {
+    slot = swap_reserve();
+    if (slot < 0) {
+      return false;
+    }
+
+    phys_page = 0;
+    intr_status = _interrupt_disable();
+    spinlock_acquire(&process_table_slock);
+    for (int i = 0; i <= 2 * PROCESS_MAX_PROCESSES && phys_page == 0; i++) {
+      pid = process_clock_pid;
+      pcb = &process_table[pid];
+      if (pcb->state == PROCESS_RUNNING && pcb->pagetable != NULL &&
+          !tlb_active_elsewhere(pcb->pagetable)) {
+        spinlock_acquire(&pcb->vm_slock);
+        pagetable = pcb->pagetable;
+        phys_page = process_clock_scan(pcb, &vaddr);
+        spinlock_release(&pcb->vm_slock);
+      }
+      if (phys_page == 0) {
+        process_clock_pid = (process_clock_pid + 1) % PROCESS_MAX_PROCESSES;
+        process_clock_vaddr = 0;
+      }
+    }
+    spinlock_release(&process_table_slock);
+    _interrupt_set_state(intr_status);
+
+    if (phys_page == 0) {
+      swap_cancel(slot);
+      return false;
+    }
+
+    written = swap_write(slot, phys_page);
+
+    swapped = false;
+    intr_status = _interrupt_disable();
+    spinlock_acquire(&process_table_slock);
+    pcb = &process_table[pid];
+    if (written == 0 && pcb->state == PROCESS_RUNNING &&
+        pcb->pagetable == pagetable) {
+      spinlock_acquire(&pcb->vm_slock);
+      entry = vm_lookup(pagetable, vaddr);
+      if (vm_translate(pagetable, vaddr) == phys_page &&
+          !(ADDR_IS_ON_EVEN_PAGE(vaddr) ? entry->D0 : entry->D1) &&
+          pagepool_phys_page_refs(phys_page) == 2) {
+        vm_swap_out(pagetable, vaddr, slot);
+        swapped = tlb_evict(pagetable, vaddr);
+        if (!swapped) {
+          /* Another CPU has started running the process, and its TLB may
+             have picked the page up again. */
+          vm_swap_in(pagetable, phys_page, vaddr);
+        }
+      }
+      spinlock_release(&pcb->vm_slock);
+    }
+    spinlock_release(&process_table_slock);
+    _interrupt_set_state(intr_status);
+
+    pagepool_free_phys_page(phys_page);
+    if (swapped) {
+      pagepool_free_phys_page(phys_page);
+      return true;
+    }
+    /* The page stays where it is.  A slot that could not be written stays
+       reserved, see `swap_write`. */
+    if (written == 0) {
+      swap_free(slot);
+    }
+  }
+  return false;
+}
+
+/* Reserve a zeroed page, swapping other pages out to make room if memory has
+   run out.  May block.  Returns 0 if there is no memory, and nothing to swap
+   out. */
+static uint32_t process_get_page(void)
+{
+  uint32_t phys_page;
+
+  do {
+    phys_page = pagepool_get_zeroed_phys_page();
+  } while (phys_page == 0 && process_reclaim_page());
+  return phys_page;
+}
+
+/* Read the page of the executable at `page` into a physical page, and tell
+   whether it is writable.  Pages of the read-only segment are shared with
+   every other process running the same executable.  Returns 0 if `page` is not
+   part of the program, or the page could not be read.  May block. */
+static uint32_t process_load_page(process_control_block_t *process,
+                                  uint32_t page, int *dirty)
+{
+  process_segment_t *segment;
+  uint32_t offset, length, phys_page;
+
+  if (process_in_segment(&process->ro_segment, page)) {
+    segment = &process->ro_segment;
+    *dirty = 0;
+  } else if (process_in_segment(&process->rw_segment, page)) {
+    segment = &process->rw_segment;
+    *dirty = 1;
+  } else {
+    return 0;
+  }
+
+  /* The part of the page past the end of the segment in the file is left
+     zero. */
+  offset = page - segment->vaddr;
+  length = offset < segment->size ? MIN(segment->size - offset, PAGE_SIZE) : 0;
+
+  if (!*dirty) {
+    return pagecache_get_page(process->executable_file,
+                              segment->location + offset, length);
+  }
+
+  phys_page = process_get_page();
+  if (phys_page == 0) {
+    return 0;
+  }
+  if (length > 0 &&
+      vfs_read_at(process->executable_file,
+                  (void *) ADDR_PHYS_TO_KERNEL(phys_page), length,
+                  segment->location + offset) != (int) length) {
+    pagepool_free_phys_page(phys_page);
+    return 0;
+  }
+  return phys_page;
+}
+
+/* Map `phys_page` at `page` in `process`, or free it if there is no memory
+   for the pagetable leaf it goes in.  Returns whether it was mapped.  The
+   process' vm lock is held. */
+static bool process_map_page(process_control_block_t *process,
+                             uint32_t phys_page, uint32_t page, int dirty)
+{
+  if (vm_map(process->pagetable, phys_page, page, dirty)) {
+    return true;
+  }
+  pagepool_free_phys_page(phys_page);
+  return false;
+}
+
+/* Map the page at `vaddr` if it lies in the program, the heap, a thread stack,
+   a mapped file or a shared memory segment of the current process.  Swapped
+   out pages are read back from swap, program and file pages from their file,
+   segment pages are shared, and the others are zeroed.  Called from
+   the TLB miss handler with interrupts disabled; reading a page, or swapping
+   pages out to make room, enables them, so that is only done if `may_block` is
+   set.  Returns true if `vaddr` is mapped or being swapped in afterwards, and
+   false if it is not part of the process or there is no memory for it. */
+bool process_demand_page(uint32_t vaddr, bool may_block)
+{
+  thread_table_t *thread = thread_get_current_thread_entry();
+  process_control_block_t *process;
+  uint32_t page = vaddr & PAGE_SIZE_MASK;
+  uint32_t phys_page, index, offset;
+  process_mapping_t *mapping;
+  openfile_t file;
+  int dirty, slot;
+  bool reclaimed, result = false;
+
+  if (thread->pagetable == NULL || thread->process_id < 0) {
+    return false;
+  }
+  process = &process_table[thread->process_id];
+  thread->page_faults++;
+
+  spinlock_acquire(&process->vm_slock);
+
+  /* Another thread may have faulted the page in while we waited. */
+  if (vm_translate(process->pagetable, vaddr) != 0) {
+    result = true;
+    goto end;
+  }
+
+  /* Make room for the page in the pagetable first, so that mapping it cannot
+     fail later on. */
+  while (vm_lookup(process->pagetable, vaddr) == NULL &&
+         !vm_create_leaf(process->pagetable, vaddr)) {
+    if (!may_block) {
+      goto end;
+    }
+    spinlock_release(&process->vm_slock);
+    _interrupt_enable();
+    reclaimed = process_reclaim_page();
+    _interrupt_disable();
+    spinlock_acquire(&process->vm_slock);
+    if (!reclaimed) {
+      goto end;
+    }
+  }
+
+  slot = vm_swap_slot(process->pagetable, vaddr);
+  if (slot >= 0) {
+    if (!may_block) {
+      goto end;
+    }
+
+    /* Keep the slot from being freed and used for another page while it is
+       read, should another thread swap the page in or unmap it meanwhile. */
+    swap_ref(slot);
+    spinlock_release(&process->vm_slock);
+    _interrupt_enable();
+    phys_page = process_get_page();
+    if (phys_page != 0 && swap_read(slot, phys_page) < 0) {
+      pagepool_free_phys_page(phys_page);
+      phys_page = 0;
+    }
+    _interrupt_disable();
+    spinlock_acquire(&process->vm_slock);
+    swap_free(slot);
+
+    if (phys_page == 0) {
+      goto end;
+    }
+    if (vm_swap_slot(process->pagetable, vaddr) != slot) {
+      /* Another thread of the process swapped it in first, or unmapped
+         it. */
+      pagepool_free_phys_page(phys_page);
+    } else {
+      vm_swap_in(process->pagetable, phys_page, page);
+      swap_free(slot);
+    }
+    result = true;
+    goto end;
+  }
+
+  if (process_in_segment(&process->ro_segment, page) ||
+      process_in_segment(&process->rw_segment, page)) {
+    if (!may_block) {
+      goto end;
+    }
+
+    /* Read the page with interrupts enabled, and without holding the lock,
+       so that other threads can run meanwhile. */
+    spinlock_release(&process->vm_slock);
+    _interrupt_enable();
+    phys_page = process_load_page(process, page, &dirty);
+    _interrupt_disable();
+    spinlock_acquire(&process->vm_slock);
+
+    if (phys_page == 0) {
+      goto end;
+    }
+    if (vm_translate(process->pagetable, vaddr) != 0 ||
+        vm_swap_slot(process->pagetable, vaddr) >= 0) {
+      /* Another thread of the process mapped it first. */
+      pagepool_free_phys_page(phys_page);
+      result = true;
+    } else {
+      result = process_map_page(process, phys_page, page, dirty);
+    }
+    goto end;
+  }
+
+  mapping = process_in_mapping(process, page, &index);
+  if (mapping != NULL && mapping->shm != NULL) {
+    /* The pages of a segment are always there, and shared writable. */
+    phys_page = usr_shm_page(mapping->shm, index);
+    pagepool_ref_phys_page(phys_page);
+    result = process_map_page(process, phys_page, page, 1);
+    goto end;
+  }
+  if (mapping != NULL) {
+    if (!may_block) {
+      goto end;
+    }
+
+    file = mapping->file;
+    offset = mapping->offset + index * PAGE_SIZE;
+    spinlock_release(&process->vm_slock);
+    _interrupt_enable();
+    phys_page = process_get_page();
+    if (phys_page != 0 &&
+        vfs_read_at(file, (void *) ADDR_PHYS_TO_KERNEL(phys_page), PAGE_SIZE,
+                    offset) < 0) {
+      pagepool_free_phys_page(phys_page);
+      phys_page = 0;
+    }
+    _interrupt_disable();
+    spinlock_acquire(&process->vm_slock);
+
+    if (phys_page == 0) {
+      goto end;
+    }
+    if (vm_translate(process->pagetable, vaddr) != 0 ||
+        mapping->file != file ||
+        mapping->offset + index * PAGE_SIZE != offset) {
+      /* Another thread of the process mapped it first, or unmapped the
+         file. */
+      pagepool_free_phys_page(phys_page);
+      result = true;
+    } else {
+      /* Write-protected, so that the first write marks it dirty, see
+         `process_copy_on_write`. */
+      result = process_map_page(process, phys_page, page, 0);
+    }
+    goto end;
+  }
+
+  if (!(process->heap_end != 0 &&
+        page >= (process->heap_start & PAGE_SIZE_MASK) &&
+        page <= (process->heap_end & PAGE_SIZE_MASK)) &&
+      !process_in_stack(process, page)) {
+    goto end;
+  }
+
+  phys_page = pagepool_get_zeroed_phys_page();
+  if (phys_page == 0) {
+    if (!may_block) {
+      goto end;
+    }
+
+    /* Make room by swapping other pages out. */
+    spinlock_release(&process->vm_slock);
+    _interrupt_enable();
+    phys_page = process_get_page();
+    _interrupt_disable();
+    spinlock_acquire(&process->vm_slock);
+
+    if (phys_page == 0) {
+      goto end;
+    }
+    if (vm_translate(process->pagetable, vaddr) != 0 ||
+        vm_swap_slot(process->pagetable, vaddr) >= 0) {
+      /* Another thread of the process mapped it first. */
+      pagepool_free_phys_page(phys_page);
+      result = true;
+      goto end;
+    }
+  }
+  result = process_map_page(process, phys_page, page, 1);
+
+ end:
+  spinlock_release(&process->vm_slock);
+  return result;
+}
+
+/* Make the copy-on-write page at `vaddr` in the current process writable.  A
+   page of a mapped file is made writable and so marked dirty.  Called from
+   the TLB modified exception handler with interrupts disabled.  Returns false
+   if the page is neither, or there is no memory for its copy. */
+bool process_copy_on_write(uint32_t vaddr)
+{
+  thread_table_t *thread = thread_get_current_thread_entry();
+  process_control_block_t *process;
+  uint32_t index;
+  bool result;
+
+  if (thread->pagetable == NULL || thread->process_id < 0) {
+    return false;
+  }
+  process = &process_table[thread->process_id];
+
+  spinlock_acquire(&process->vm_slock);
+  result = vm_copy_on_write(process->pagetable, vaddr);
+  if (!result &&
+      process_in_mapping(process, vaddr & PAGE_SIZE_MASK, &index) != NULL &&
+      vm_translate(process->pagetable, vaddr) != 0) {
+    vm_set_dirty(process->pagetable, vaddr, 1);
+    result = true;
+  }
+  spinlock_release(&process->vm_slock);
+  return result;
+}
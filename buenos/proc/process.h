@@ -36,6 +36,7 @@
 #define BUENOS_PROC_PROCESS_H
 
 #include "kernel/config.h"
+#include "kernel/spinlock.h"
 #include "lib/types.h"
 
 #define USERLAND_STACK_TOP 0x7fffeffc
@@ -44,12 +45,27 @@
 #define PROCESS_PTABLE_FULL -1
 #define PROCESS_ILLEGAL_JOIN -2
 #define PROCESS_TTABLE_FULL -3
+#define PROCESS_ILLEGAL_THREAD -4
+#define PROCESS_THREADS_FULL -5
+#define PROCESS_ILLEGAL_MAPPING -6
+#define PROCESS_ILLEGAL_RUSAGE -7
+#define PROCESS_NO_MEMORY -8
 
 // All process data is stored in statically allocated memory because of kmalloc
 // limitations, so we choose some sensible numbers.
 #define PROCESS_MAX_PROCESSES 32
 #define PROCESS_MAX_FILELENGTH 64
 
+/* Maximum number of threads in one process, including the initial one.  Each
+   thread gets its own user stack below USERLAND_STACK_TOP. */
+#define PROCESS_MAX_THREADS 8
+
+/* Maximum number of file mappings of one process, and the largest mapping in
+   pages.  Each mapping has its own window of addresses below the thread
+   stacks. */
+#define PROCESS_MAX_MAPPINGS 8
+#define PROCESS_MAPPING_PAGES 256
+
 typedef int process_id_t;
 typedef int openfile_t;
 
@@ -59,6 +75,73 @@ typedef enum {
   PROCESS_ZOMBIE
 } process_state_t;
 
+typedef enum {
+  PROCESS_THREAD_FREE,
+  PROCESS_THREAD_RUNNING,
+  PROCESS_THREAD_ZOMBIE
+} process_thread_state_t;
+
+/* Where an ELF segment of the executable is, in the file and in memory. */
+typedef struct {
+  uint32_t location;
+  uint32_t size;
+  uint32_t pages;
+  uint32_t vaddr;
+} process_segment_t;
+
+/* Part of an open file or a shared memory segment mapped into the address
+   space of a process, see `process_mmap` and `process_map_shm`.  The index in
+   the process' mapping array selects the window it is mapped at. */
+typedef struct {
+  /* The mapped file, or -1. */
+  openfile_t file;
+  /* The mapped shared memory segment (see proc/usr_shm.h), or NULL.  Both are
+     unset in unused entries. */
+  void *shm;
+  /* Position of the first mapped byte in the file, a multiple of
+     PAGE_SIZE. */
+  uint32_t offset;
+  /* Length of the mapping in pages. */
+  uint32_t pages;
+} process_mapping_t;
+
+/* Resources used by a process, see `process_getrusage`.  Userland has the
+   same structure as rusage_t in tests/lib.h. */
+typedef struct {
+  /* Timer ticks (CPU cycles) its threads ran for. */
+  uint32_t cpu_ticks;
+  /* TLB refills done while its threads ran. */
+  uint32_t tlb_refills;
+  /* Page faults handled, see `process_demand_page`. */
+  uint32_t page_faults;
+  /* Pages mapped in its address space.  For exited processes, the number
+     mapped when they exited; for the children of a process, the most any of
+     them had. */
+  uint32_t pages_resident;
+  /* System calls made. */
+  uint32_t syscalls;
+  /* Bytes read and written through the read and write system calls. */
+  uint32_t bytes_read;
+  uint32_t bytes_written;
+} process_rusage_t;
+
+/* One userland thread of a process.  The index in the process' thread array
+   is the thread id seen by userland, and also selects the thread's stack. */
+typedef struct {
+  process_thread_state_t state;
+  /* The kernel thread running this userland thread. */
+  int tid;
+  /* Value passed to `process_thread_exit`, read by `process_thread_join`. */
+  int retval;
+  /* Where the thread starts in userland, and its two arguments. */
+  uint32_t entry;
+  uint32_t arg0;
+  uint32_t arg1;
+  /* Kernel address of the futex the thread sleeps on in `futex_wait`, or
+     NULL.  Woken when the process starts exiting. */
+  int *futex;
+} process_thread_t;
+
 typedef struct {
   /* The executable name originates in userspace.  The struct instance may last
      longer than the process (so the original string memory might end up
@@ -77,9 +160,47 @@ typedef struct {
   /* Only a process' parent should be able to interface with it. */
   process_id_t parent;
 
-  /* End of the process heap. */
+  /* The executable stays open while the process runs, since its segments are
+     only read from it when they are first touched. */
+  openfile_t executable_file;
+  process_segment_t ro_segment;
+  process_segment_t rw_segment;
+
+  /* Start and end of the process heap.  Pages in this range are only mapped
+     once they are touched. */
+  uint32_t heap_start;
   uint32_t heap_end;
 
+  /* Number of pages each thread stack of the process may grow to, at most
+     CONFIG_USERLAND_STACK_SIZE, see `process_stacklimit`.  Touching the stack
+     below that faults. */
+  uint32_t stack_limit;
+
+  /* Files and shared memory segments mapped by the process.  Their pages
+     are mapped when first touched. */
+  process_mapping_t mappings[PROCESS_MAX_MAPPINGS];
+
+  /* The address space shared by all threads of the process. */
+  struct pagetable_struct_t *pagetable;
+
+  /* Serializes changes to the pagetable, heap_end and the mappings between
+     the process' threads. */
+  spinlock_t vm_slock;
+
+  /* The userland threads of the process, and how many are still alive.  The
+     process becomes a zombie when the last of them exits. */
+  process_thread_t threads[PROCESS_MAX_THREADS];
+  int thread_count;
+
+  /* Set by `process_finish`.  The remaining threads exit the next time they
+     enter the kernel, or are interrupted in userland. */
+  bool exiting;
+
+  /* Resources used by the threads of the process that have exited, and by
+     the children it has joined, including their joined children. */
+  process_rusage_t rusage;
+  process_rusage_t rusage_children;
+
   /* The files opened by this process. */
   openfile_t files[CONFIG_MAX_OPEN_FILES];
 } process_control_block_t;
@@ -93,6 +214,17 @@ void process_finish(int retval);
 int process_join(process_id_t pid);
 int process_fork();
 
+/* Thread management within the current process. */
+int process_thread_create(uint32_t entry, uint32_t arg0, uint32_t arg1);
+void process_thread_exit(int retval);
+int process_thread_join(int thread);
+void process_check_exiting();
+void process_check_interrupted();
+bool process_futex_sleep(int *futex);
+
+/* Resource usage. */
+int process_getrusage(int who, process_rusage_t *usage);
+
 /* Return PID of current process. */
 process_id_t process_get_current_process();
 
@@ -101,6 +233,16 @@ process_control_block_t *process_get_current_process_entry();
 
 /* Memory allocation. */
 uint32_t process_memlimit(uint32_t heap_end);
+uint32_t process_stacklimit(uint32_t pages);
+bool process_demand_page(uint32_t vaddr, bool may_block);
+bool process_reclaim_page(void);
+bool process_copy_on_write(uint32_t vaddr);
+
+/* File and shared memory mappings. */
+uint32_t process_mmap(openfile_t file, uint32_t offset, uint32_t length);
+uint32_t process_map_shm(void *shm, uint32_t pages);
+int process_munmap(uint32_t vaddr);
+void process_munmap_file(openfile_t file);
 
 /* Process file bookkeeping. */
 bool process_add_file(openfile_t file);
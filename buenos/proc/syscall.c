@@ -45,6 +45,11 @@
 #include "drivers/device.h"
 #include "drivers/gcd.h"
 #include "proc/usr_sem.h"
+#include "proc/futex.h"
+#include "proc/usr_barrier.h"
+#include "proc/usr_event.h"
+#include "proc/usr_shm.h"
+#include "kernel/thread.h"
 
 #define A0 user_context->cpu_regs[MIPS_REGISTER_A0]
 #define A1 user_context->cpu_regs[MIPS_REGISTER_A1]
@@ -72,6 +77,8 @@ void syscall_handle(context_t *user_context)
    * restored from user_context.
    */
 
+  thread_get_current_thread_entry()->syscalls++;
+
   switch (A0) {
   case SYSCALL_HALT:
     halt_kernel();
@@ -93,11 +100,26 @@ void syscall_handle(context_t *user_context)
   case SYSCALL_GETPID:
     V0 = process_get_current_process();
     break;
+  case SYSCALL_THREAD_CREATE:
+    V0 = process_thread_create(A1, A2, A3);
+    break;
+  case SYSCALL_THREAD_EXIT:
+    process_thread_exit((int) A1);
+    break;
+  case SYSCALL_THREAD_JOIN:
+    V0 = process_thread_join((int) A1);
+    break;
+  case SYSCALL_GETRUSAGE:
+    V0 = process_getrusage((int) A1, (process_rusage_t*) A2);
+    break;
 
     /* Memory allocation */
   case SYSCALL_MEMLIMIT:
     V0 = process_memlimit(A1);
     break;
+  case SYSCALL_STACKLIMIT:
+    V0 = process_stacklimit(A1);
+    break;
 
     /* File I/O */
   case SYSCALL_OPEN:
@@ -124,6 +146,12 @@ void syscall_handle(context_t *user_context)
   case SYSCALL_WRITE:
     V0 = io_write((openfile_t) A1, (void*) A2, (int) A3);
     break;
+  case SYSCALL_MMAP:
+    V0 = (uint32_t) io_mmap((openfile_t) A1, (int) A2, (int) A3);
+    break;
+  case SYSCALL_MUNMAP:
+    V0 = io_munmap((void*) A1);
+    break;
 
     /* User semaphores */
   case SYSCALL_SEM_OPEN:
@@ -139,6 +167,48 @@ void syscall_handle(context_t *user_context)
     V0 = usr_sem_destroy((usr_sem_t*) A1);
     break;
 
+    /* Futexes */
+  case SYSCALL_FUTEX_WAIT:
+    V0 = futex_wait((int*) A1, (int) A2);
+    break;
+  case SYSCALL_FUTEX_WAKE:
+    V0 = futex_wake((int*) A1, (int) A2);
+    break;
+
+    /* User barriers and events */
+  case SYSCALL_BARRIER_OPEN:
+    V0 = (uint32_t) usr_barrier_open((char*) A1, (int) A2);
+    break;
+  case SYSCALL_BARRIER_WAIT:
+    V0 = usr_barrier_wait((usr_barrier_t*) A1);
+    break;
+  case SYSCALL_BARRIER_DESTROY:
+    V0 = usr_barrier_destroy((usr_barrier_t*) A1);
+    break;
+  case SYSCALL_EVENT_OPEN:
+    V0 = (uint32_t) usr_event_open((char*) A1, (int) A2);
+    break;
+  case SYSCALL_EVENT_WAIT:
+    V0 = usr_event_wait((usr_event_t*) A1);
+    break;
+  case SYSCALL_EVENT_SIGNAL:
+    V0 = usr_event_signal((usr_event_t*) A1);
+    break;
+  case SYSCALL_EVENT_DESTROY:
+    V0 = usr_event_destroy((usr_event_t*) A1);
+    break;
+
+    /* Shared memory segments */
+  case SYSCALL_SHM_OPEN:
+    V0 = (uint32_t) usr_shm_open((char*) A1, (int) A2);
+    break;
+  case SYSCALL_SHM_MAP:
+    V0 = (uint32_t) usr_shm_map((usr_shm_t*) A1);
+    break;
+  case SYSCALL_SHM_UNLINK:
+    V0 = usr_shm_unlink((char*) A1);
+    break;
+
   default:
     KERNEL_PANIC("Unhandled system call\n");
   }
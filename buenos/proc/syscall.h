@@ -51,6 +51,15 @@
 #define SYSCALL_MEMLIMIT  0x105
 #define SYSCALL_GETPID    0x106
 
+/* Threads within a process. */
+#define SYSCALL_THREAD_CREATE 0x107
+#define SYSCALL_THREAD_EXIT   0x108
+#define SYSCALL_THREAD_JOIN   0x109
+
+/* Resource usage of processes. */
+#define SYSCALL_GETRUSAGE     0x10a
+#define SYSCALL_STACKLIMIT    0x10b
+
 /* I/O. */
 #define SYSCALL_OPEN    0x201
 #define SYSCALL_CLOSE   0x202
@@ -60,6 +69,8 @@
 #define SYSCALL_CREATE  0x206
 #define SYSCALL_REMOVE  0x207
 #define SYSCALL_TELL    0x208
+#define SYSCALL_MMAP    0x209
+#define SYSCALL_MUNMAP  0x20a
 
 /* User semaphore support. */
 #define SYSCALL_SEM_OPEN    0x300
@@ -67,9 +78,32 @@
 #define SYSCALL_SEM_VACATE  0x302
 #define SYSCALL_SEM_DESTROY 0x303
 
+/* Futexes. */
+#define SYSCALL_FUTEX_WAIT  0x304
+#define SYSCALL_FUTEX_WAKE  0x305
+
+/* User barriers and events. */
+#define SYSCALL_BARRIER_OPEN    0x306
+#define SYSCALL_BARRIER_WAIT    0x307
+#define SYSCALL_BARRIER_DESTROY 0x308
+#define SYSCALL_EVENT_OPEN      0x309
+#define SYSCALL_EVENT_WAIT      0x30a
+#define SYSCALL_EVENT_SIGNAL    0x30b
+#define SYSCALL_EVENT_DESTROY   0x30c
+
+/* Shared memory segments. */
+#define SYSCALL_SHM_OPEN        0x30d
+#define SYSCALL_SHM_MAP         0x30e
+#define SYSCALL_SHM_UNLINK      0x30f
+
 /* Console file handles. */
 #define FILEHANDLE_STDIN    0
 #define FILEHANDLE_STDOUT   1
 #define FILEHANDLE_STDERR   2
 
+/* Whose resource usage SYSCALL_GETRUSAGE reports: the calling process', or
+   that of the children it has joined. */
+#define RUSAGE_SELF         0
+#define RUSAGE_CHILDREN     1
+
 #endif
@@ -0,0 +1,165 @@
+#include "proc/usr_barrier.h"
+#include "kernel/interrupt.h"
+#include "kernel/sleepq.h"
+#include "kernel/thread.h"
+#include "lib/libc.h"
+
+/* Named barriers for userland.  Each waiter costs one syscall, and the last
+   arrival releases everybody with a single `sleepq_wake_all`, instead of the
+   chain of semaphore V's a semaphore-built barrier needs. */
+
+static usr_barrier_block_t usr_barrier_table[MAX_USR_BARRIER];
+static spinlock_t usr_barrier_table_slock;
+static usr_name_table_t usr_barrier_names;
+
+static usr_barrier_block_t* find_barrier(usr_barrier_t* p) {
+  usr_barrier_block_t* barrier = (usr_barrier_block_t*) p;
+  if (barrier >= usr_barrier_table
+      && barrier < usr_barrier_table + MAX_USR_BARRIER) {
+    return barrier;
+  }
+  else {
+    return NULL;
+  }
+}
+
+void usr_barrier_init() {
+  int i;
+
+  spinlock_reset(&usr_barrier_table_slock);
+  usr_name_table_init(&usr_barrier_names);
+
+  for (i = 0; i < MAX_USR_BARRIER; i++) {
+    usr_barrier_table[i].state = USR_BARRIER_FREE;
+  }
+}
+
+/* Open the barrier called `name`.  If `parties` is positive, a new barrier
+   for that many threads is created, failing if the name is taken; otherwise an
+   existing barrier is looked up.  Returns NULL on failure. */
+usr_barrier_t* usr_barrier_open(const char* name, int parties) {
+  int i;
+  interrupt_status_t intr_status;
+  usr_barrier_t* ret = NULL;
+  usr_name_entry_t* existing;
+  char key[USR_NAME_MAX];
+
+  /* The name is in userland memory, which may have to be paged in, so it is
+     copied before taking the lock. */
+  stringcopy(key, name, USR_NAME_MAX);
+
+  intr_status = _interrupt_disable();
+  spinlock_acquire(&usr_barrier_table_slock);
+
+  existing = usr_name_lookup(&usr_barrier_names, key);
+
+  if (parties <= 0) {
+    ret = (usr_barrier_t*) existing;
+  }
+  else if (existing == NULL) {
+    for (i = 0; i < MAX_USR_BARRIER; i++) {
+      usr_barrier_block_t* barrier = &usr_barrier_table[i];
+      if (barrier->state == USR_BARRIER_FREE) {
+        barrier->state = USR_BARRIER_USED;
+        spinlock_reset(&barrier->slock);
+        barrier->parties = parties;
+        barrier->arrived = 0;
+        barrier->phase = 0;
+        barrier->leaving = 0;
+        usr_name_insert(&usr_barrier_names, &barrier->name, key);
+        ret = (usr_barrier_t*) barrier;
+        break;
+      }
+    }
+  }
+
+  spinlock_release(&usr_barrier_table_slock);
+  _interrupt_set_state(intr_status);
+
+  return ret;
+}
+
+/* Block until `parties` threads have called this function.  Returns
+   USR_BARRIER_SERIAL in the last thread to arrive, 0 in the others. */
+int usr_barrier_wait(usr_barrier_t* p) {
+  interrupt_status_t intr_status;
+  uint32_t phase;
+  int ret = 0;
+  usr_barrier_block_t* barrier = find_barrier(p);
+
+  if (barrier == NULL || barrier->state != USR_BARRIER_USED) {
+    return USR_BARRIER_ERROR_NOT_IN_USE;
+  }
+
+  intr_status = _interrupt_disable();
+  spinlock_acquire(&barrier->slock);
+
+  phase = barrier->phase;
+  barrier->arrived++;
+
+  if (barrier->arrived == barrier->parties) {
+    /* Last one in: open the barrier for everyone at once. */
+    barrier->leaving += barrier->arrived - 1;
+    barrier->arrived = 0;
+    barrier->phase++;
+    sleepq_wake_all(barrier);
+    ret = USR_BARRIER_SERIAL;
+  }
+  else {
+    while (barrier->phase == phase) {
+      sleepq_add(barrier);
+      spinlock_release(&barrier->slock);
+      thread_switch();
+      spinlock_acquire(&barrier->slock);
+    }
+    barrier->leaving--;
+    if (barrier->leaving == 0) {
+      sleepq_wake_all(&barrier->leaving);
+    }
+  }
+
+  spinlock_release(&barrier->slock);
+  _interrupt_set_state(intr_status);
+
+  return ret;
+}
+
+/* Destroy the barrier, unless threads are waiting on it.  Threads that were
+   released but have not yet returned from `usr_barrier_wait` are waited
+   for, so that the block is not reused under them.  Returns 1 if the barrier
+   was destroyed, 0 otherwise. */
+int usr_barrier_destroy(usr_barrier_t* p) {
+  interrupt_status_t intr_status;
+  int ret = 0;
+  usr_barrier_block_t* barrier = find_barrier(p);
+
+  if (barrier == NULL) {
+    return 0;
+  }
+
+  intr_status = _interrupt_disable();
+  spinlock_acquire(&usr_barrier_table_slock);
+  spinlock_acquire(&barrier->slock);
+
+  while (barrier->state == USR_BARRIER_USED && barrier->arrived == 0 &&
+         barrier->leaving > 0) {
+    sleepq_add(&barrier->leaving);
+    spinlock_release(&barrier->slock);
+    spinlock_release(&usr_barrier_table_slock);
+    thread_switch();
+    spinlock_acquire(&usr_barrier_table_slock);
+    spinlock_acquire(&barrier->slock);
+  }
+
+  if (barrier->state == USR_BARRIER_USED && barrier->arrived == 0) {
+    usr_name_remove(&usr_barrier_names, &barrier->name);
+    barrier->state = USR_BARRIER_FREE;
+    ret = 1;
+  }
+
+  spinlock_release(&barrier->slock);
+  spinlock_release(&usr_barrier_table_slock);
+  _interrupt_set_state(intr_status);
+
+  return ret;
+}
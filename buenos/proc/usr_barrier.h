@@ -0,0 +1,46 @@
+#ifndef BUENOS_PROC_BARRIER
+#define BUENOS_PROC_BARRIER
+
+#include "lib/types.h"
+#include "kernel/spinlock.h"
+#include "proc/usr_name.h"
+
+typedef void usr_barrier_t;
+
+#define MAX_USR_BARRIER 32
+
+/* Returned by `usr_barrier_wait` to exactly one of the released threads. */
+#define USR_BARRIER_SERIAL 1
+
+#define USR_BARRIER_ERROR_NOT_IN_USE -1
+
+typedef enum {
+  USR_BARRIER_FREE,
+  USR_BARRIER_USED
+} usr_barrier_state_t;
+
+typedef struct {
+  /* Must be first, so an entry found by name is also the block. */
+  usr_name_entry_t name;
+  usr_barrier_state_t state;
+  spinlock_t slock;
+  /* Number of threads that must arrive before all are released. */
+  int parties;
+  /* Number of threads that have arrived in the current phase. */
+  int arrived;
+  /* Incremented every time the barrier opens. */
+  uint32_t phase;
+  /* Number of released threads that have not yet left `usr_barrier_wait`.
+     They still read the block, so it is not freed before they are gone. */
+  int leaving;
+} usr_barrier_block_t;
+
+void usr_barrier_init();
+
+usr_barrier_t* usr_barrier_open(const char* name, int parties);
+
+int usr_barrier_wait(usr_barrier_t* barrier);
+
+int usr_barrier_destroy(usr_barrier_t* barrier);
+
+#endif
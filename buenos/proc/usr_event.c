@@ -0,0 +1,154 @@
+#include "proc/usr_event.h"
+#include "kernel/interrupt.h"
+#include "kernel/sleepq.h"
+#include "kernel/thread.h"
+#include "lib/libc.h"
+
+static usr_event_block_t usr_event_table[MAX_USR_EVENT];
+static spinlock_t usr_event_table_slock;
+static usr_name_table_t usr_event_names;
+
+static usr_event_block_t* find_event(usr_event_t* p) {
+  usr_event_block_t* event = (usr_event_block_t*) p;
+  if (event >= usr_event_table
+      && event < usr_event_table + MAX_USR_EVENT) {
+    return event;
+  }
+  else {
+    return NULL;
+  }
+}
+
+void usr_event_init() {
+  int i;
+
+  spinlock_reset(&usr_event_table_slock);
+  usr_name_table_init(&usr_event_names);
+
+  for (i = 0; i < MAX_USR_EVENT; i++) {
+    usr_event_table[i].state = USR_EVENT_FREE;
+  }
+}
+
+/* Open the event called `name`.  If `signalled` is non-negative, a new event
+   is created in that state (0 or 1), failing if the name is taken; otherwise
+   an existing event is looked up.  Returns NULL on failure. */
+usr_event_t* usr_event_open(const char* name, int signalled) {
+  int i;
+  interrupt_status_t intr_status;
+  usr_event_t* ret = NULL;
+  usr_name_entry_t* existing;
+  char key[USR_NAME_MAX];
+
+  /* The name is in userland memory, which may have to be paged in, so it is
+     copied before taking the lock. */
+  stringcopy(key, name, USR_NAME_MAX);
+
+  intr_status = _interrupt_disable();
+  spinlock_acquire(&usr_event_table_slock);
+
+  existing = usr_name_lookup(&usr_event_names, key);
+
+  if (signalled < 0) {
+    ret = (usr_event_t*) existing;
+  }
+  else if (existing == NULL) {
+    for (i = 0; i < MAX_USR_EVENT; i++) {
+      usr_event_block_t* event = &usr_event_table[i];
+      if (event->state == USR_EVENT_FREE) {
+        event->state = USR_EVENT_USED;
+        spinlock_reset(&event->slock);
+        event->signalled = (signalled != 0);
+        event->waiters = 0;
+        usr_name_insert(&usr_event_names, &event->name, key);
+        ret = (usr_event_t*) event;
+        break;
+      }
+    }
+  }
+
+  spinlock_release(&usr_event_table_slock);
+  _interrupt_set_state(intr_status);
+
+  return ret;
+}
+
+/* Block until the event has been signalled. */
+int usr_event_wait(usr_event_t* p) {
+  interrupt_status_t intr_status;
+  usr_event_block_t* event = find_event(p);
+
+  if (event == NULL || event->state != USR_EVENT_USED) {
+    return USR_EVENT_ERROR_NOT_IN_USE;
+  }
+
+  intr_status = _interrupt_disable();
+  spinlock_acquire(&event->slock);
+
+  while (!event->signalled) {
+    event->waiters++;
+    sleepq_add(event);
+    spinlock_release(&event->slock);
+    thread_switch();
+    spinlock_acquire(&event->slock);
+    event->waiters--;
+  }
+
+  spinlock_release(&event->slock);
+  _interrupt_set_state(intr_status);
+
+  return 0;
+}
+
+/* Signal the event, releasing all current waiters at once. */
+int usr_event_signal(usr_event_t* p) {
+  interrupt_status_t intr_status;
+  usr_event_block_t* event = find_event(p);
+
+  if (event == NULL || event->state != USR_EVENT_USED) {
+    return USR_EVENT_ERROR_NOT_IN_USE;
+  }
+
+  intr_status = _interrupt_disable();
+  spinlock_acquire(&event->slock);
+
+  if (!event->signalled) {
+    event->signalled = true;
+    if (event->waiters > 0) {
+      sleepq_wake_all(event);
+    }
+  }
+
+  spinlock_release(&event->slock);
+  _interrupt_set_state(intr_status);
+
+  return 0;
+}
+
+/* Destroy the event, unless threads are waiting on it.  Returns 1 if the
+   event was destroyed, 0 otherwise. */
+int usr_event_destroy(usr_event_t* p) {
+  interrupt_status_t intr_status;
+  int ret = 0;
+  usr_event_block_t* event = find_event(p);
+
+  if (event == NULL) {
+    return 0;
+  }
+
+  intr_status = _interrupt_disable();
+  spinlock_acquire(&usr_event_table_slock);
+  spinlock_acquire(&event->slock);
+
+  if (event->state == USR_EVENT_USED && event->waiters == 0) {
+    usr_name_remove(&usr_event_names, &event->name);
+    event->state = USR_EVENT_FREE;
+    ret = 1;
+  }
+
+  spinlock_release(&event->slock);
+  spinlock_release(&usr_event_table_slock);
+  _interrupt_set_state(intr_status);
+
+  return ret;
+}
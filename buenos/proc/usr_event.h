@@ -0,0 +1,41 @@
+#ifndef BUENOS_PROC_EVENT
+#define BUENOS_PROC_EVENT
+
+#include "lib/types.h"
+#include "kernel/spinlock.h"
+#include "proc/usr_name.h"
+
+typedef void usr_event_t;
+
+#define MAX_USR_EVENT 32
+
+#define USR_EVENT_ERROR_NOT_IN_USE -1
+
+typedef enum {
+  USR_EVENT_FREE,
+  USR_EVENT_USED
+} usr_event_state_t;
+
+/* A one-shot event (latch): once signalled it stays signalled, and every
+   present and future waiter passes straight through. */
+typedef struct {
+  /* Must be first, so an entry found by name is also the block. */
+  usr_name_entry_t name;
+  usr_event_state_t state;
+  spinlock_t slock;
+  bool signalled;
+  /* Number of threads sleeping on the event. */
+  int waiters;
+} usr_event_block_t;
+
+void usr_event_init();
+
+usr_event_t* usr_event_open(const char* name, int signalled);
+
+int usr_event_wait(usr_event_t* event);
+
+int usr_event_signal(usr_event_t* event);
+
+int usr_event_destroy(usr_event_t* event);
+
+#endif
@@ -0,0 +1,66 @@
+#include "proc/usr_name.h"
+#include "lib/libc.h"
+
+/* FNV-1a over at most USR_NAME_MAX-1 characters, matching what
+   `stringcopy` keeps of a name. */
+static uint32_t hash_name(const char* name) {
+  uint32_t hash = 2166136261u;
+  int i;
+  for (i = 0; i < USR_NAME_MAX - 1 && name[i] != '\0'; i++) {
+    hash ^= (uint8_t) name[i];
+    hash *= 16777619u;
+  }
+  return hash;
+}
+
+void usr_name_table_init(usr_name_table_t* table) {
+  int i;
+  for (i = 0; i < USR_NAME_HASH_SIZE; i++) {
+    table->buckets[i] = NULL;
+  }
+}
+
+usr_name_entry_t* usr_name_lookup(usr_name_table_t* table, const char* name) {
+  char key[USR_NAME_MAX];
+  uint32_t hash;
+  usr_name_entry_t* entry;
+
+  /* Compare against the name as it would have been stored. */
+  stringcopy(key, name, USR_NAME_MAX);
+  hash = hash_name(key);
+
+  for (entry = table->buckets[hash % USR_NAME_HASH_SIZE];
+       entry != NULL;
+       entry = entry->next) {
+    if (entry->hash == hash && stringcmp(entry->name, key) == 0) {
+      return entry;
+    }
+  }
+  return NULL;
+}
+
+void usr_name_insert(usr_name_table_t* table, usr_name_entry_t* entry,
+                     const char* name) {
+  usr_name_entry_t** bucket;
+
+  stringcopy(entry->name, name, USR_NAME_MAX);
+  entry->hash = hash_name(entry->name);
+
+  bucket = &table->buckets[entry->hash % USR_NAME_HASH_SIZE];
+  entry->next = *bucket;
+  *bucket = entry;
+}
+
+void usr_name_remove(usr_name_table_t* table, usr_name_entry_t* entry) {
+  usr_name_entry_t** link;
+
+  for (link = &table->buckets[entry->hash % USR_NAME_HASH_SIZE];
+       *link != NULL;
+       link = &(*link)->next) {
+    if (*link == entry) {
+      *link = entry->next;
+      entry->next = NULL;
+      return;
+    }
+  }
+}
@@ -0,0 +1,34 @@
+#ifndef BUENOS_PROC_USR_NAME
+#define BUENOS_PROC_USR_NAME
+
+#include "lib/types.h"
+
+/* Hashed namespace for named userland objects (semaphores, barriers,
+   events).  The table does no locking of its own; callers hold the lock
+   that protects the objects the entries are embedded in.  Since that is a
+   spinlock, the names given must be in kernel memory: a userland name is
+   copied out before taking the lock. */
+
+#define USR_NAME_MAX 32
+#define USR_NAME_HASH_SIZE 31
+
+typedef struct usr_name_entry {
+  char name[USR_NAME_MAX];
+  uint32_t hash;
+  struct usr_name_entry* next;
+} usr_name_entry_t;
+
+typedef struct {
+  usr_name_entry_t* buckets[USR_NAME_HASH_SIZE];
+} usr_name_table_t;
+
+void usr_name_table_init(usr_name_table_t* table);
+
+usr_name_entry_t* usr_name_lookup(usr_name_table_t* table, const char* name);
+
+void usr_name_insert(usr_name_table_t* table, usr_name_entry_t* entry,
+                     const char* name);
+
+void usr_name_remove(usr_name_table_t* table, usr_name_entry_t* entry);
+
+#endif
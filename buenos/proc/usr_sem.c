@@ -7,6 +7,9 @@
 static usr_sem_block_t usr_sem_table[MAX_USR_SEM];
 static spinlock_t usr_sem_table_slock;
 
+/* Names of the semaphores in use, for O(1) lookup in `usr_sem_open`. */
+static usr_name_table_t usr_sem_names;
+
 static void reset(int i) {
   usr_sem_table[i].state = USR_SEM_FREE;
 }
@@ -24,6 +27,7 @@ static usr_sem_block_t* find_sem(usr_sem_t* p) {
 
 void usr_sem_init() {
   spinlock_reset(&usr_sem_table_slock);
+  usr_name_table_init(&usr_sem_names);
 
   int i;
   for (i = 0; i < MAX_USR_SEM; i++) {
@@ -35,43 +39,47 @@ usr_sem_t* usr_sem_open(const char* name, int value) {
   int i;
   interrupt_status_t intr_status;
   usr_sem_t* ret;
+  usr_name_entry_t* existing;
+  char key[USR_NAME_MAX];
+
+  /* The name is in userland memory, which may have to be paged in, so it is
+     copied before taking the lock. */
+  stringcopy(key, name, USR_NAME_MAX);
 
   intr_status = _interrupt_disable();
   spinlock_acquire(&usr_sem_table_slock);
 
+  existing = usr_name_lookup(&usr_sem_names, key);
+
   if (value < 0) {
     /* Try to find an existing semaphore. */
-    for (i = 0; i < MAX_USR_SEM; i++) {
-      usr_sem_block_t* sem = &usr_sem_table[i];
-      if (sem->state == USR_SEM_USED
-          && stringcmp(sem->name, name) == 0) {
-        ret = (usr_sem_t*) sem;
-        goto unlock;
-      }
+    if (existing != NULL) {
+      ret = (usr_sem_t*) existing;
+    }
+    else {
+      ret = NULL;
     }
-    ret = NULL;
     goto unlock;
   }
   else {
     /* Try to create a fresh semaphore. */
 
     /* Check if one already exists. */
-    for (i = 0; i < MAX_USR_SEM; i++) {
-      usr_sem_block_t* sem = &usr_sem_table[i];
-      if (sem->state == USR_SEM_USED
-          && stringcmp(sem->name, name) == 0) {
-        ret = NULL;
-        goto unlock;
-      }
+    if (existing != NULL) {
+      ret = NULL;
+      goto unlock;
     }
 
     /* Create the new one. */
     for (i = 0; i < MAX_USR_SEM; i++) {
       usr_sem_block_t* sem = &usr_sem_table[i];
       if (sem->state == USR_SEM_FREE) {
-        sem->state = USR_SEM_USED;
-        stringcopy(sem->name, name, MAX_USR_SEM_NAME);
         sem->kernel_sem = semaphore_create(value);
+        if (sem->kernel_sem == NULL) {
+          break;
+        }
+        sem->state = USR_SEM_USED;
+        usr_name_insert(&usr_sem_names, &sem->name, key);
         ret = (usr_sem_t*) sem;
         goto unlock;
       }
@@ -120,8 +128,13 @@ int usr_sem_destroy(usr_sem_t* p) {
        have become blocking since we checked it.  The only way to avoid this
        race condition is to disable blocking on this semaphore altogether,
        but that can only be done if we keep the semaphore alive forever. */
+    interrupt_status_t intr_status = _interrupt_disable();
+    spinlock_acquire(&usr_sem_table_slock);
+    usr_name_remove(&usr_sem_names, &sem->name);
     semaphore_destroy(sem->kernel_sem);
     sem->state = USR_SEM_FREE;
+    spinlock_release(&usr_sem_table_slock);
+    _interrupt_set_state(intr_status);
     return 1;
   }
 }
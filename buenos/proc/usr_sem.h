@@ -3,12 +3,13 @@
 
 #include "lib/types.h"
 #include "kernel/semaphore.h"
+#include "proc/usr_name.h"
 
 
 typedef void usr_sem_t;
 
 #define MAX_USR_SEM 32
-#define MAX_USR_SEM_NAME 32
+#define MAX_USR_SEM_NAME USR_NAME_MAX
 
 #define USR_SEM_ERROR_NOT_IN_USE -1
 
@@ -18,8 +19,9 @@ typedef enum {
 } usr_sem_state_t;
 
 typedef struct {
+  /* Must be first, so an entry found by name is also the block. */
+  usr_name_entry_t name;
   usr_sem_state_t state;
-  char name[MAX_USR_SEM_NAME];
   semaphore_t* kernel_sem;
 } usr_sem_block_t;
 
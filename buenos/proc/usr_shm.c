@@ -0,0 +1,208 @@
+#include "proc/usr_shm.h"
+#include "kernel/assert.h"
+#include "kernel/interrupt.h"
+#include "kernel/spinlock.h"
+#include "vm/pagepool.h"
+#include "lib/libc.h"
+
+static usr_shm_block_t usr_shm_table[MAX_USR_SHM];
+static spinlock_t usr_shm_table_slock;
+static usr_name_table_t usr_shm_names;
+
+static usr_shm_block_t* find_shm(usr_shm_t* p) {
+  usr_shm_block_t* shm = (usr_shm_block_t*) p;
+  if (shm >= usr_shm_table
+      && shm < usr_shm_table + MAX_USR_SHM) {
+    return shm;
+  }
+  else {
+    return NULL;
+  }
+}
+
+void usr_shm_init() {
+  int i;
+
+  spinlock_reset(&usr_shm_table_slock);
+  usr_name_table_init(&usr_shm_names);
+
+  for (i = 0; i < MAX_USR_SHM; i++) {
+    usr_shm_table[i].state = USR_SHM_FREE;
+  }
+}
+
+/* Drop the segment's references to its first `pages` pages. */
+static void free_pages(usr_shm_block_t* shm, uint32_t pages) {
+  uint32_t i;
+  for (i = 0; i < pages; i++) {
+    pagepool_free_phys_page(shm->phys_pages[i]);
+  }
+}
+
+/* Drop a reference to the segment, and destroy it if it was the last one.
+   The table lock is held. */
+static void drop_ref(usr_shm_block_t* shm) {
+  KERNEL_ASSERT(shm->state == USR_SHM_USED && shm->refs > 0);
+  shm->refs--;
+  if (shm->refs == 0) {
+    free_pages(shm, shm->pages);
+    shm->state = USR_SHM_FREE;
+  }
+}
+
+/* Open the shared memory segment called `name`.  If `size` is non-negative, a
+   new zero-filled segment of that many bytes is created, failing if the name
+   is taken; otherwise an existing segment is looked up.  The name keeps the
+   segment until it is unlinked with `usr_shm_unlink`, so it can be mapped
+   after it is opened.  Returns NULL on failure. */
+usr_shm_t* usr_shm_open(const char* name, int size) {
+  int i;
+  interrupt_status_t intr_status;
+  usr_shm_block_t* shm = NULL;
+  usr_shm_t* ret = NULL;
+  uint32_t pages, page;
+  char key[USR_NAME_MAX];
+
+  if (size > USR_SHM_MAX_PAGES * PAGE_SIZE || size == 0) {
+    return NULL;
+  }
+
+  /* The name is in userland memory, which may have to be paged in, so it is
+     copied before taking the lock. */
+  stringcopy(key, name, USR_NAME_MAX);
+
+  intr_status = _interrupt_disable();
+  spinlock_acquire(&usr_shm_table_slock);
+
+  if (size < 0) {
+    ret = (usr_shm_t*) usr_name_lookup(&usr_shm_names, key);
+  }
+  else if (usr_name_lookup(&usr_shm_names, key) == NULL) {
+    for (i = 0; i < MAX_USR_SHM; i++) {
+      if (usr_shm_table[i].state == USR_SHM_FREE) {
+        /* Only claim the entry; the pages are allocated without the lock. */
+        shm = &usr_shm_table[i];
+        shm->state = USR_SHM_CREATING;
+        shm->refs = 0;
+        shm->pages = 0;
+        break;
+      }
+    }
+  }
+
+  spinlock_release(&usr_shm_table_slock);
+  _interrupt_set_state(intr_status);
+
+  if (shm == NULL) {
+    return ret;
+  }
+
+  pages = (size + PAGE_SIZE - 1) / PAGE_SIZE;
+  for (shm->pages = 0; shm->pages < pages; shm->pages++) {
+    do {
+      page = pagepool_get_zeroed_phys_page();
+    } while (page == 0 && process_reclaim_page());
+    if (page == 0) {
+      break;
+    }
+    shm->phys_pages[shm->pages] = page;
+  }
+
+  intr_status = _interrupt_disable();
+  spinlock_acquire(&usr_shm_table_slock);
+
+  /* Someone else may have created a segment of the same name meanwhile. */
+  if (shm->pages == pages &&
+      usr_name_lookup(&usr_shm_names, key) == NULL) {
+    usr_name_insert(&usr_shm_names, &shm->name, key);
+    shm->state = USR_SHM_USED;
+    shm->refs = 1;
+    ret = (usr_shm_t*) shm;
+  }
+  else {
+    free_pages(shm, shm->pages);
+    shm->state = USR_SHM_FREE;
+  }
+
+  spinlock_release(&usr_shm_table_slock);
+  _interrupt_set_state(intr_status);
+
+  return ret;
+}
+
+/* Map the segment into the address space of the current process.  Returns
+   the address of the mapping, or NULL on failure.  The mapping is removed
+   with `process_munmap`. */
+void* usr_shm_map(usr_shm_t* p) {
+  interrupt_status_t intr_status;
+  usr_shm_block_t* shm = find_shm(p);
+  uint32_t vaddr;
+
+  if (shm == NULL) {
+    return NULL;
+  }
+
+  intr_status = _interrupt_disable();
+  spinlock_acquire(&usr_shm_table_slock);
+  if (shm->state != USR_SHM_USED) {
+    shm = NULL;
+  }
+  else {
+    shm->refs++;
+  }
+  spinlock_release(&usr_shm_table_slock);
+  _interrupt_set_state(intr_status);
+
+  if (shm == NULL) {
+    return NULL;
+  }
+
+  vaddr = process_map_shm(shm, shm->pages);
+  if (vaddr == 0) {
+    usr_shm_unref(shm);
+  }
+  return (void*) vaddr;
+}
+
+/* Return physical page `index` of a mapped segment. */
+uint32_t usr_shm_page(usr_shm_t* p, uint32_t index) {
+  usr_shm_block_t* shm = (usr_shm_block_t*) p;
+
+  KERNEL_ASSERT(index < shm->pages);
+  return shm->phys_pages[index];
+}
+
+/* Drop a mapping of the segment, and destroy the segment if it was the last
+   reference. */
+void usr_shm_unref(usr_shm_t* p) {
+  interrupt_status_t intr_status;
+
+  intr_status = _interrupt_disable();
+  spinlock_acquire(&usr_shm_table_slock);
+  drop_ref((usr_shm_block_t*) p);
+  spinlock_release(&usr_shm_table_slock);
+  _interrupt_set_state(intr_status);
+}
+
+/* Remove the name of the segment called `name`, so that it can no longer be
+   opened, and destroy the segment once it is no longer mapped.  Returns 1, or
+   0 if there is no such segment. */
+int usr_shm_unlink(const char* name) {
+  interrupt_status_t intr_status;
+  usr_shm_block_t* shm;
+  char key[USR_NAME_MAX];
+
+  stringcopy(key, name, USR_NAME_MAX);
+
+  intr_status = _interrupt_disable();
+  spinlock_acquire(&usr_shm_table_slock);
+  shm = (usr_shm_block_t*) usr_name_lookup(&usr_shm_names, key);
+  if (shm != NULL) {
+    usr_name_remove(&usr_shm_names, &shm->name);
+    drop_ref(shm);
+  }
+  spinlock_release(&usr_shm_table_slock);
+  _interrupt_set_state(intr_status);
+
+  return shm != NULL;
+}
@@ -0,0 +1,49 @@
+#ifndef BUENOS_PROC_USR_SHM
+#define BUENOS_PROC_USR_SHM
+
+#include "lib/types.h"
+#include "proc/process.h"
+#include "proc/usr_name.h"
+
+typedef void usr_shm_t;
+
+#define MAX_USR_SHM 16
+
+/* Largest segment in pages.  A segment is mapped in one of the windows that
+   files are mapped in, see `process_mmap`. */
+#define USR_SHM_MAX_PAGES PROCESS_MAPPING_PAGES
+
+typedef enum {
+  USR_SHM_FREE,
+  USR_SHM_CREATING,
+  USR_SHM_USED
+} usr_shm_state_t;
+
+/* A named shared memory segment.  Its pages are allocated when it is created,
+   and mapped by every process that maps the segment. */
+typedef struct {
+  /* Must be first, so an entry found by name is also the block. */
+  usr_name_entry_t name;
+  usr_shm_state_t state;
+  /* Number of mappings of the segment, plus one for its name until it is
+     unlinked.  The segment is destroyed when the last one is dropped. */
+  int refs;
+  uint32_t pages;
+  /* The physical pages.  The segment holds one reference to each, and every
+     address space the page is mapped in another. */
+  uint32_t phys_pages[USR_SHM_MAX_PAGES];
+} usr_shm_block_t;
+
+void usr_shm_init();
+
+usr_shm_t* usr_shm_open(const char* name, int size);
+
+void* usr_shm_map(usr_shm_t* shm);
+
+uint32_t usr_shm_page(usr_shm_t* shm, uint32_t index);
+
+void usr_shm_unref(usr_shm_t* shm);
+
+int usr_shm_unlink(const char* name);
+
+#endif
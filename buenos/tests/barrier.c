@@ -0,0 +1,58 @@
+#include "tests/lib.h"
+
+/* Barrier and event test.  The parent and CHILDREN children go through
+   ROUNDS barrier phases together after the parent fires the start event. */
+
+#define VOLUME "[disk]"
+#define CHILDREN 3
+#define ROUNDS 5
+
+int main() {
+  usr_barrier_t *barrier;
+  usr_event_t *start;
+  int pids[CHILDREN];
+  int i, serial = 0, ret = 0;
+
+  barrier = syscall_barrier_open("phase", CHILDREN + 1);
+  start = syscall_event_open("start", 0);
+  if (barrier == NULL || start == NULL) {
+    puts("Could not create the barrier or the event.\n");
+    return 1;
+  }
+
+  if (syscall_barrier_open("phase", 2) != NULL) {
+    puts("Created a barrier with a name already in use.\n");
+    return 2;
+  }
+
+  for (i = 0; i < CHILDREN; i++) {
+    pids[i] = syscall_exec(VOLUME "barrier_child");
+  }
+
+  puts("[barrier] Releasing the children.\n");
+  syscall_event_signal(start);
+
+  for (i = 0; i < ROUNDS; i++) {
+    serial += syscall_barrier_wait(barrier);
+  }
+
+  /* Every child reports how many times it was the serial thread. */
+  for (i = 0; i < CHILDREN; i++) {
+    serial += syscall_join(pids[i]);
+  }
+
+  if (serial != ROUNDS) {
+    printf("Expected %d serial threads, got %d.\n", ROUNDS, serial);
+    ret = 3;
+  }
+
+  if (!syscall_barrier_destroy(barrier) || !syscall_event_destroy(start)) {
+    puts("Could not destroy the barrier or the event.\n");
+    ret = 4;
+  }
+
+  if (ret == 0) {
+    puts("\nSUCCESS!\n\n");
+  }
+  return ret;
+}
@@ -0,0 +1,26 @@
+#include "tests/lib.h"
+
+/* Child of the barrier test; returns the number of phases in which it was
+   the serial (last arriving) thread. */
+
+#define ROUNDS 5
+
+int main() {
+  usr_barrier_t *barrier;
+  usr_event_t *start;
+  int i, serial = 0;
+
+  barrier = syscall_barrier_open("phase", -1);
+  start = syscall_event_open("start", -1);
+  if (barrier == NULL || start == NULL) {
+    return 100;
+  }
+
+  syscall_event_wait(start);
+
+  for (i = 0; i < ROUNDS; i++) {
+    serial += syscall_barrier_wait(barrier);
+  }
+
+  return serial;
+}
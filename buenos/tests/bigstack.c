@@ -0,0 +1,57 @@
+#include "tests/lib.h"
+
+/* Test that the stack grows well past one page.  Each call keeps a kilobyte
+   of locals alive, and the sums check that no frame was overwritten.  A
+   child whose stack limit is lowered dies when it recurses as deep. */
+
+#define DEPTH 200
+#define WORDS 256
+
+int descend(int depth) {
+  volatile int frame[WORDS];
+  int i, sum = 0;
+
+  for (i = 0; i < WORDS; i++) {
+    frame[i] = depth + i;
+  }
+  if (depth > 0) {
+    sum = descend(depth - 1);
+  }
+  for (i = 0; i < WORDS; i++) {
+    sum += frame[i] - i;
+  }
+  return sum;
+}
+
+int main() {
+  int limit, pid, sum;
+
+  limit = syscall_stacklimit(0);
+  if (limit < 64 || syscall_stacklimit(limit + 1) != 0) {
+    printf("Unexpected stack limit %d.\n", limit);
+    return 2;
+  }
+
+  /* The stack has not grown yet, so the child's starts out small too. */
+  pid = syscall_fork();
+  if (pid == 0) {
+    syscall_stacklimit(4);
+    descend(DEPTH);
+    return 0;
+  }
+  if (pid < 0 || syscall_join(pid) != 255) {
+    puts("A child grew its stack past its limit.\n");
+    return 3;
+  }
+
+  sum = descend(DEPTH);
+
+  /* Every frame adds WORDS times its depth. */
+  if (sum != WORDS * DEPTH * (DEPTH + 1) / 2) {
+    printf("Wrong sum %d.\n", sum);
+    return 1;
+  }
+
+  puts("\nSUCCESS!\n\n");
+  return 0;
+}
@@ -56,7 +56,7 @@ int stack_push(stack_t* stack, void* data) {
 typedef int (*binop)(int,int);
 
 static void out_of_memory() {
-  printf("Out of memory.\n");
+  fprintf(stderr_stream, "Out of memory.\n");
   syscall_exit(1);
 }
 
@@ -85,7 +85,7 @@ static void perform_binop(stack_t* stack, binop op) {
     }
   }
   free(z);
-  printf("Too few elements on stack.\n");
+  fprintf(stderr_stream, "Too few elements on stack.\n");
 }
 
 static int plus(int x, int y) {
@@ -151,7 +151,7 @@ int main() {
         }
       }
     } else {
-      printf("Bad input.\n");
+      fprintf(stderr_stream, "Bad input.\n");
     }
   }
 }
@@ -0,0 +1,132 @@
+#include "tests/lib.h"
+
+/* Test the futex syscalls and the futex-backed user semaphores.  The
+   uncontended P/V loop never enters the kernel; the contended one has several
+   threads sleeping on the same futex at once. */
+
+#define ROUNDS 10000
+#define THREADS 4
+#define CONTENDED_ROUNDS 500
+
+futex_sem_t gate;
+futex_sem_t lock;
+volatile int counter = 0;
+volatile int passed = 0;
+
+/* Wait at the gate, then increment the counter under the lock, staying in the
+   critical section for a while so that the others pile up on the futex. */
+int worker(void* arg) {
+  int i, j, value;
+
+  futex_sem_p(&gate);
+  _atomic_add(&passed, 1);
+  for (i = 0; i < CONTENDED_ROUNDS; i++) {
+    futex_sem_p(&lock);
+    value = counter;
+    for (j = 0; j < 20; j++) {
+      syscall_getpid();
+    }
+    counter = value + 1;
+    futex_sem_v(&lock);
+  }
+  return (int) arg;
+}
+
+/* Run THREADS workers on the same semaphores.  All of them first sleep on the
+   closed gate, and are let through one V at a time.  Returns 0 on success. */
+int contended() {
+  int tids[THREADS];
+  int i;
+
+  futex_sem_init(&gate, 0);
+  futex_sem_init(&lock, 1);
+
+  for (i = 0; i < THREADS; i++) {
+    tids[i] = syscall_thread_create(&worker, (void*) i);
+    if (tids[i] < 0) {
+      printf("Could not create thread %d: %d\n", i, tids[i]);
+      return 5;
+    }
+  }
+
+  /* Open the gate only when everybody is waiting at it. */
+  while (gate.waiters < THREADS) {
+    syscall_getpid();
+  }
+  if (passed != 0) {
+    puts("A thread got through the closed gate.\n");
+    return 6;
+  }
+  for (i = 0; i < THREADS; i++) {
+    futex_sem_v(&gate);
+  }
+
+  for (i = 0; i < THREADS; i++) {
+    if (syscall_thread_join(tids[i]) != i) {
+      printf("Thread %d did not finish properly.\n", i);
+      return 7;
+    }
+  }
+
+  if (passed != THREADS || gate.value != 0 || gate.waiters != 0) {
+    printf("Gate state corrupted: %d passed, value %d, waiters %d\n",
+           passed, gate.value, gate.waiters);
+    return 8;
+  }
+  if (lock.value != 1 || lock.waiters != 0) {
+    printf("Lock state corrupted: value %d, waiters %d\n",
+           lock.value, lock.waiters);
+    return 9;
+  }
+  if (counter != THREADS * CONTENDED_ROUNDS) {
+    printf("Counter is %d, expected %d; an update was lost.\n",
+           counter, THREADS * CONTENDED_ROUNDS);
+    return 10;
+  }
+  printf("%d threads made %d contended P/V pairs.\n", THREADS, counter);
+  return 0;
+}
+
+int main() {
+  futex_sem_t sem;
+  volatile int word = 7;
+  int i, ret;
+
+  futex_sem_init(&sem, 1);
+  for (i = 0; i < ROUNDS; i++) {
+    futex_sem_p(&sem);
+    futex_sem_v(&sem);
+  }
+  if (sem.value != 1 || sem.waiters != 0) {
+    printf("Semaphore state corrupted: value %d, waiters %d\n",
+           sem.value, sem.waiters);
+    return 1;
+  }
+  printf("%d uncontended P/V pairs done.\n", ROUNDS);
+
+  /* Waiting on a stale value must return at once instead of sleeping. */
+  if (syscall_futex_wait(&word, 8) >= 0) {
+    puts("futex_wait slept on a changed value.\n");
+    return 2;
+  }
+
+  /* Nobody is waiting, so nobody can be woken. */
+  if (syscall_futex_wake(&word, 1) != 0) {
+    puts("futex_wake woke a thread that did not exist.\n");
+    return 3;
+  }
+
+  /* Kernel addresses are not futexes. */
+  if (syscall_futex_wait((int*) 0x80000000, 0) >= 0) {
+    puts("futex_wait accepted a kernel address.\n");
+    return 4;
+  }
+
+  ret = contended();
+  if (ret != 0) {
+    return ret;
+  }
+
+  puts("\nSUCCESS!\n\n");
+  return 0;
+}
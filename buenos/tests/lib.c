@@ -69,6 +69,142 @@ int syscall_sem_destroy(usr_sem_t* handle)
                         (uint32_t) handle, 0, 0);
 }
 
+/* Create a barrier named 'name' for 'parties' threads, or open an
+ * existing one if 'parties' is not positive. Returns NULL on error.
+ */
+usr_barrier_t* syscall_barrier_open(const char* name, int parties)
+{
+  return (usr_barrier_t*) _syscall(SYSCALL_BARRIER_OPEN,
+                                   (uint32_t) name, (uint32_t) parties, 0);
+}
+
+int syscall_barrier_wait(usr_barrier_t* barrier)
+{
+  return (int) _syscall(SYSCALL_BARRIER_WAIT,
+                        (uint32_t) barrier, 0, 0);
+}
+
+int syscall_barrier_destroy(usr_barrier_t* barrier)
+{
+  return (int) _syscall(SYSCALL_BARRIER_DESTROY,
+                        (uint32_t) barrier, 0, 0);
+}
+
+/* Create an event named 'name', initially set if 'signalled' is 1, or
+ * open an existing one if 'signalled' is negative. Returns NULL on
+ * error.
+ */
+usr_event_t* syscall_event_open(const char* name, int signalled)
+{
+  return (usr_event_t*) _syscall(SYSCALL_EVENT_OPEN,
+                                 (uint32_t) name, (uint32_t) signalled, 0);
+}
+
+int syscall_event_wait(usr_event_t* event)
+{
+  return (int) _syscall(SYSCALL_EVENT_WAIT,
+                        (uint32_t) event, 0, 0);
+}
+
+int syscall_event_signal(usr_event_t* event)
+{
+  return (int) _syscall(SYSCALL_EVENT_SIGNAL,
+                        (uint32_t) event, 0, 0);
+}
+
+int syscall_event_destroy(usr_event_t* event)
+{
+  return (int) _syscall(SYSCALL_EVENT_DESTROY,
+                        (uint32_t) event, 0, 0);
+}
+
+/* Create a zero-filled shared memory segment of 'size' bytes named
+ * 'name', or open an existing one if 'size' is negative. Returns NULL
+ * on error.
+ */
+usr_shm_t* syscall_shm_open(const char* name, int size)
+{
+  return (usr_shm_t*) _syscall(SYSCALL_SHM_OPEN,
+                               (uint32_t) name, (uint32_t) size, 0);
+}
+
+/* Map a shared memory segment into memory. Returns its address, or
+ * NULL on error. The segment is unmapped with syscall_munmap.
+ */
+void* syscall_shm_map(usr_shm_t* shm)
+{
+  return (void*) _syscall(SYSCALL_SHM_MAP, (uint32_t) shm, 0, 0);
+}
+
+/* Remove the name of a shared memory segment. The segment is
+ * destroyed when no process has it mapped any more. Returns 1, or 0
+ * if there is no segment of that name.
+ */
+int syscall_shm_unlink(const char* name)
+{
+  return (int) _syscall(SYSCALL_SHM_UNLINK, (uint32_t) name, 0, 0);
+}
+
+/* Sleep until woken by syscall_futex_wake, but only if *addr still
+ * equals 'value'. Returns 0 when woken, or a negative value if the
+ * value had already changed or addr is invalid.
+ */
+int syscall_futex_wait(volatile int *addr, int value)
+{
+  return (int) _syscall(SYSCALL_FUTEX_WAIT,
+                        (uint32_t) addr, (uint32_t) value, 0);
+}
+
+/* Wake at most 'count' threads sleeping on the futex at 'addr'.
+ * Returns the number of threads woken.
+ */
+int syscall_futex_wake(volatile int *addr, int count)
+{
+  return (int) _syscall(SYSCALL_FUTEX_WAKE,
+                        (uint32_t) addr, (uint32_t) count, 0);
+}
+
+void futex_sem_init(futex_sem_t *sem, int value)
+{
+  sem->value = value;
+  sem->waiters = 0;
+}
+
+void futex_sem_p(futex_sem_t *sem)
+{
+  int value;
+
+  /* Fast path: take a unit without entering the kernel. */
+  value = sem->value;
+  if (value > 0 && _atomic_cas(&sem->value, value, value - 1)) {
+    return;
+  }
+
+  /* Slow path: announce ourselves so futex_sem_v knows to wake us, and
+     sleep until a unit shows up.  The kernel rechecks the value before
+     sleeping, so a V between our check and the wait is never lost. */
+  _atomic_add(&sem->waiters, 1);
+  while (1) {
+    value = sem->value;
+    if (value > 0) {
+      if (_atomic_cas(&sem->value, value, value - 1)) {
+        break;
+      }
+    } else {
+      syscall_futex_wait(&sem->value, value);
+    }
+  }
+  _atomic_add(&sem->waiters, -1);
+}
+
+void futex_sem_v(futex_sem_t *sem)
+{
+  _atomic_add(&sem->value, 1);
+  if (sem->waiters > 0) {
+    syscall_futex_wake(&sem->value, 1);
+  }
+}
+
 /* Halt the system (sync disks and power off). This function will
  * never return.
  */
@@ -105,6 +241,9 @@ int syscall_execp(const char *filename, int argc, const char **argv)
  */
 void syscall_exit(int retval)
 {
+#ifdef PROVIDE_BASIC_IO
+  fflush(NULL);
+#endif
   _syscall(SYSCALL_EXIT, (uint32_t)retval, 0, 0);
 }
 
@@ -129,6 +268,10 @@ int syscall_join(int pid)
 */
 int syscall_fork()
 {
+#ifdef PROVIDE_BASIC_IO
+  /* Otherwise the child would write out the same buffered output. */
+  fflush(NULL);
+#endif
   return (int) _syscall(SYSCALL_FORK, 0, 0, 0);
 }
 
@@ -138,6 +281,43 @@ int syscall_getpid()
   return (int) _syscall(SYSCALL_GETPID, 0, 0, 0);
 }
 
+/* New threads start here, and exit with the return value of `func`. */
+static void thread_trampoline(int (*func)(void*), void* arg)
+{
+  syscall_thread_exit(func(arg));
+}
+
+/* Start a new thread in the calling process, running `func(arg)`.  The thread
+   shares all memory with the rest of the process, but has its own small stack.
+   Returns the thread id, or a negative value on error. */
+int syscall_thread_create(int (*func)(void*), void* arg)
+{
+  return (int) _syscall(SYSCALL_THREAD_CREATE, (uint32_t) &thread_trampoline,
+                        (uint32_t) func, (uint32_t) arg);
+}
+
+/* Stop the calling thread.  The process exits when its last thread does. */
+void syscall_thread_exit(int retval)
+{
+  _syscall(SYSCALL_THREAD_EXIT, (uint32_t) retval, 0, 0);
+}
+
+/* Wait for a thread of the calling process to exit and return its return
+   value.  Each thread can be joined once. */
+int syscall_thread_join(int thread)
+{
+  return (int) _syscall(SYSCALL_THREAD_JOIN, (uint32_t) thread, 0, 0);
+}
+
+/* Store the resources used by the calling process in `usage` if `who` is
+   RUSAGE_SELF, or by the children it has joined if it is RUSAGE_CHILDREN.
+   Returns 0, or a negative value on error. */
+int syscall_getrusage(int who, rusage_t *usage)
+{
+  return (int) _syscall(SYSCALL_GETRUSAGE, (uint32_t) who,
+                        (uint32_t) usage, 0);
+}
+
 /* (De)allocate memory by trying to set the heap to end at the address
  * 'heap_end'. Returns the new end address of the heap, or NULL on
  * error. If 'heap_end' is NULL, the current heap end is returned.
@@ -147,6 +327,15 @@ void *syscall_memlimit(void *heap_end)
   return (void*)_syscall(SYSCALL_MEMLIMIT, (uint32_t)heap_end, 0, 0);
 }
 
+/* Set the number of pages the stack of each thread may grow to. Returns
+ * the new limit, or 0 if 'pages' is larger than the room reserved for a
+ * stack. If 'pages' is 0, the current limit is returned.
+ */
+int syscall_stacklimit(int pages)
+{
+  return (int)_syscall(SYSCALL_STACKLIMIT, (uint32_t)pages, 0, 0);
+}
+
 
 /* Open the file identified by 'filename' for reading and
  * writing. Returns the file handle of the opened file (positive
@@ -200,6 +389,29 @@ int syscall_write(int filehandle, const void *buffer, int length)
 }
 
 
+/* Map 'length' bytes of the open file identified by 'filehandle',
+ * starting at 'offset', into memory. 'offset' must be a multiple of
+ * the page size. Pages are read from the file when first touched, and
+ * the ones written to are written back when the file is unmapped or
+ * closed, or the process exits. Returns the address of the mapping, or
+ * NULL on error.
+ */
+void *syscall_mmap(int filehandle, int offset, int length)
+{
+  return (void*)_syscall(SYSCALL_MMAP, (uint32_t)filehandle,
+                         (uint32_t)offset, (uint32_t)length);
+}
+
+
+/* Unmap the file mapped at 'addr', writing back the pages written
+ * to. Returns 0 on success or a negative value on error.
+ */
+int syscall_munmap(void *addr)
+{
+  return (int)_syscall(SYSCALL_MUNMAP, (uint32_t)addr, 0, 0);
+}
+
+
 /* Create a file with the name 'filename' and initial size of
  * 'size'. Returns 0 on success and a negative value on error.
  */
@@ -322,15 +534,89 @@ char *strstr(const char *s1, const char *s2)
 
 void *memset(void *s, int c, size_t n) {
   byte *p = s;
+  uint32_t *w;
+  uint32_t word;
+
+  /* Fill whole words, eight at a time, once p is aligned. */
+  if (n >= 16) {
+    while ((uint32_t) p & 3) {
+      *(p++) = c;
+      n--;
+    }
+    word = (byte) c;
+    word |= word << 8;
+    word |= word << 16;
+    for (w = (uint32_t *) p; n >= 32; n -= 32, w += 8) {
+      w[0] = word; w[1] = word; w[2] = word; w[3] = word;
+      w[4] = word; w[5] = word; w[6] = word; w[7] = word;
+    }
+    for (; n >= 4; n -= 4) {
+      *(w++) = word;
+    }
+    p = (byte *) w;
+  }
   while (n-- > 0) {
     *(p++) = c;
   }
   return s;
 }
 
+/* The bytes of word a followed by those of word b, from shift bits into a.
+   Lower addresses are the more significant bytes on big-endian MIPS. */
+#if __BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__
+#define MERGE_WORDS(a, b, shift) (((a) >> (shift)) | ((b) << (32 - (shift))))
+#else
+#define MERGE_WORDS(a, b, shift) (((a) << (shift)) | ((b) >> (32 - (shift))))
+#endif
+
 void *memcpy(void *dest, const void *src, size_t n) {
   byte *d = dest;
   const byte *s = src;
+  uint32_t *dw;
+  const uint32_t *sw;
+  uint32_t prev, next;
+  int shift;
+
+  /* Copy whole words once d is aligned.  If s is not, each word is merged
+     from two aligned source words instead of making unaligned loads. */
+  if (n >= 16) {
+    while ((uint32_t) d & 3) {
+      *(d++) = *(s++);
+      n--;
+    }
+    dw = (uint32_t *) d;
+    shift = ((uint32_t) s & 3) * 8;
+    if (shift == 0) {
+      for (sw = (const uint32_t *) s; n >= 32; n -= 32, dw += 8, sw += 8) {
+        dw[0] = sw[0]; dw[1] = sw[1]; dw[2] = sw[2]; dw[3] = sw[3];
+        dw[4] = sw[4]; dw[5] = sw[5]; dw[6] = sw[6]; dw[7] = sw[7];
+      }
+      for (; n >= 4; n -= 4) {
+        *(dw++) = *(sw++);
+      }
+      s = (const byte *) sw;
+    } else {
+      sw = (const uint32_t *) (s - shift / 8);
+      s += n & ~3;
+      prev = *(sw++);
+      for (; n >= 16; n -= 16, dw += 4, sw += 4) {
+        next = sw[0];
+        dw[0] = MERGE_WORDS(prev, next, shift);
+        prev = sw[1];
+        dw[1] = MERGE_WORDS(next, prev, shift);
+        next = sw[2];
+        dw[2] = MERGE_WORDS(prev, next, shift);
+        prev = sw[3];
+        dw[3] = MERGE_WORDS(next, prev, shift);
+      }
+      for (; n >= 4; n -= 4) {
+        next = *(sw++);
+        *(dw++) = MERGE_WORDS(prev, next, shift);
+        prev = next;
+      }
+    }
+    d = (byte *) dw;
+  }
   while (n-- > 0) {
     *(d++) = *(s++);
   }
@@ -341,37 +627,260 @@ void *memcpy(void *dest, const void *src, size_t n) {
 
 #ifdef PROVIDE_BASIC_IO
 
+/* What a stream is open for, and when its output is written. */
+#define STREAM_READ       0x01
+#define STREAM_WRITE      0x02
+#define STREAM_LINE       0x04
+#define STREAM_UNBUFFERED 0x08
+
+static FILE streams[STREAM_MAX] = {
+  { stdin, STREAM_READ, 0, 0, {0} },
+  { stdout, STREAM_WRITE | STREAM_LINE, 0, 0, {0} },
+  { stderr, STREAM_WRITE | STREAM_UNBUFFERED, 0, 0, {0} },
+  { -1, 0, 0, 0, {0} }, { -1, 0, 0, 0, {0} }, { -1, 0, 0, 0, {0} },
+  { -1, 0, 0, 0, {0} }, { -1, 0, 0, 0, {0} }
+};
+
+FILE *stdin_stream = &streams[0];
+FILE *stdout_stream = &streams[1];
+FILE *stderr_stream = &streams[2];
+
+/* Open the existing file filename as a stream, for reading if mode is "r"
+   and for writing from its start if mode is "w".  Returns NULL on
+   error. */
+FILE *fopen(const char *filename, const char *mode)
+{
+  int i, handle, flags;
+
+  if (strcmp(mode, "r") == 0) {
+    flags = STREAM_READ;
+  } else if (strcmp(mode, "w") == 0) {
+    flags = STREAM_WRITE;
+  } else {
+    return NULL;
+  }
+
+  for (i = 0; i < STREAM_MAX; i++) {
+    if (streams[i].handle == -1) {
+      handle = syscall_open(filename);
+      if (handle < 0) {
+        return NULL;
+      }
+      streams[i].handle = handle;
+      streams[i].flags = flags;
+      streams[i].count = 0;
+      streams[i].pos = 0;
+      return &streams[i];
+    }
+  }
+  return NULL;
+}
+
+/* Write out any buffered output of stream, or of all streams if stream
+   is NULL.  Buffered input is kept.  Returns 0 on success and EOF on
+   error, in which case the buffered output is lost. */
+int fflush(FILE *stream)
+{
+  int i, ret, written = 0, result = 0;
+
+  if (stream == NULL) {
+    for (i = 0; i < STREAM_MAX; i++) {
+      if (streams[i].handle != -1 && fflush(&streams[i]) != 0) {
+        result = EOF;
+      }
+    }
+    return result;
+  }
+
+  if (!(stream->flags & STREAM_WRITE)) {
+    return 0;
+  }
+  while (written < stream->count) {
+    ret = syscall_write(stream->handle, stream->buf + written,
+                        stream->count - written);
+    if (ret <= 0) {
+      result = EOF;
+      break;
+    }
+    written += ret;
+  }
+  stream->count = 0;
+  return result;
+}
+
+/* Flush and close stream.  Returns 0 on success and EOF on error. */
+int fclose(FILE *stream)
+{
+  int result = fflush(stream);
+
+  if (syscall_close(stream->handle) < 0) {
+    result = EOF;
+  }
+  stream->handle = -1;
+  return result;
+}
+
+/* Write size*nmemb bytes from ptr to stream.  Writes as large as the
+   buffer go straight to the file.  Returns the number of whole items
+   written. */
+size_t fwrite(const void *ptr, size_t size, size_t nmemb, FILE *stream)
+{
+  const char *p = ptr;
+  size_t len = size * nmemb, done = 0, n;
+  int ret, newline = 0;
+
+  if (!(stream->flags & STREAM_WRITE) || len == 0) {
+    return 0;
+  }
+
+  if (stream->count + len > STREAM_BUFFER_SIZE) {
+    if (fflush(stream) != 0) {
+      return 0;
+    }
+    while (len - done >= STREAM_BUFFER_SIZE) {
+      ret = syscall_write(stream->handle, p + done, len - done);
+      if (ret <= 0) {
+        return done / size;
+      }
+      done += ret;
+    }
+  }
+
+  n = len - done;
+  memcpy(stream->buf + stream->count, p + done, n);
+  stream->count += n;
+  if (stream->flags & STREAM_LINE) {
+    while (n-- > 0 && !newline) {
+      newline = (p[done + n] == '\n');
+    }
+  }
+  if ((stream->flags & STREAM_UNBUFFERED) || newline) {
+    if (fflush(stream) != 0) {
+      return done / size;
+    }
+  }
+  return nmemb;
+}
+
+/* Write c to stream.  Returns c as an unsigned char, or EOF on error. */
+int fputc(int c, FILE *stream)
+{
+  if (!(stream->flags & STREAM_WRITE)) {
+    return EOF;
+  }
+  if (stream->count == STREAM_BUFFER_SIZE && fflush(stream) != 0) {
+    return EOF;
+  }
+  stream->buf[stream->count++] = c;
+  if ((stream->flags & STREAM_UNBUFFERED) ||
+      ((stream->flags & STREAM_LINE) && c == '\n')) {
+    if (fflush(stream) != 0) {
+      return EOF;
+    }
+  }
+  return (byte) c;
+}
+
+/* Write the string s to stream.  Returns the number of characters
+   written, or EOF on error. */
+int fputs(const char *s, FILE *stream)
+{
+  size_t len = strlen(s);
+
+  if (fwrite(s, 1, len, stream) != len) {
+    return EOF;
+  }
+  return len;
+}
+
+/* Fill the buffer of a stream open for reading with what one read
+   returns.  Returns the number of bytes read, 0 or less at end of file or
+   on error. */
+static int stream_fill(FILE *stream)
+{
+  int ret;
+
+  if (stream == stdin_stream) {
+    /* Show any prompt before waiting for input. */
+    fflush(stdout_stream);
+  }
+  ret = syscall_read(stream->handle, stream->buf, STREAM_BUFFER_SIZE);
+  stream->count = ret > 0 ? ret : 0;
+  stream->pos = 0;
+  return ret;
+}
+
+/* Read a character from stream.  Returns it as an unsigned char, or EOF
+   at end of file or on error. */
+int fgetc(FILE *stream)
+{
+  if (!(stream->flags & STREAM_READ)) {
+    return EOF;
+  }
+  if (stream->pos == stream->count && stream_fill(stream) <= 0) {
+    return EOF;
+  }
+  return (byte) stream->buf[stream->pos++];
+}
+
+/* Read size*nmemb bytes from stream into ptr, stopping early at end of
+   file.  Reads as large as the buffer go straight from the file.  Returns
+   the number of whole items read. */
+size_t fread(void *ptr, size_t size, size_t nmemb, FILE *stream)
+{
+  char *p = ptr;
+  size_t len = size * nmemb, done = 0, n;
+  int ret;
+
+  if (!(stream->flags & STREAM_READ)) {
+    return 0;
+  }
+
+  while (done < len) {
+    if (stream->pos == stream->count) {
+      if (len - done >= STREAM_BUFFER_SIZE) {
+        if (stream == stdin_stream) {
+          fflush(stdout_stream);
+        }
+        ret = syscall_read(stream->handle, p + done, len - done);
+      } else {
+        ret = stream_fill(stream);
+      }
+      if (ret <= 0) {
+        break;
+      }
+      if (stream->pos == stream->count) {
+        done += ret;
+        continue;
+      }
+    }
+    n = MIN(len - done, (size_t) (stream->count - stream->pos));
+    memcpy(p + done, stream->buf + stream->pos, n);
+    stream->pos += n;
+    done += n;
+  }
+  return size ? done / size : 0;
+}
+
 /* Write c to standard output.  Returns a positive integer on
    success. */
 int putc(char c)
 {
-  return syscall_write(stdout, &c, 1);
+  return fputc(c, stdout_stream);
 }
 
 /* Write the string pointed to by s to standard output.  Returns a
    non-negative integer on success. */
 int puts(const char* s)
 {
-  int len = strlen(s);
-  int written = 0;
-  int ret;
-
-  do {
-    ret = syscall_write(stdout, s, len);
-    written += ret;
-    s += ret;
-  } while (written < len && ret > 0);
-
-  return written;
+  return fputs(s, stdout_stream);
 }
 
 /* Read character from standard input, without echoing.  Returns a
    non-negative integer on success, which can be casted to char. */
 int getc_raw(void)
 {
-  char c;
-  syscall_read(stdin, &c, 1);
-  return c;
+  return (char) fgetc(stdin_stream);
 }
 
 /* Read character from standard input, with echoing.  Returns a
@@ -379,7 +888,7 @@ int getc_raw(void)
 int getc(void)
 {
   char c = getc_raw();
-  syscall_write(stdout, &c, 1); /* Echo back at user. */
+  putc(c); /* Echo back at user. */
   return c;
 }
 
@@ -442,11 +951,15 @@ ssize_t readline(char *s, size_t size)
 #define FLAG_SIGN    0x20
 
 
-/* Output the given char either to the string or to the TTY. */
+/* The stream printf and fprintf output to. */
+static FILE *print_stream;
+
+/* Output the given char either to the string or to the TTY, which is
+   print_stream. */
 static void printc(char *buf, char c, int flags) {
   if (flags & FLAG_TTY) {
     /* do not output (terminating) zeros to TTY */
-    if (c != '\0') putc(c);
+    if (c != '\0') fputc(c, print_stream);
   } else
     *buf = c;
 }
@@ -694,12 +1207,39 @@ static int vxnprintf(char *buf,
   return written;
 }
 
+/* Format to stream.  Output to an unbuffered stream is written at the
+   end, rather than a character at a time. */
+static int vfprintc(FILE *stream, const char *fmt, va_list ap) {
+  int saved = stream->flags;
+  int written;
+
+  stream->flags &= ~STREAM_UNBUFFERED;
+  print_stream = stream;
+  written = vxnprintf((char*)0, 0x7fffffff, fmt, ap, FLAG_TTY);
+  stream->flags = saved;
+  if (saved & STREAM_UNBUFFERED) {
+    fflush(stream);
+  }
+  return written;
+}
+
 int printf(const char *fmt, ...) {
   va_list ap;
   int written;
 
   va_start(ap, fmt);
-  written = vxnprintf((char*)0, 0x7fffffff, fmt, ap, FLAG_TTY);
+  written = vfprintc(stdout_stream, fmt, ap);
+  va_end(ap);
+
+  return written;
+}
+
+int fprintf(FILE *stream, const char *fmt, ...) {
+  va_list ap;
+  int written;
+
+  va_start(ap, fmt);
+  written = vfprintc(stream, fmt, ap);
   va_end(ap);
 
   return written;
@@ -720,133 +1260,276 @@ int snprintf(char *str, int size, const  char  *fmt, ...) {
 /* Heap allocation. */
 #ifdef PROVIDE_HEAP_ALLOCATOR
 
-typedef struct free_block {
-  size_t size;
-  struct free_block *next;
-} free_block_t;
-
-static const size_t MIN_ALLOC_SIZE = sizeof(free_block_t);
+/* The heap is a sequence of chunks, each starting with a header word that
+   holds its size and two flags.  Free chunks are kept in bins by size, and
+   also end with their size, so that a chunk being freed can find a free
+   chunk just before it and merge with it.  Two free chunks are never
+   adjacent.  The space at the end of the heap, the top chunk, is in no bin:
+   it is carved up when the bins have nothing suitable, and grows and
+   shrinks with syscall_memlimit. */
+
+typedef struct chunk {
+  size_t head;
+  /* Links in the bin, only in free chunks. */
+  struct chunk *next;
+  struct chunk *prev;
+} chunk_t;
+
+#define CHUNK_INUSE      1
+#define CHUNK_PREV_INUSE 2
+#define CHUNK_ALIGN      8
+#define CHUNK_OVERHEAD   sizeof(size_t)
+#define CHUNK_MIN        16
+#define CHUNK_SIZE(c)    ((c)->head & ~(CHUNK_ALIGN - 1))
+#define CHUNK_AT(c, off) ((chunk_t *) ((byte *) (c) + (off)))
+
+/* Chunks of up to SMALL_MAX bytes have a bin for each size, so that small
+   requests are an exact fit taken off a list.  Larger chunks have a bin
+   for each power of two, searched first fit. */
+#define SMALL_MAX  256
+#define SMALL_BINS (SMALL_MAX / CHUNK_ALIGN + 1)
+#define BINS       (SMALL_BINS + 24)
+
+/* The heap grows by at least this much at a time.  Pages are only mapped
+   when first touched, so this costs nothing until used.  When freeing
+   leaves more than HEAP_TRIM unused at the end, it is given back. */
+#define HEAP_GROWTH (16 * 4096)
+#define HEAP_TRIM   (4 * HEAP_GROWTH)
+
+/* Largest request served, so that sizes cannot overflow. */
+#define HEAP_MAX_REQUEST 0x7ffff000
+
+static chunk_t *bins[BINS];
+static chunk_t *heap_top = NULL;
+static size_t heap_top_size;
+static byte *heap_end;
 
 void* get_heap_end() {
   return syscall_memlimit(NULL);
 }
 
-free_block_t *free_list = NULL;
+/* Set up the heap so that chunks give 8-byte aligned blocks.  Called by
+   malloc as needed, may also be called directly. */
+void heap_init()
+{
+  byte *start;
+  size_t adjust;
+
+  if (heap_top != NULL) {
+    return;
+  }
+  start = get_heap_end();
+  adjust = (4 - (size_t) start) & (CHUNK_ALIGN - 1);
+  if (adjust != 0 && syscall_memlimit(start + adjust) == NULL) {
+    return;
+  }
+  heap_top = (chunk_t *) (start + adjust);
+  heap_top_size = 0;
+  heap_end = start + adjust;
+}
+
+static int bin_index(size_t size)
+{
+  int i = SMALL_BINS;
+  size_t limit;
+
+  if (size <= SMALL_MAX) {
+    return size / CHUNK_ALIGN;
+  }
+  for (limit = 2 * SMALL_MAX; size >= limit && i < BINS - 1; limit <<= 1) {
+    i++;
+  }
+  return i;
+}
+
+static void bin_insert(chunk_t *c, size_t size)
+{
+  int i = bin_index(size);
+  c->prev = NULL;
+  c->next = bins[i];
+  if (bins[i] != NULL) {
+    bins[i]->prev = c;
+  }
+  bins[i] = c;
+}
+
+static void bin_remove(chunk_t *c, size_t size)
+{
+  if (c->prev != NULL) {
+    c->prev->next = c->next;
+  } else {
+    bins[bin_index(size)] = c->next;
+  }
+  if (c->next != NULL) {
+    c->next->prev = c->prev;
+  }
+}
+
+/* Make c a free chunk of size bytes and put it in its bin.  The chunks
+   around it must be in use. */
+static void chunk_free(chunk_t *c, size_t size)
+{
+  c->head = size | CHUNK_PREV_INUSE;
+  *(size_t *) ((byte *) c + size - sizeof(size_t)) = size;
+  CHUNK_AT(c, size)->head &= ~CHUNK_PREV_INUSE;
+  bin_insert(c, size);
+}
+
+/* Mark c, which has size bytes and is in no bin, in use with size n, and
+   free what is left over if that is big enough to be a chunk. */
+static void chunk_use(chunk_t *c, size_t size, size_t n)
+{
+  size_t prev_inuse = c->head & CHUNK_PREV_INUSE;
+
+  if (size - n >= CHUNK_MIN) {
+    c->head = n | CHUNK_INUSE | prev_inuse;
+    chunk_free(CHUNK_AT(c, n), size - n);
+  } else {
+    c->head = size | CHUNK_INUSE | prev_inuse;
+    CHUNK_AT(c, size)->head |= CHUNK_PREV_INUSE;
+  }
+}
+
+/* Make the top chunk at least n bytes, growing the heap by a multiple of
+   HEAP_GROWTH if possible and by just enough otherwise.  Returns 0 if the
+   heap cannot grow. */
+static int heap_grow(size_t n)
+{
+  size_t need, grow;
+
+  if (heap_top_size >= n) {
+    return 1;
+  }
+  need = n - heap_top_size;
+  grow = (need + HEAP_GROWTH - 1) & ~(HEAP_GROWTH - 1);
+  if (syscall_memlimit(heap_end + grow) == NULL) {
+    grow = need;
+    if (syscall_memlimit(heap_end + grow) == NULL) {
+      return 0;
+    }
+  }
+  heap_end += grow;
+  heap_top_size += grow;
+  return 1;
+}
+
+/* Give back the end of the top chunk if it has grown large. */
+static void heap_trim(void)
+{
+  byte *end = (byte *) heap_top + HEAP_GROWTH;
+
+  if (heap_top_size > HEAP_TRIM && syscall_memlimit(end) != NULL) {
+    heap_end = end;
+    heap_top_size = HEAP_GROWTH;
+  }
+}
+
+/* The chunk size needed for a request of size bytes. */
+static size_t chunk_size(size_t size)
+{
+  size = (size + CHUNK_OVERHEAD + CHUNK_ALIGN - 1) & ~(CHUNK_ALIGN - 1);
+  return MAX(size, CHUNK_MIN);
+}
 
 /* Return a block of at least size bytes, or NULL if no such block
    can be found.  */
 void *malloc(size_t size)
 {
-  free_block_t *block;
-  free_block_t **prev_p; /* Previous link so we can remove an element */
-  if (size == 0) {
+  chunk_t *c;
+  size_t n;
+  int i;
+
+  if (size == 0 || size > HEAP_MAX_REQUEST) {
     return NULL;
   }
-
-  /* Ensure block is big enough for bookkeeping. */
-  size=MAX(MIN_ALLOC_SIZE,size);
-  /* Word-align */
-  if (size % 4 != 0) {
-    size &= ~3;
-    size += 4;
-  }
-
-  /* Iterate through list of free blocks, using the first that is
-     big enough for the request. */
-  for (block = free_list, prev_p = &free_list;
-       block;
-       prev_p = &(block->next), block = block->next) {
-    if ( (int)( block->size - size - sizeof(size_t) ) >=
-         (int)( MIN_ALLOC_SIZE+sizeof(size_t) ) ) {
-      /* Block is too big, but can be split. */
-      block->size -= size+sizeof(size_t);
-      free_block_t *new_block =
-        (free_block_t*)(((byte*)block)+block->size);
-      new_block->size = size+sizeof(size_t);
-      return ((byte*)new_block)+sizeof(size_t);
-    } else if (block->size >= size + sizeof(size_t)) {
-      /* Block is big enough, but not so big that we can split
-         it, so just return it */
-      *prev_p = block->next;
-      return ((byte*)block)+sizeof(size_t);
+  heap_init();
+  if (heap_top == NULL) {
+    return NULL;
+  }
+  n = chunk_size(size);
+
+  /* An exact fit for a small request, or else the first chunk that is big
+     enough, from this bin or a bigger one.  Only large bins can hold chunks
+     too small for the request. */
+  for (i = bin_index(n); i < BINS; i++) {
+    for (c = bins[i]; c != NULL; c = c->next) {
+      if (CHUNK_SIZE(c) >= n) {
+        bin_remove(c, CHUNK_SIZE(c));
+        chunk_use(c, CHUNK_SIZE(c), n);
+        return (byte *) c + CHUNK_OVERHEAD;
+      }
     }
-    /* Else, check the next block. */
   }
 
-  /* No heap space left.  Attempt to increase the heap space. */
-  byte* heap_end = (byte*) get_heap_end();
-  size_t full_size = sizeof(size_t) + size;
-  byte* heap_end_new = (byte*) syscall_memlimit(heap_end + full_size);
-  if (heap_end_new == NULL) {
-    /* Cannot allocate. */
+  /* Carve it from the top chunk.  The chunk before the top is never free,
+     since freed chunks merge into the top. */
+  if (!heap_grow(n)) {
     return NULL;
   }
-  /* The address to return is the previous heap end + the space to store
-     metadata. */
-  block = (free_block_t*) heap_end;
-  block->size = full_size;
-  return heap_end + sizeof(size_t);
+  c = heap_top;
+  c->head = n | CHUNK_INUSE | CHUNK_PREV_INUSE;
+  heap_top = CHUNK_AT(c, n);
+  heap_top_size -= n;
+  return (byte *) c + CHUNK_OVERHEAD;
 }
 
 /* Return the block pointed to by ptr to the free pool. */
 void free(void *ptr)
 {
-  if (ptr != NULL) { /* Freeing NULL is a no-op */
-    free_block_t *block = (free_block_t*)((byte*)ptr-sizeof(size_t));
-    free_block_t *cur_block;
-    free_block_t *prev_block;
-
-    /* Iterate through the free list, which is sorted by
-       increasing address, and insert the newly freed block at the
-       proper position. */
-    for (cur_block = free_list, prev_block = NULL;
-         ;
-         prev_block = cur_block, cur_block = cur_block->next) {
-      if (cur_block > block || cur_block == NULL) {
-        /* Insert block here. */
-        if (prev_block == NULL) {
-          free_list = block;
-        } else {
-          prev_block->next = block;
-        }
-        block->next = cur_block;
-
-        if (prev_block != NULL &&
-            (size_t)((byte*)block - (byte*)prev_block) == prev_block->size) {
-          /* Merge with previous. */
-          prev_block->size += block->size;
-          prev_block->next = cur_block;
-          block = prev_block;
-        }
+  chunk_t *c, *next;
+  size_t size, prev_size;
 
-        if (cur_block != NULL &&
-            (size_t)((byte*)cur_block - (byte*)block) == block->size) {
-          /* Merge with next. */
-          block->size += cur_block->size;
-          block->next = cur_block->next;
-        }
-        return;
-      }
-    }
+  if (ptr == NULL) { /* Freeing NULL is a no-op */
+    return;
+  }
+
+  c = (chunk_t *) ((byte *) ptr - CHUNK_OVERHEAD);
+  size = CHUNK_SIZE(c);
+  next = CHUNK_AT(c, size);
+
+  if (!(c->head & CHUNK_PREV_INUSE)) {
+    /* Merge with the free chunk before, whose size ends it. */
+    prev_size = *(size_t *) ((byte *) c - sizeof(size_t));
+    c = (chunk_t *) ((byte *) c - prev_size);
+    bin_remove(c, prev_size);
+    size += prev_size;
+  }
+
+  if (next == heap_top) {
+    heap_top = c;
+    heap_top_size += size;
+    heap_trim();
+    return;
   }
+
+  if (!(next->head & CHUNK_INUSE)) {
+    /* Merge with the free chunk after. */
+    bin_remove(next, CHUNK_SIZE(next));
+    size += CHUNK_SIZE(next);
+  }
+  chunk_free(c, size);
 }
 
 void *calloc(size_t nmemb, size_t size)
 {
-  size_t i;
-  byte *ptr = malloc(nmemb*size);
+  byte *ptr;
+
+  if (size != 0 && nmemb > HEAP_MAX_REQUEST / size) {
+    return NULL;
+  }
+  ptr = malloc(nmemb*size);
   if (ptr != NULL) {
-    for (i = 0; i < nmemb*size; i++) {
-      ptr[i] = 0;
-    }
+    memset(ptr, 0, nmemb*size);
   }
   return ptr;
 }
 
 void *realloc(void *ptr, size_t size)
 {
+  chunk_t *c, *next;
   byte *new_ptr;
-  size_t i;
+  size_t n, old;
+
   if (ptr == NULL) {
     return malloc(size);
   }
@@ -856,14 +1539,41 @@ void *realloc(void *ptr, size_t size)
     return NULL;
   }
 
-  /* Simple implementation: allocate new space and copy the contents
-     over.  Exercise: Improve this by searching through the free
-     list and seeing whether an actual enlargement is possible. */
+  if (size > HEAP_MAX_REQUEST) {
+    return NULL;
+  }
+  n = chunk_size(size);
+  c = (chunk_t *) ((byte *) ptr - CHUNK_OVERHEAD);
+  old = CHUNK_SIZE(c);
+  next = CHUNK_AT(c, old);
+
+  if (n <= old) {
+    /* Shrink in place; a big enough tail is freed like any block. */
+    if (old - n >= CHUNK_MIN) {
+      c->head = n | (c->head & (CHUNK_INUSE | CHUNK_PREV_INUSE));
+      CHUNK_AT(c, n)->head = (old - n) | CHUNK_INUSE | CHUNK_PREV_INUSE;
+      free((byte *) CHUNK_AT(c, n) + CHUNK_OVERHEAD);
+    }
+    return ptr;
+  }
+
+  /* Grow in place into the top chunk, or into a free chunk after. */
+  if (next == heap_top && heap_grow(n - old)) {
+    c->head = n | (c->head & (CHUNK_INUSE | CHUNK_PREV_INUSE));
+    heap_top = CHUNK_AT(c, n);
+    heap_top_size -= n - old;
+    return ptr;
+  }
+  if (next != heap_top && !(next->head & CHUNK_INUSE) &&
+      old + CHUNK_SIZE(next) >= n) {
+    bin_remove(next, CHUNK_SIZE(next));
+    chunk_use(c, old + CHUNK_SIZE(next), n);
+    return ptr;
+  }
+
   new_ptr = malloc(size);
   if (new_ptr != NULL) {
-    for (i = 0; i < size; i++) {
-      new_ptr[i] = ((byte*)ptr)[i];
-    }
+    memcpy(new_ptr, ptr, old - CHUNK_OVERHEAD);
     free(ptr);
   }
   return new_ptr;
@@ -49,6 +49,29 @@
 /* User semaphore */
 typedef void usr_sem_t;
 
+/* User barrier and event */
+typedef void usr_barrier_t;
+typedef void usr_event_t;
+
+/* Shared memory segment */
+typedef void usr_shm_t;
+
+/* Resources used by a process, see syscall_getrusage.  Must match
+   process_rusage_t in proc/process.h. */
+typedef struct {
+  uint32_t cpu_ticks;      /* CPU cycles run */
+  uint32_t tlb_refills;
+  uint32_t page_faults;
+  uint32_t pages_resident; /* pages mapped now, or most of any child */
+  uint32_t syscalls;
+  uint32_t bytes_read;     /* through syscall_read */
+  uint32_t bytes_written;  /* through syscall_write */
+} rusage_t;
+
+/* Whose resources syscall_getrusage reports */
+#define RUSAGE_SELF 0
+#define RUSAGE_CHILDREN 1
+
 /* POSIX-like integer types */
 typedef uint8_t byte;
 typedef int32_t ssize_t;
@@ -64,6 +87,42 @@ int syscall_sem_p(usr_sem_t* handle);
 int syscall_sem_v(usr_sem_t* handle);
 int syscall_sem_destroy(usr_sem_t* destroy);
 
+/* User barrier functions.  syscall_barrier_wait returns 1 in exactly one of
+   the released threads. */
+usr_barrier_t* syscall_barrier_open(const char* name, int parties);
+int syscall_barrier_wait(usr_barrier_t* barrier);
+int syscall_barrier_destroy(usr_barrier_t* barrier);
+
+/* User event (one-shot latch) functions. */
+usr_event_t* syscall_event_open(const char* name, int signalled);
+int syscall_event_wait(usr_event_t* event);
+int syscall_event_signal(usr_event_t* event);
+int syscall_event_destroy(usr_event_t* event);
+
+/* Shared memory segment functions. */
+usr_shm_t* syscall_shm_open(const char* name, int size);
+void* syscall_shm_map(usr_shm_t* shm);
+int syscall_shm_unlink(const char* name);
+
+/* Atomic operations on user memory (LL/SC based). */
+int _atomic_add(volatile int *p, int delta);
+int _atomic_cas(volatile int *p, int expected, int desired);
+
+/* Futex functions. */
+int syscall_futex_wait(volatile int *addr, int value);
+int syscall_futex_wake(volatile int *addr, int count);
+
+/* Semaphore kept in user memory.  P and V only trap into the kernel when a
+   thread has to sleep or a sleeping thread has to be woken. */
+typedef struct {
+  volatile int value;
+  volatile int waiters;
+} futex_sem_t;
+
+void futex_sem_init(futex_sem_t *sem, int value);
+void futex_sem_p(futex_sem_t *sem);
+void futex_sem_v(futex_sem_t *sem);
+
 /* The library functions which are just wrappers to the _syscall function. */
 
 void syscall_halt(void);
@@ -80,10 +139,23 @@ int syscall_read(int filehandle, void *buffer, int length);
 int syscall_write(int filehandle, const void *buffer, int length);
 int syscall_create(const char *filename, int size);
 int syscall_delete(const char *filename);
+void *syscall_mmap(int filehandle, int offset, int length);
+int syscall_munmap(void *addr);
 
 int syscall_fork();
 int syscall_getpid();
 void *syscall_memlimit(void *heap_end);
+int syscall_stacklimit(int pages);
+
+/* Each thread gets a stack of its own, which grows on demand like that of
+   the first thread.  The output functions share the stdout stream, which
+   must not be used by two threads at the same time, so worker threads
+   should leave printing to one thread. */
+int syscall_thread_create(int (*func)(void*), void* arg);
+void syscall_thread_exit(int retval);
+int syscall_thread_join(int thread);
+
+int syscall_getrusage(int who, rusage_t *usage);
 
 
 /* The following functions and macros are not system calls, but convenient
@@ -117,6 +189,37 @@ void *memcpy(void *dest, const void *src, size_t n);
 #endif
 
 #ifdef PROVIDE_BASIC_IO
+/* Buffered streams on file handles.  Output to stdout_stream is written
+   at each newline, to stderr_stream at once, and to other streams when
+   the buffer fills, on fflush and on fclose.  Reading stdin_stream writes
+   out stdout_stream first.  All streams are flushed by syscall_exit and
+   before syscall_fork.  A stream must not be used by two threads at the
+   same time. */
+#define STREAM_BUFFER_SIZE 512
+#define STREAM_MAX 8
+#define EOF (-1)
+
+typedef struct {
+  int handle;    /* -1 if the stream is not open */
+  int flags;
+  int count;     /* Bytes in buf */
+  int pos;       /* Next byte of buf to read */
+  char buf[STREAM_BUFFER_SIZE];
+} FILE;
+
+extern FILE *stdin_stream;
+extern FILE *stdout_stream;
+extern FILE *stderr_stream;
+
+FILE *fopen(const char *filename, const char *mode);
+int fclose(FILE *stream);
+int fflush(FILE *stream);
+int fputc(int c, FILE *stream);
+int fputs(const char *s, FILE *stream);
+size_t fwrite(const void *ptr, size_t size, size_t nmemb, FILE *stream);
+int fgetc(FILE *stream);
+size_t fread(void *ptr, size_t size, size_t nmemb, FILE *stream);
+
 int putc(char c);
 int puts(const char* s);
 int getchar(void);
@@ -126,6 +229,7 @@ ssize_t readline(char *s, size_t size);
 
 #ifdef PROVIDE_FORMATTED_OUTPUT
 int printf(const char *, ...);
+int fprintf(FILE *, const char *, ...);
 int snprintf(char *, int, const char *, ...);
 #endif
 
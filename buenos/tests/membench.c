@@ -0,0 +1,108 @@
+#include "tests/lib.h"
+
+/* Time memcpy and memset against plain byte loops, with the buffers aligned
+   and misaligned.  The results are also checked, so this is a test too. */
+
+#define SIZE 8192
+#define ROUNDS 20
+
+byte source[SIZE + 4];
+byte target[SIZE + 4];
+
+static uint32_t ticks(void)
+{
+  rusage_t usage;
+  syscall_getrusage(RUSAGE_SELF, &usage);
+  return usage.cpu_ticks;
+}
+
+static void byte_copy(byte *d, const byte *s, size_t n)
+{
+  while (n-- > 0) {
+    *(d++) = *(s++);
+  }
+}
+
+static void byte_set(byte *d, int c, size_t n)
+{
+  while (n-- > 0) {
+    *(d++) = c;
+  }
+}
+
+static int check_copy(int to, int from)
+{
+  int i;
+  for (i = 0; i < SIZE; i++) {
+    if (target[to + i] != source[from + i]) {
+      return 0;
+    }
+  }
+  return 1;
+}
+
+static int check_set(int to, byte c)
+{
+  int i;
+  for (i = 0; i < SIZE; i++) {
+    if (target[to + i] != c) {
+      return 0;
+    }
+  }
+  return 1;
+}
+
+int main() {
+  uint32_t start, bytes, words;
+  int to, from, i;
+
+  for (i = 0; i < SIZE + 4; i++) {
+    source[i] = i * 7 + 3;
+  }
+
+  for (to = 0; to < 4; to++) {
+    for (from = 0; from < 4; from++) {
+      start = ticks();
+      for (i = 0; i < ROUNDS; i++) {
+        byte_copy(target + to, source + from, SIZE);
+      }
+      bytes = ticks() - start;
+
+      memset(target, 0, sizeof(target));
+      start = ticks();
+      for (i = 0; i < ROUNDS; i++) {
+        memcpy(target + to, source + from, SIZE);
+      }
+      words = ticks() - start;
+
+      if (!check_copy(to, from)) {
+        printf("memcpy to +%d from +%d copied wrong bytes.\n", to, from);
+        return 1;
+      }
+      printf("copy +%d <- +%d: bytes %d, memcpy %d ticks\n",
+             to, from, bytes, words);
+    }
+  }
+
+  for (to = 0; to < 4; to++) {
+    start = ticks();
+    for (i = 0; i < ROUNDS; i++) {
+      byte_set(target + to, 0x5a, SIZE);
+    }
+    bytes = ticks() - start;
+
+    start = ticks();
+    for (i = 0; i < ROUNDS; i++) {
+      memset(target + to, 0xa5, SIZE);
+    }
+    words = ticks() - start;
+
+    if (!check_set(to, 0xa5)) {
+      printf("memset at +%d set wrong bytes.\n", to);
+      return 2;
+    }
+    printf("set +%d: bytes %d, memset %d ticks\n", to, bytes, words);
+  }
+
+  return 0;
+}
@@ -0,0 +1,41 @@
+#include "tests/lib.h"
+
+/* Test that the heap can shrink, and that pages given back to the kernel are
+   zeroed when the heap grows over them again. */
+
+#define PAGES 4
+#define PAGE_SIZE 4096
+
+int main() {
+  char *start = syscall_memlimit(NULL);
+  char *end = start + PAGES * PAGE_SIZE;
+  int i;
+
+  if (syscall_memlimit(end) != end) {
+    puts("Could not grow the heap.\n");
+    return 1;
+  }
+  for (i = 0; i < PAGES; i++) {
+    end[-1 - i * PAGE_SIZE] = 'x';
+  }
+
+  if (syscall_memlimit(start) != start) {
+    puts("Could not shrink the heap.\n");
+    return 2;
+  }
+  if (syscall_memlimit(end) != end) {
+    puts("Could not grow the heap again.\n");
+    return 3;
+  }
+
+  /* Only the page holding the heap start survives the shrink. */
+  for (i = 0; i < PAGES - 1; i++) {
+    if (end[-1 - i * PAGE_SIZE] != 0) {
+      printf("Byte %d pages from the end was not zeroed.\n", i);
+      return 4;
+    }
+  }
+
+  puts("\nSUCCESS!\n\n");
+  return 0;
+}
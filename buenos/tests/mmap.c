@@ -0,0 +1,69 @@
+#include "tests/lib.h"
+
+/* Test that a mapped file reads like the file, and that writes to the
+   mapping reach the file when it is unmapped. */
+
+#define VOLUME "[disk]"
+#define FILENAME VOLUME "mmap.txt"
+#define PAGES 3
+#define PAGE_SIZE 4096
+#define SIZE (PAGES * PAGE_SIZE)
+
+char buffer[SIZE];
+
+int main() {
+  char *map;
+  int file, i;
+
+  syscall_delete(FILENAME);
+  if (syscall_create(FILENAME, SIZE) < 0) {
+    puts("Could not create the file.\n");
+    return 1;
+  }
+  file = syscall_open(FILENAME);
+  for (i = 0; i < SIZE; i++) {
+    buffer[i] = 'a' + i % 26;
+  }
+  if (syscall_write(file, buffer, SIZE) != SIZE) {
+    puts("Could not write the file.\n");
+    return 2;
+  }
+
+  map = syscall_mmap(file, 0, SIZE);
+  if (map == NULL) {
+    puts("Could not map the file.\n");
+    return 3;
+  }
+  for (i = 0; i < SIZE; i++) {
+    if (map[i] != 'a' + i % 26) {
+      printf("Byte %d of the mapping differs from the file.\n", i);
+      return 4;
+    }
+  }
+
+  /* Only the middle page is written, and so written back. */
+  for (i = PAGE_SIZE; i < 2 * PAGE_SIZE; i++) {
+    map[i] = 'A' + i % 26;
+  }
+  if (syscall_munmap(map) != 0) {
+    puts("Could not unmap the file.\n");
+    return 5;
+  }
+
+  syscall_seek(file, 0);
+  if (syscall_read(file, buffer, SIZE) != SIZE) {
+    puts("Could not read the file back.\n");
+    return 6;
+  }
+  for (i = 0; i < SIZE; i++) {
+    if (buffer[i] != (i / PAGE_SIZE == 1 ? 'A' : 'a') + i % 26) {
+      printf("Byte %d of the file was not written back.\n", i);
+      return 7;
+    }
+  }
+
+  syscall_close(file);
+  syscall_delete(FILENAME);
+  puts("\nSUCCESS!\n\n");
+  return 0;
+}
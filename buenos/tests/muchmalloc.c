@@ -4,10 +4,23 @@
 
 #include "tests/lib.h"
 
+#define SMALL 500
+
+static uint32_t ticks(void)
+{
+  rusage_t usage;
+  syscall_getrusage(RUSAGE_SELF, &usage);
+  return usage.cpu_ticks;
+}
+
 int main() {
   char* data[10];
-  int j;
+  char* small[SMALL];
+  char* grown;
+  uint32_t start;
+  int i, j;
 
+  start = ticks();
   for (j = 0; j < 50; j++) {
     int i;
     /* Allocate and insert in different places. */
@@ -35,7 +48,47 @@ int main() {
     free(data[8]);
     free(data[4]);
   }
-  
+  printf("large blocks: %d ticks\n", ticks() - start);
+
+  /* Many small blocks of mixed sizes, freed every other one and then the
+     rest. */
+  start = ticks();
+  for (j = 0; j < 20; j++) {
+    for (i = 0; i < SMALL; i++) {
+      small[i] = (char*) malloc(8 + (i % 13) * 12);
+      if (small[i] == NULL) {
+        return 2;
+      }
+      small[i][0] = i;
+    }
+    for (i = 0; i < SMALL; i += 2) {
+      free(small[i]);
+    }
+    for (i = 1; i < SMALL; i += 2) {
+      if (small[i][0] != (char) i) {
+        return 3;
+      }
+      free(small[i]);
+    }
+  }
+  printf("small blocks: %d ticks\n", ticks() - start);
+
+  /* A block grown a little at a time, as a buffer being filled would be. */
+  start = ticks();
+  grown = NULL;
+  for (i = 1; i <= 400; i++) {
+    grown = (char*) realloc(grown, i * 64);
+    if (grown == NULL) {
+      return 4;
+    }
+    if (i > 1 && grown[(i - 1) * 64 - 1] != (char) (i - 1)) {
+      return 5;
+    }
+    grown[i * 64 - 1] = i;
+  }
+  free(grown);
+  printf("realloc: %d ticks\n", ticks() - start);
+
   syscall_exit(0);
   return 0;
 }
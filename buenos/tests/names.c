@@ -0,0 +1,49 @@
+#include "tests/lib.h"
+
+/* Named object test.  Semaphores, barriers and events are created with names
+   on pages of the program's data that have not been touched yet, so that the
+   kernel has to page them in while reading the names. */
+
+#define PAGE 4096
+
+/* Each name starts a page of its own, and nothing else on those pages is
+   used before the names are passed to the kernel. */
+static char names[4 * PAGE] __attribute__ ((aligned (PAGE))) = {
+  [1 * PAGE] = 'c', 'o', 'l', 'd', '-', 's', 'e', 'm',
+  [2 * PAGE] = 'c', 'o', 'l', 'd', '-', 'b', 'a', 'r', 'r', 'i', 'e', 'r',
+  [3 * PAGE] = 'c', 'o', 'l', 'd', '-', 'e', 'v', 'e', 'n', 't',
+};
+
+int main() {
+  usr_sem_t *sem;
+  usr_barrier_t *barrier;
+  usr_event_t *event;
+  int ret = 0;
+
+  sem = syscall_sem_open(&names[1 * PAGE], 1);
+  barrier = syscall_barrier_open(&names[2 * PAGE], 1);
+  event = syscall_event_open(&names[3 * PAGE], 0);
+  if (sem == NULL || barrier == NULL || event == NULL) {
+    puts("Could not create the objects.\n");
+    return 1;
+  }
+
+  /* The names were stored as they were on the untouched pages. */
+  if (syscall_sem_open("cold-sem", -1) != sem ||
+      syscall_barrier_open("cold-barrier", 0) != barrier ||
+      syscall_event_open("cold-event", -1) != event) {
+    puts("Could not look up the objects by name.\n");
+    ret = 2;
+  }
+
+  if (!syscall_sem_destroy(sem) || !syscall_barrier_destroy(barrier) ||
+      !syscall_event_destroy(event)) {
+    puts("Could not destroy the objects.\n");
+    ret = 3;
+  }
+
+  if (ret == 0) {
+    puts("\nSUCCESS!\n\n");
+  }
+  return ret;
+}
@@ -14,15 +14,15 @@ int main() {
   char stderr_text[] = "Here's something for stderr..\n";
   char stdout_text[] = "Writing to stdout..\n";
 
-  syscall_write(stdout, stdout_text, sizeof(stdout_text));
-  syscall_write(stderr, stderr_text, sizeof(stderr_text));
-  syscall_write(stdout, stdout_text, sizeof(stdout_text));
+  fputs(stdout_text, stdout_stream);
+  fputs(stderr_text, stderr_stream);
+  fputs(stdout_text, stdout_stream);
 
-  syscall_write(stdout, hello, sizeof(hello));
+  fputs(hello, stdout_stream);
   read_length = syscall_read(stdin, text_read, READ_LENGTH);
-  syscall_write(stdout, you_wrote, sizeof(you_wrote));
-  syscall_write(stdout, text_read, read_length);
-  syscall_write(stdout, "\n", 1);
+  fputs(you_wrote, stdout_stream);
+  fwrite(text_read, 1, read_length > 0 ? read_length : 0, stdout_stream);
+  fputc('\n', stdout_stream);
 
   return 0;
 }
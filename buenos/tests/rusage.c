@@ -0,0 +1,63 @@
+#include "tests/lib.h"
+
+/* Test that the resources used by a process and its children are counted. */
+
+#define VOLUME "[disk]"
+#define BUFFER_SIZE 100
+
+char buffer[BUFFER_SIZE];
+
+int main() {
+  rusage_t before, after, children;
+  int file, pid, len;
+
+  if (syscall_getrusage(RUSAGE_SELF, &before) != 0) {
+    puts("Could not get the resource usage.\n");
+    return 1;
+  }
+  if (syscall_getrusage(2, &after) >= 0) {
+    puts("Got the resource usage of nobody.\n");
+    return 2;
+  }
+
+  file = syscall_open(VOLUME "science.txt");
+  len = syscall_read(file, buffer, BUFFER_SIZE);
+  syscall_close(file);
+  syscall_getrusage(RUSAGE_SELF, &after);
+
+  if (len <= 0 || after.bytes_read - before.bytes_read != (uint32_t) len) {
+    printf("Read %d bytes, but %d were counted.\n",
+           len, after.bytes_read - before.bytes_read);
+    return 3;
+  }
+  /* open, read, close and getrusage twice. */
+  if (after.syscalls - before.syscalls < 4) {
+    printf("Only %d syscalls were counted.\n",
+           after.syscalls - before.syscalls);
+    return 4;
+  }
+  if (after.cpu_ticks == 0 || after.page_faults == 0 ||
+      after.pages_resident == 0) {
+    puts("No CPU time, page faults or resident pages were counted.\n");
+    return 5;
+  }
+
+  pid = syscall_fork();
+  if (pid == 0) {
+    syscall_write(stdout, "child\n", 6);
+    return 0;
+  }
+  syscall_join(pid);
+  syscall_getrusage(RUSAGE_CHILDREN, &children);
+  if (children.syscalls == 0 || children.bytes_written != 6 ||
+      children.cpu_ticks == 0) {
+    puts("The child's resources were not counted.\n");
+    return 6;
+  }
+
+  printf("cycles %d, refills %d, faults %d, pages %d, syscalls %d\n",
+         after.cpu_ticks, after.tlb_refills, after.page_faults,
+         after.pages_resident, after.syscalls);
+  puts("\nSUCCESS!\n\n");
+  return 0;
+}
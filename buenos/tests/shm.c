@@ -0,0 +1,62 @@
+#include "tests/lib.h"
+
+/* Shared memory test.  The parent fills a segment, and the child sums it and
+   writes the sum back into the segment for the parent to check. */
+
+#define VOLUME "[disk]"
+#define WORDS 2048
+
+int main() {
+  usr_shm_t *shm;
+  int *data;
+  int i, pid, ret, sum = 0;
+
+  shm = syscall_shm_open("shm", (WORDS + 1) * sizeof(int));
+  if (shm == NULL) {
+    puts("Could not create the segment.\n");
+    return 1;
+  }
+  if (syscall_shm_open("shm", 4) != NULL) {
+    puts("Created a segment with a name already in use.\n");
+    return 2;
+  }
+
+  data = syscall_shm_map(shm);
+  if (data == NULL) {
+    puts("Could not map the segment.\n");
+    return 3;
+  }
+  for (i = 0; i < WORDS; i++) {
+    data[i] = i;
+    sum += i;
+  }
+
+  pid = syscall_exec(VOLUME "shm_child");
+  ret = syscall_join(pid);
+  if (ret != 0) {
+    printf("The child failed with %d.\n", ret);
+    return 4;
+  }
+  if (data[WORDS] != sum) {
+    printf("Expected the sum %d, got %d.\n", sum, data[WORDS]);
+    return 5;
+  }
+
+  if (syscall_munmap(data) != 0) {
+    puts("Could not unmap the segment.\n");
+    return 6;
+  }
+  /* The name keeps the segment after its last mapping is gone, until it is
+     unlinked. */
+  if (syscall_shm_open("shm", -1) != shm) {
+    puts("The segment did not outlive its mappings.\n");
+    return 7;
+  }
+  if (!syscall_shm_unlink("shm") || syscall_shm_open("shm", -1) != NULL) {
+    puts("Could not unlink the segment.\n");
+    return 8;
+  }
+
+  puts("\nSUCCESS!\n\n");
+  return 0;
+}
@@ -0,0 +1,29 @@
+#include "tests/lib.h"
+
+/* Child of the shared memory test; sums the words the parent wrote into the
+   segment, and stores the sum after them. */
+
+#define WORDS 2048
+
+int main() {
+  usr_shm_t *shm;
+  int *data;
+  int i, sum = 0;
+
+  shm = syscall_shm_open("shm", -1);
+  if (shm == NULL) {
+    return 100;
+  }
+  data = syscall_shm_map(shm);
+  if (data == NULL) {
+    return 101;
+  }
+
+  for (i = 0; i < WORDS; i++) {
+    sum += data[i];
+  }
+  data[WORDS] = sum;
+
+  /* The mapping is dropped when the process exits. */
+  return 0;
+}
@@ -0,0 +1,64 @@
+#include "tests/lib.h"
+
+/* Swap test.  The heap is grown over more pages than the machine has memory,
+   so run this with a swap disk (see the swapdisk boot argument) and less than
+   PAGES pages of memory.  Every page is filled with a pattern of its own, and
+   then checked twice, so that the pages are swapped out and read back in both
+   directions. */
+
+#define PAGES 2048
+#define PAGE_SIZE 4096
+#define WORDS (PAGE_SIZE / sizeof(uint32_t))
+
+static uint32_t pattern(int page, int word)
+{
+  return (page * 2654435761u) ^ (word * 40503u);
+}
+
+static int check(uint32_t *heap, int page)
+{
+  uint32_t *p = heap + page * WORDS;
+  int i;
+
+  for (i = 0; i < (int) WORDS; i++) {
+    if (p[i] != pattern(page, i)) {
+      printf("Word %d of page %d was not kept.\n", i, page);
+      return 0;
+    }
+  }
+  return 1;
+}
+
+int main() {
+  uint32_t *heap, *end;
+  int page, i;
+
+  /* Start at a page boundary. */
+  heap = (uint32_t *) (((uint32_t) syscall_memlimit(NULL) + PAGE_SIZE - 1) &
+                       ~(PAGE_SIZE - 1));
+  end = heap + PAGES * WORDS;
+  if (syscall_memlimit(end) != end) {
+    puts("Could not grow the heap.\n");
+    return 1;
+  }
+
+  for (page = 0; page < PAGES; page++) {
+    for (i = 0; i < (int) WORDS; i++) {
+      heap[page * WORDS + i] = pattern(page, i);
+    }
+  }
+
+  for (page = 0; page < PAGES; page++) {
+    if (!check(heap, page)) {
+      return 2;
+    }
+  }
+  for (page = PAGES - 1; page >= 0; page--) {
+    if (!check(heap, page)) {
+      return 3;
+    }
+  }
+
+  puts("\nSUCCESS!\n\n");
+  return 0;
+}
@@ -0,0 +1,57 @@
+#include "tests/lib.h"
+
+/* Test threads sharing one process.  The workers increment a shared counter
+   under a futex semaphore, and each returns its own index, which the main
+   thread checks when joining. */
+
+#define THREADS 4
+#define ROUNDS 1000
+
+futex_sem_t lock;
+int counter = 0;
+
+int worker(void* arg) {
+  int i;
+  for (i = 0; i < ROUNDS; i++) {
+    futex_sem_p(&lock);
+    counter++;
+    futex_sem_v(&lock);
+  }
+  return (int) arg;
+}
+
+int main() {
+  int tids[THREADS];
+  int i, ret;
+
+  futex_sem_init(&lock, 1);
+
+  for (i = 0; i < THREADS; i++) {
+    tids[i] = syscall_thread_create(&worker, (void*) i);
+    if (tids[i] < 0) {
+      printf("Could not create thread %d: %d\n", i, tids[i]);
+      return 1;
+    }
+  }
+
+  for (i = 0; i < THREADS; i++) {
+    ret = syscall_thread_join(tids[i]);
+    if (ret != i) {
+      printf("Thread %d returned %d\n", i, ret);
+      return 2;
+    }
+  }
+
+  /* A thread can only be joined once. */
+  if (syscall_thread_join(tids[0]) >= 0) {
+    puts("Joined the same thread twice.\n");
+    return 3;
+  }
+
+  if (counter != THREADS * ROUNDS) {
+    printf("Counter is %d, expected %d\n", counter, THREADS * ROUNDS);
+    return 4;
+  }
+  printf("%d threads counted to %d.\n", THREADS, counter);
+  return 0;
+}
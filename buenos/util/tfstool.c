@@ -669,17 +669,21 @@ void bitmap_set(bitmap_t *bitmap, int pos, int value)
  */
 int bitmap_findnset(bitmap_t *bitmap, int l)
 {
-  int i;
-
-  for(i=0;i<l;i++) {
-    if(bitmap_get(bitmap,i) == 0) {
-      bitmap_set(bitmap, i, 1);
-      break;
+  int i, j;
+  uint32_t word;
+
+  /* Skip full words, then find the lowest zero bit of the first word
+     that has one; ~word & (word + 1) leaves just that bit set. */
+  for(i=0;i<(l+31)/32;i++) {
+    word = ntohl(bitmap[i]);
+    if(word != 0xffffffff) {
+      j = i*32 + 31 - __builtin_clz(~word & (word + 1));
+      if(j >= l)
+        break;
+      bitmap_set(bitmap, j, 1);
+      return j;
     }
   }
 
-  if(i >= l)
-    i = -1;
-
-  return i;
+  return -1;
 }
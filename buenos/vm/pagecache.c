@@ -0,0 +1,175 @@
+#include "vm/pagecache.h"
+#include "vm/pagepool.h"
+#include "kernel/spinlock.h"
+#include "kernel/interrupt.h"
+#include "kernel/assert.h"
+#include "lib/libc.h"
+
+typedef struct {
+  /* The file and part of it that the page holds.  `fs` is NULL in unused
+     entries. */
+  fs_t *fs;
+  int fileid;
+  uint32_t offset;
+  uint32_t length;
+  /* The cached page.  The cache holds one reference to it. */
+  uint32_t phys_page;
+} pagecache_entry_t;
+
+/* The cache is set-associative.  A page can only be in the set chosen by
+   `pagecache_set`, which keeps lookups short without a separate index. */
+static pagecache_entry_t pagecache[PAGECACHE_SETS][PAGECACHE_WAYS];
+static spinlock_t pagecache_slock;
+
+void pagecache_init(void)
+{
+  memoryset(pagecache, 0, sizeof(pagecache));
+  spinlock_reset(&pagecache_slock);
+}
+
+static pagecache_entry_t *pagecache_set(fs_t *fs, int fileid, uint32_t offset)
+{
+  uint32_t hash = (uint32_t) fs ^ (fileid * 31) ^ (offset / PAGE_SIZE);
+  return pagecache[hash % PAGECACHE_SETS];
+}
+
+/* Find the cached page, and take a reference to it for the caller.  The
+   cache lock must be held. */
+static uint32_t pagecache_lookup(fs_t *fs, int fileid, uint32_t offset,
+                                 uint32_t length)
+{
+  pagecache_entry_t *set = pagecache_set(fs, fileid, offset);
+
+  for (int i = 0; i < PAGECACHE_WAYS; i++) {
+    if (set[i].fs == fs && set[i].fileid == fileid &&
+        set[i].offset == offset && set[i].length == length) {
+      pagepool_ref_phys_page(set[i].phys_page);
+      return set[i].phys_page;
+    }
+  }
+  return 0;
+}
+
+/**
+ * Returns a page holding `length` bytes of given file from `offset`,
+ * followed by zeroes. The page is shared with everyone else asking for
+ * the same part of the same file, and must not be written to. The
+ * caller gets a reference to the page, which it must drop with
+ * pagepool_free_phys_page. Reads the file on a miss, so interrupts
+ * must be enabled.
+ *
+ * @param file Open file to read.
+ *
+ * @param offset Offset of the page in the file.
+ *
+ * @param length Number of bytes to read, at most PAGE_SIZE.
+ *
+ * @return Physical address of the page, or zero if out of memory or
+ * the read failed.
+ */
+uint32_t pagecache_get_page(openfile_t file, uint32_t offset, uint32_t length)
+{
+  interrupt_status_t intr_status;
+  pagecache_entry_t *set, *victim;
+  uint32_t phys_page, cached;
+  fs_t *fs;
+  int fileid;
+
+  KERNEL_ASSERT(length <= PAGE_SIZE);
+
+  if (vfs_identify(file, &fs, &fileid) != VFS_OK) {
+    return 0;
+  }
+
+  intr_status = _interrupt_disable();
+  spinlock_acquire(&pagecache_slock);
+  phys_page = pagecache_lookup(fs, fileid, offset, length);
+  spinlock_release(&pagecache_slock);
+  _interrupt_set_state(intr_status);
+  if (phys_page != 0) {
+    return phys_page;
+  }
+
+  /* Read the page without holding the lock. */
+  phys_page = pagepool_get_zeroed_phys_page();
+  if (phys_page == 0) {
+    return 0;
+  }
+  if (length > 0 &&
+      vfs_read_at(file, (void *) ADDR_PHYS_TO_KERNEL(phys_page), length,
+                  offset) != (int) length) {
+    pagepool_free_phys_page(phys_page);
+    return 0;
+  }
+
+  intr_status = _interrupt_disable();
+  spinlock_acquire(&pagecache_slock);
+
+  /* Someone else may have read the same page in the meantime. */
+  cached = pagecache_lookup(fs, fileid, offset, length);
+  if (cached != 0) {
+    pagepool_free_phys_page(phys_page);
+    phys_page = cached;
+    goto end;
+  }
+
+  /* Use a free entry, or else one whose page nobody but the cache uses any
+     more.  If every page in the set is in use, the page is not cached. */
+  set = pagecache_set(fs, fileid, offset);
+  victim = NULL;
+  for (int i = 0; i < PAGECACHE_WAYS && victim == NULL; i++) {
+    if (set[i].fs == NULL) {
+      victim = &set[i];
+    }
+  }
+  for (int i = 0; i < PAGECACHE_WAYS && victim == NULL; i++) {
+    if (pagepool_phys_page_refs(set[i].phys_page) == 1) {
+      victim = &set[i];
+      pagepool_free_phys_page(victim->phys_page);
+    }
+  }
+  if (victim != NULL) {
+    victim->fs = fs;
+    victim->fileid = fileid;
+    victim->offset = offset;
+    victim->length = length;
+    victim->phys_page = phys_page;
+    pagepool_ref_phys_page(phys_page);
+  }
+
+ end:
+  spinlock_release(&pagecache_slock);
+  _interrupt_set_state(intr_status);
+  return phys_page;
+}
+
+/**
+ * Forgets the cached pages of given file, or of every file in the
+ * filesystem if `fileid` is negative. Pages still mapped somewhere stay
+ * valid there, but are no longer handed out.
+ *
+ * @param fs Filesystem of the file.
+ *
+ * @param fileid The file, or negative for all files.
+ */
+void pagecache_invalidate(fs_t *fs, int fileid)
+{
+  interrupt_status_t intr_status;
+  pagecache_entry_t *entry;
+
+  intr_status = _interrupt_disable();
+  spinlock_acquire(&pagecache_slock);
+
+  for (int s = 0; s < PAGECACHE_SETS; s++) {
+    for (int i = 0; i < PAGECACHE_WAYS; i++) {
+      entry = &pagecache[s][i];
+      if (entry->fs == fs && (fileid < 0 || entry->fileid == fileid)) {
+        pagepool_free_phys_page(entry->phys_page);
+        entry->fs = NULL;
+      }
+    }
+  }
+
+  spinlock_release(&pagecache_slock);
+  _interrupt_set_state(intr_status);
+}
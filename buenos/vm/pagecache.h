@@ -0,0 +1,18 @@
+#ifndef BUENOS_VM_PAGECACHE_H
+#define BUENOS_VM_PAGECACHE_H
+
+#include "lib/types.h"
+#include "fs/vfs.h"
+
+/* The page cache keeps pages read from files, so that processes mapping the
+   same part of the same file read-only can share one physical page.  Pages are
+   identified by filesystem, fileid, offset and length; bytes of the page past
+   the length are zero. */
+#define PAGECACHE_SETS 64
+#define PAGECACHE_WAYS 4
+
+void pagecache_init(void);
+uint32_t pagecache_get_page(openfile_t file, uint32_t offset, uint32_t length);
+void pagecache_invalidate(fs_t *fs, int fileid);
+
+#endif /* BUENOS_VM_PAGECACHE_H */
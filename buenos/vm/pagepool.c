@@ -35,27 +35,55 @@
  */
 
 #include "vm/pagepool.h"
-#include "lib/bitmap.h"
 #include "kernel/kmalloc.h"
 #include "kernel/spinlock.h"
 #include "kernel/interrupt.h"
 #include "kernel/assert.h"
+#include "kernel/percpu.h"
 
 /** @name Page pool
  *
  * Functions and data structures for handling physical page reservation.
  *
+ * Free memory is managed by a buddy allocator. A free block of order n
+ * is 2^n pages aligned to its size, and is kept in the free list of
+ * that order. Splitting a block gives two buddies of the next lower
+ * order, and two free buddies are merged back when the second one is
+ * freed.
+ *
  * @{
  */
 
-/* Bitmap field of physical pages. Length is number of physical pages
-   rounded up to a word boundary */
-static bitmap_t *pagepool_free_pages;
+/* Links of a free list.  These are kept in the first words of the free
+   block itself, and hold page numbers, or -1 at the ends of the list. */
+typedef struct {
+  int next;
+  int prev;
+} pagepool_link_t;
+
+#define PAGEPOOL_LINK(page) \
+  ((pagepool_link_t *) ADDR_PHYS_TO_KERNEL((uint32_t) (page) * PAGE_SIZE))
+
+/* Marks a page that does not start a free block in pagepool_orders. */
+#define PAGEPOOL_NOT_FREE 0xff
+
+/* First page of a free block of each order, or -1 if there is none. */
+static int pagepool_free_lists[PAGEPOOL_MAX_ORDER + 1];
+
+/* For each physical page, the order of the free block that starts with
+   it, or PAGEPOOL_NOT_FREE. */
+static uint8_t *pagepool_orders;
+
+/* Number of references to each physical page, zero for free pages.  A
+   page is shared between address spaces after a fork, and only freed
+   when its last reference is dropped. */
+static uint16_t *pagepool_refcounts;
 
 /* Number of physical pages */
 static int pagepool_num_pages;
 
-/* Number of free physical pages */
+/* Number of free physical pages in the free lists.  Pages in the per-CPU
+   magazines are not counted. */
 static int pagepool_num_free_pages;
 
 /* Number of last staticly reserved page. This is needed to ensure
@@ -63,33 +91,168 @@ static int pagepool_num_free_pages;
    purpose).  */
 static int pagepool_static_end;
 
-/* Spinlock to handle synchronous access to pagepool_free_pages */
+/* Reserved pages that are already filled with zeros, ready to be handed
+   out by pagepool_get_zeroed_phys_page.  They are kept apart from the free
+   lists, whose links are written into the free pages. */
+static uint32_t pagepool_zeroed[PAGEPOOL_ZEROED_MAX];
+static int pagepool_num_zeroed;
+
+/* Statistics of pagepool_get_zeroed_phys_page. */
+static uint32_t pagepool_zeroed_hits;
+static uint32_t pagepool_zeroed_misses;
+
+/* Spinlock to handle synchronous access to the free lists and the zeroed
+   pages */
 static spinlock_t pagepool_slock;
 
+/* Put the free block starting at `page` in the free list of `order`. */
+static void pagepool_push(int page, int order)
+{
+  int head = pagepool_free_lists[order];
+
+  PAGEPOOL_LINK(page)->next = head;
+  PAGEPOOL_LINK(page)->prev = -1;
+  if (head >= 0) {
+    PAGEPOOL_LINK(head)->prev = page;
+  }
+  pagepool_free_lists[order] = page;
+  pagepool_orders[page] = order;
+}
+
+/* Take the free block starting at `page` out of the free list of `order`. */
+static void pagepool_remove(int page, int order)
+{
+  pagepool_link_t *link = PAGEPOOL_LINK(page);
+
+  if (link->prev >= 0) {
+    PAGEPOOL_LINK(link->prev)->next = link->next;
+  } else {
+    pagepool_free_lists[order] = link->next;
+  }
+  if (link->next >= 0) {
+    PAGEPOOL_LINK(link->next)->prev = link->prev;
+  }
+  pagepool_orders[page] = PAGEPOOL_NOT_FREE;
+}
+
+/* Free the block of `order` starting at `page`, merging it with its buddy
+   as long as the buddy is free too.  The lock must be held. */
+static void pagepool_free_block(int page, int order)
+{
+  int buddy;
+
+  pagepool_num_free_pages += 1 << order;
+  while (order < PAGEPOOL_MAX_ORDER) {
+    buddy = page ^ (1 << order);
+    if (buddy < pagepool_static_end || buddy >= pagepool_num_pages ||
+        pagepool_orders[buddy] != order) {
+      break;
+    }
+    pagepool_remove(buddy, order);
+    page &= ~(1 << order);
+    order++;
+  }
+  pagepool_push(page, order);
+}
+
+/* Return the pages in the magazines of all CPUs to the free lists, where
+   pagepool_get_phys_page on another CPU, or pagepool_get_phys_block, can find
+   them.  Used when the free lists have run out.  Interrupts must be disabled,
+   and no lock held.  Returns the number of pages returned. */
+static int pagepool_drain_magazines(void)
+{
+  pagepool_magazine_t *magazine;
+  int cpu, drained = 0;
+
+  for (cpu = 0; cpu < CONFIG_MAX_CPUS; cpu++) {
+    magazine = &percpu_area[cpu].page_magazine;
+    spinlock_acquire(&magazine->slock);
+    spinlock_acquire(&pagepool_slock);
+    while (magazine->count > 0) {
+      pagepool_free_block(magazine->pages[--magazine->count], 0);
+      drained++;
+    }
+    spinlock_release(&pagepool_slock);
+    spinlock_release(&magazine->slock);
+  }
+  return drained;
+}
+
+/* Take a free block of `order` out of the free lists, splitting a larger one
+   if needed.  Returns its first page, or -1 if there is no large enough block.
+   The lock must be held. */
+static int pagepool_take_block(int order)
+{
+  int k, page;
+
+  if (pagepool_num_pages == 0) {
+    /* Not initialized yet. */
+    return -1;
+  }
+
+  /* Find the smallest free block that is large enough. */
+  for (k = order; k <= PAGEPOOL_MAX_ORDER; k++) {
+    if (pagepool_free_lists[k] >= 0)
+      break;
+  }
+  if (k > PAGEPOOL_MAX_ORDER) {
+    return -1;
+  }
+
+  page = pagepool_free_lists[k];
+  pagepool_remove(page, k);
+
+  /* Split it, returning the upper halves to the free lists. */
+  while (k > order) {
+    k--;
+    pagepool_push(page + (1 << k), k);
+  }
+
+  pagepool_num_free_pages -= 1 << order;
+  return page;
+}
+
 /**
  * Pagepool initialization. Finds out number of physical pages and
- * number of staticly reserved physical pages. Marks reserved pages
- * reserved in pagepool_free_pages.
+ * number of staticly reserved physical pages, and puts the rest in
+ * the free lists.
  */
 void pagepool_init(void)
 {
   int num_res_pages;
-  int i;
+  int i, order;
 
   pagepool_num_pages = kmalloc_get_numpages();
 
-  pagepool_free_pages =
-    (uint32_t *)kmalloc(bitmap_sizeof(pagepool_num_pages));
-  bitmap_init(pagepool_free_pages, pagepool_num_pages);
+  pagepool_orders = (uint8_t *)kmalloc(pagepool_num_pages);
+  pagepool_refcounts =
+    (uint16_t *)kmalloc(pagepool_num_pages * sizeof(uint16_t));
 
   /* Note that number of reserved pages must be get after we have
-     (statically) reserved memory for bitmap. */
+     (statically) reserved memory for the page arrays. */
   num_res_pages = kmalloc_get_reserved_pages();
-  pagepool_num_free_pages = pagepool_num_pages - num_res_pages;
+  pagepool_num_free_pages = 0;
+  pagepool_num_zeroed = 0;
   pagepool_static_end = num_res_pages;
 
-  for (i = 0; i < num_res_pages; i++)
-    bitmap_set(pagepool_free_pages, i, 1);
+  for (order = 0; order <= PAGEPOOL_MAX_ORDER; order++)
+    pagepool_free_lists[order] = -1;
+  for (i = 0; i < pagepool_num_pages; i++) {
+    pagepool_orders[i] = PAGEPOOL_NOT_FREE;
+    pagepool_refcounts[i] = (i < num_res_pages) ? 1 : 0;
+  }
+
+  /* Cover the free pages with the largest blocks that are aligned to their
+     size. */
+  for (i = num_res_pages; i < pagepool_num_pages; i += 1 << order) {
+    order = 0;
+    while (order < PAGEPOOL_MAX_ORDER &&
+           (i & ((2 << order) - 1)) == 0 &&
+           i + (2 << order) <= pagepool_num_pages) {
+      order++;
+    }
+    pagepool_free_block(i, order);
+  }
 
   spinlock_reset(&pagepool_slock);
 
@@ -101,62 +264,362 @@ void pagepool_init(void)
 }
 
 /**
- * Finds first free physical page and marks it reserved.
+ * Reserves 2^order physically contiguous pages, aligned to their
+ * combined size. Each page of the block has one reference.
  *
- * @return Address of first free physical page, zero if no free pages
- * are available.
+ * @param order Base 2 logarithm of the number of pages, at most
+ * PAGEPOOL_MAX_ORDER.
+ *
+ * @return Address of the first page of the block, zero if no block
+ * of that size is available.
  */
-uint32_t pagepool_get_phys_page(void)
+uint32_t pagepool_get_phys_block(int order)
 {
   interrupt_status_t intr_status;
-  int i;
+  int i, page;
+
+  KERNEL_ASSERT(order >= 0 && order <= PAGEPOOL_MAX_ORDER);
 
   intr_status = _interrupt_disable();
   spinlock_acquire(&pagepool_slock);
 
-  if (pagepool_num_free_pages > 0) {
-    i = bitmap_findnset(pagepool_free_pages,pagepool_num_pages);
-    pagepool_num_free_pages--;
+  page = pagepool_take_block(order);
+  if (page < 0) {
+    /* The pages in the magazines may complete a block. */
+    spinlock_release(&pagepool_slock);
+    pagepool_drain_magazines();
+    spinlock_acquire(&pagepool_slock);
+    page = pagepool_take_block(order);
+  }
+  if (page < 0) {
+    spinlock_release(&pagepool_slock);
+    _interrupt_set_state(intr_status);
+    return 0;
+  }
+
+  for (i = 0; i < (1 << order); i++) {
+    KERNEL_ASSERT(pagepool_refcounts[page + i] == 0);
+    pagepool_refcounts[page + i] = 1;
+  }
 
-    /* There should have been a free page. Check that the pagepool
-       internal variables are in synch. */
-    KERNEL_ASSERT(i >= 0 && pagepool_num_free_pages >= 0);
+  spinlock_release(&pagepool_slock);
+  _interrupt_set_state(intr_status);
+  return page * PAGE_SIZE;
+}
+
+/**
+ * Frees a block reserved with pagepool_get_phys_block. No page of the
+ * block may have been shared with pagepool_ref_phys_page.
+ *
+ * @param phys_addr First page of the block.
+ *
+ * @param order Order the block was reserved with.
+ */
+void pagepool_free_phys_block(uint32_t phys_addr, int order)
+{
+  interrupt_status_t intr_status;
+  int i, page;
+
+  page = phys_addr / PAGE_SIZE;
+  KERNEL_ASSERT(order >= 0 && order <= PAGEPOOL_MAX_ORDER);
+  KERNEL_ASSERT(page >= pagepool_static_end && (page & ((1 << order) - 1)) == 0);
+
+  intr_status = _interrupt_disable();
+  spinlock_acquire(&pagepool_slock);
+
+  for (i = 0; i < (1 << order); i++) {
+    KERNEL_ASSERT(pagepool_refcounts[page + i] == 1);
+    pagepool_refcounts[page + i] = 0;
+  }
+  pagepool_free_block(page, order);
+
+  spinlock_release(&pagepool_slock);
+  _interrupt_set_state(intr_status);
+}
+
+/* Take a page from the calling CPU's magazine, first taking a batch of pages
+   from the free lists if it is empty.  Returns the page, or -1 if the free
+   lists are empty too.  Interrupts must be disabled, and no lock held. */
+static int pagepool_magazine_get(void)
+{
+  pagepool_magazine_t *magazine = &percpu_this()->page_magazine;
+  int page;
+
+  spinlock_acquire(&magazine->slock);
+  if (magazine->count > 0) {
+    magazine->hits++;
   } else {
-    i = 0;
+    spinlock_acquire(&pagepool_slock);
+    while (magazine->count < PAGEPOOL_MAGAZINE_BATCH) {
+      page = pagepool_take_block(0);
+      if (page < 0) {
+        break;
+      }
+      magazine->pages[magazine->count++] = page;
+    }
+    spinlock_release(&pagepool_slock);
+    magazine->refills++;
+  }
+  page = magazine->count > 0 ? (int) magazine->pages[--magazine->count] : -1;
+  spinlock_release(&magazine->slock);
+  return page;
+}
+
+/**
+ * Finds a free physical page and marks it reserved. The page comes
+ * from the calling CPU's magazine, which is refilled from the free
+ * lists when empty. When those are empty too, a zeroed page is used,
+ * and failing that, the pages left in the magazines of the other
+ * CPUs.
+ *
+ * @return Address of the free physical page, zero if no free pages
+ * are available.
+ */
+uint32_t pagepool_get_phys_page(void)
+{
+  interrupt_status_t intr_status;
+  uint32_t phys_addr = 0;
+  int page;
+
+  intr_status = _interrupt_disable();
+
+  page = pagepool_magazine_get();
+  if (page < 0) {
+    /* Out of free pages, but a zeroed one is as good as any.  It is
+       already reserved. */
+    spinlock_acquire(&pagepool_slock);
+    if (pagepool_num_zeroed > 0) {
+      phys_addr = pagepool_zeroed[--pagepool_num_zeroed];
+    }
+    spinlock_release(&pagepool_slock);
+
+    if (phys_addr == 0 && pagepool_drain_magazines() > 0) {
+      page = pagepool_magazine_get();
+    }
+    if (page < 0) {
+      _interrupt_set_state(intr_status);
+      return phys_addr;
+    }
   }
 
+  KERNEL_ASSERT(pagepool_refcounts[page] == 0);
+  pagepool_refcounts[page] = 1;
+  phys_addr = page * PAGE_SIZE;
+
+  _interrupt_set_state(intr_status);
+  return phys_addr;
+}
+
+/**
+ * Reserves a physical page filled with zeros. The page is taken from
+ * the pages zeroed in advance by idle CPUs if there are any, and
+ * otherwise zeroed here.
+ *
+ * @return Address of the page, zero if no free pages are available.
+ */
+uint32_t pagepool_get_zeroed_phys_page(void)
+{
+  interrupt_status_t intr_status;
+  uint32_t phys_addr = 0;
+
+  intr_status = _interrupt_disable();
+  spinlock_acquire(&pagepool_slock);
+  if (pagepool_num_zeroed > 0) {
+    phys_addr = pagepool_zeroed[--pagepool_num_zeroed];
+    pagepool_zeroed_hits++;
+  } else {
+    pagepool_zeroed_misses++;
+  }
   spinlock_release(&pagepool_slock);
   _interrupt_set_state(intr_status);
-  return i*PAGE_SIZE;
+
+  if (phys_addr == 0) {
+    phys_addr = pagepool_get_phys_page();
+    if (phys_addr != 0) {
+      memzero_page((void *) ADDR_PHYS_TO_KERNEL(phys_addr));
+    }
+  }
+  return phys_addr;
 }
 
 /**
- * Frees given page. Given page should be reserved, but not staticly
- * reserved.
+ * Zeroes a few free pages for pagepool_get_zeroed_phys_page. Called
+ * by the interrupt handler when the CPU has nothing else to run, so
+ * the work is done while the CPU would otherwise wait. Free pages are
+ * left alone when memory is low.
+ */
+void pagepool_zero_idle(void)
+{
+  interrupt_status_t intr_status;
+  uint32_t phys_addr;
+  int i;
+
+  for (i = 0; i < PAGEPOOL_ZERO_BATCH; i++) {
+    /* Unlocked reads; at worst one page too many is zeroed and freed. */
+    if (pagepool_num_zeroed >= PAGEPOOL_ZEROED_MAX ||
+        pagepool_num_free_pages < PAGEPOOL_ZEROED_MAX) {
+      break;
+    }
+
+    phys_addr = pagepool_get_phys_page();
+    if (phys_addr == 0) {
+      break;
+    }
+    memzero_page((void *) ADDR_PHYS_TO_KERNEL(phys_addr));
+
+    intr_status = _interrupt_disable();
+    spinlock_acquire(&pagepool_slock);
+    if (pagepool_num_zeroed < PAGEPOOL_ZEROED_MAX) {
+      pagepool_zeroed[pagepool_num_zeroed++] = phys_addr;
+      phys_addr = 0;
+    }
+    spinlock_release(&pagepool_slock);
+    _interrupt_set_state(intr_status);
+
+    if (phys_addr != 0) {
+      pagepool_free_phys_page(phys_addr);
+      break;
+    }
+  }
+}
+
+/* Put a page whose last reference was just dropped in the calling CPU's
+   magazine, first returning a batch of pages to the free lists if it is full.
+   Interrupts must be disabled, and the lock must not be held. */
+static void pagepool_magazine_put(int page)
+{
+  pagepool_magazine_t *magazine = &percpu_this()->page_magazine;
+
+  spinlock_acquire(&magazine->slock);
+  if (magazine->count == PAGEPOOL_MAGAZINE_SIZE) {
+    spinlock_acquire(&pagepool_slock);
+    while (magazine->count > PAGEPOOL_MAGAZINE_SIZE - PAGEPOOL_MAGAZINE_BATCH) {
+      pagepool_free_block(magazine->pages[--magazine->count], 0);
+    }
+    spinlock_release(&pagepool_slock);
+    magazine->drains++;
+  }
+  magazine->pages[magazine->count++] = page;
+  spinlock_release(&magazine->slock);
+}
+
+/* Drop a reference to the page, and free it if it was the last one.  The
+   lock must be held. */
+static void pagepool_unref(int i)
+{
+  /* A page allocated by kmalloc should not be freed. */
+  KERNEL_ASSERT(i >= pagepool_static_end && i < pagepool_num_pages);
+  /* Check that the page was reserved. */
+  KERNEL_ASSERT(pagepool_refcounts[i] > 0);
+
+  if (--pagepool_refcounts[i] == 0) {
+    pagepool_free_block(i, 0);
+  }
+}
+
+/**
+ * Drops a reference to given page, and frees the page if it was the
+ * last one. Given page should be reserved, but not staticly reserved.
  *
  * @param phys_addr Page to be freed.
  */
 void pagepool_free_phys_page(uint32_t phys_addr)
 {
   interrupt_status_t intr_status;
+  bool last;
   int i;
 
   i = phys_addr / PAGE_SIZE;
+  KERNEL_ASSERT(i >= pagepool_static_end && i < pagepool_num_pages);
 
-  /* A page allocated by kmalloc should not be freed. */
-  KERNEL_ASSERT(i >= pagepool_static_end);
+  intr_status = _interrupt_disable();
+
+  /* The count is dropped under the lock, since another holder of the page
+     may be dropping its reference at the same time.  Only the page that lost
+     its last reference goes to the magazine, under the magazine's own
+     lock. */
+  spinlock_acquire(&pagepool_slock);
+  KERNEL_ASSERT(pagepool_refcounts[i] > 0);
+  last = --pagepool_refcounts[i] == 0;
+  spinlock_release(&pagepool_slock);
+
+  if (last) {
+    pagepool_magazine_put(i);
+  }
+
+  _interrupt_set_state(intr_status);
+}
+
+/**
+ * Drops a reference to each of the given pages, like
+ * pagepool_free_phys_page, but takes the pagepool lock only once. The
+ * array may be in one of the pages to be freed.
+ *
+ * @param phys_addrs Pages to be freed.
+ *
+ * @param count Number of pages in phys_addrs.
+ */
+void pagepool_free_phys_pages(uint32_t *phys_addrs, int count)
+{
+  interrupt_status_t intr_status;
+  int j;
 
   intr_status = _interrupt_disable();
   spinlock_acquire(&pagepool_slock);
 
-  /* Check that the page was reserved. */
-  KERNEL_ASSERT(bitmap_get(pagepool_free_pages, i) == 1);
+  for (j = 0; j < count; j++) {
+    pagepool_unref(phys_addrs[j] / PAGE_SIZE);
+  }
 
-  bitmap_set(pagepool_free_pages, i, 0);
-  pagepool_num_free_pages++;
+  spinlock_release(&pagepool_slock);
+  _interrupt_set_state(intr_status);
+}
 
+/**
+ * Adds a reference to given page, which must already be reserved. The
+ * page is then only freed after one more call to
+ * pagepool_free_phys_page.
+ *
+ * @param phys_addr Page to be shared.
+ */
+void pagepool_ref_phys_page(uint32_t phys_addr)
+{
+  interrupt_status_t intr_status;
+  int i;
+
+  i = phys_addr / PAGE_SIZE;
+  KERNEL_ASSERT(i >= pagepool_static_end && i < pagepool_num_pages);
+
+  intr_status = _interrupt_disable();
+  spinlock_acquire(&pagepool_slock);
+
+  KERNEL_ASSERT(pagepool_refcounts[i] > 0 && pagepool_refcounts[i] < 0xffff);
+  pagepool_refcounts[i]++;
+
+  spinlock_release(&pagepool_slock);
+  _interrupt_set_state(intr_status);
+}
+
+/**
+ * Returns the number of references to given page. The count is read
+ * under the pagepool lock, so that it is not torn by a concurrent
+ * update. A caller holding one of the references can rely on a count
+ * of 1 only if nobody else could add a reference meanwhile.
+ *
+ * @param phys_addr Page to look up.
+ */
+int pagepool_phys_page_refs(uint32_t phys_addr)
+{
+  interrupt_status_t intr_status;
+  int refs;
+
+  intr_status = _interrupt_disable();
+  spinlock_acquire(&pagepool_slock);
+  refs = pagepool_refcounts[phys_addr / PAGE_SIZE];
   spinlock_release(&pagepool_slock);
   _interrupt_set_state(intr_status);
+
+  return refs;
 }
 
 
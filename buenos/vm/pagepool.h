@@ -38,13 +38,48 @@
 #define BUENOS_VM_PAGEPOOL_H
 
 #include "lib/libc.h"
+#include "kernel/spinlock.h"
 
 #define ADDR_PHYS_TO_KERNEL(addr) ((addr) | 0x80000000)
 #define ADDR_KERNEL_TO_PHYS(addr) ((addr) & 0x7fffffff)
 
+/* Largest block pagepool_get_phys_block can allocate is 2^10 pages (4 MB). */
+#define PAGEPOOL_MAX_ORDER 10
+
+/* Free pages cached by one CPU in front of the global free lists.  A CPU
+   allocates from and frees to its own magazine without taking the pagepool
+   lock, and moves PAGEPOOL_MAGAZINE_BATCH pages at a time between the
+   magazine and the free lists when it runs empty or full.  The magazine has a
+   lock of its own, which other CPUs only take to empty it when the free lists
+   run out. */
+#define PAGEPOOL_MAGAZINE_SIZE 16
+#define PAGEPOOL_MAGAZINE_BATCH 8
+
+typedef struct {
+  spinlock_t slock;
+  int count;
+  uint32_t pages[PAGEPOOL_MAGAZINE_SIZE];
+
+  /* Statistics. */
+  uint32_t hits;
+  uint32_t refills;
+  uint32_t drains;
+} pagepool_magazine_t;
+
+/* Pages kept zeroed ahead of demand for pagepool_get_zeroed_phys_page,
+   and the most an idle CPU zeroes on each interrupt. */
+#define PAGEPOOL_ZEROED_MAX 32
+#define PAGEPOOL_ZERO_BATCH 2
 
 void pagepool_init(void);
 uint32_t pagepool_get_phys_page(void);
+uint32_t pagepool_get_zeroed_phys_page(void);
+void pagepool_zero_idle(void);
+uint32_t pagepool_get_phys_block(int order);
+void pagepool_free_phys_block(uint32_t phys_addr, int order);
 void pagepool_free_phys_page(uint32_t phys_addr);
+void pagepool_free_phys_pages(uint32_t *phys_addrs, int count);
+void pagepool_ref_phys_page(uint32_t phys_addr);
+int pagepool_phys_page_refs(uint32_t phys_addr);
 
 #endif /* BUENOS_VM_PAGEPOOL_H */
@@ -37,21 +37,80 @@
 #ifndef BUENOS_VM_PAGETABLE_H
 #define BUENOS_VM_PAGETABLE_H
 
+/* Pagetables are two-level radix trees indexed by VPN2, the number of
+   the 8 KiB page pair that a TLB entry maps.  The upper bits of VPN2 select
+   a leaf in the pagetable's directory, and the lower bits an entry in the
+   leaf.  Together they cover all of kuseg. */
+#define PAGETABLE_LEAF_BITS 9
+#define PAGETABLE_LEAF_ENTRIES (1 << PAGETABLE_LEAF_BITS)
+#define PAGETABLE_LEAVES (1 << (18 - PAGETABLE_LEAF_BITS))
+
+/* Index of the leaf and of the entry in the leaf for a virtual address. */
+#define PAGETABLE_LEAF_INDEX(vaddr) ((vaddr) >> (13 + PAGETABLE_LEAF_BITS))
+#define PAGETABLE_ENTRY_INDEX(vaddr) \
+  (((vaddr) >> 13) & (PAGETABLE_LEAF_ENTRIES - 1))
+
+/* Byte offset of the leaves in pagetable_t, and size of a leaf entry.  The
+   TLB refill handler in vm/_tlb.S walks the tree using these. */
+#define PAGETABLE_LEAVES_OFFSET 4
+#define PAGETABLE_ENTRY_SHIFT 3
+
+#ifndef __ASSEMBLER__
+
 #include "lib/libc.h"
+#include "kernel/config.h"
 #include "vm/tlb.h"
 
-/* Number of mapping entries in one pagetable. This is the number
-   of entries that fits on a single hardware memory page (4k). */
-#define PAGETABLE_ENTRIES 340
+/* A leaf entry: the two EntryLo halves of a TLB entry, laid out exactly like
+   the last two words of tlb_entry_t.  EntryHi is implied by the position in
+   the tree and the ASID the pagetable has on the CPU. */
+typedef struct {
+  /* Set on a write-protected even page that is shared copy-on-write.  This
+     is the Fill bit of EntryLo, which the TLB ignores. */
+  unsigned int COW0:1     __attribute__ ((packed));
+  /* Set on an invalid even page that is swapped out.  PFN0 then holds its
+     swap slot, and the other bits are kept for when it is swapped in. */
+  unsigned int SWAP0:1    __attribute__ ((packed));
+  unsigned int dummy2:4   __attribute__ ((packed));
+  /* Physical page number for even page */
+  unsigned int PFN0:20    __attribute__ ((packed));
+  unsigned int C0:3       __attribute__ ((packed));
+  /* Dirty (writable) and valid bits for even page */
+  unsigned int D0:1       __attribute__ ((packed));
+  unsigned int V0:1       __attribute__ ((packed));
+  unsigned int G0:1       __attribute__ ((packed));
+
+  /* Copy-on-write and swapped out bits for odd page */
+  unsigned int COW1:1     __attribute__ ((packed));
+  unsigned int SWAP1:1    __attribute__ ((packed));
+  unsigned int dummy3:4   __attribute__ ((packed));
+  /* Physical page number for odd page */
+  unsigned int PFN1:20    __attribute__ ((packed));
+  unsigned int C1:3       __attribute__ ((packed));
+  /* Dirty (writable) and valid bits for odd page */
+  unsigned int D1:1       __attribute__ ((packed));
+  unsigned int V1:1       __attribute__ ((packed));
+  unsigned int G1:1       __attribute__ ((packed));
+} pagetable_entry_t;
+
+/* A leaf fills exactly one physical page (4k). */
+typedef struct {
+  pagetable_entry_t entries[PAGETABLE_LEAF_ENTRIES];
+} pagetable_leaf_t;
 
 /* A pagetable. This structure fits on one physical page (4k). */
 typedef struct pagetable_struct_t{
-  /* Address space identifier. We use Thread Ids in Buenos. */
-  uint32_t ASID;
-  /* Number of valid consecutive mappings in this pagetable. */
+  /* Number of valid page mappings in this pagetable. */
   uint32_t valid_count;
-  /* Actual virtual memory mapping entries*/
-  tlb_entry_t entries[PAGETABLE_ENTRIES];
+  /* Leaves of the tree, in kernel segment addresses.  NULL where no page
+     has ever been mapped. */
+  pagetable_leaf_t *leaves[PAGETABLE_LEAVES];
+  /* Address space identifier on each CPU: the hardware ASID in the low
+     8 bits, and the generation it was handed out in above them.  Zero if
+     none has been (see tlb_activate). */
+  uint32_t asid[CONFIG_MAX_CPUS];
 } pagetable_t;
 
+#endif /* __ASSEMBLER__ */
+
 #endif /* BUENOS_VM_PAGETABLE_H */
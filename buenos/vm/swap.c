@@ -0,0 +1,247 @@
+#include "vm/swap.h"
+#include "vm/pagepool.h"
+#include "drivers/device.h"
+#include "drivers/gbd.h"
+#include "drivers/yams.h"
+#include "drivers/bootargs.h"
+#include "fs/vfs.h"
+#include "kernel/semaphore.h"
+#include "kernel/spinlock.h"
+#include "kernel/interrupt.h"
+#include "kernel/assert.h"
+#include "kernel/panic.h"
+#include "lib/libc.h"
+
+/* The swap disk, or NULL if there is none. */
+static gbd_t *swap_disk;
+
+/* Disk blocks in one slot, and number of slots.  The slots are limited to
+   what one page of reference counts can track. */
+static uint32_t swap_blocks_per_slot;
+static int swap_num_slots;
+
+/* Number of references to each slot, zero for free slots. */
+static uint8_t *swap_refcounts;
+
+/* Where to start looking for a free slot. */
+static int swap_next_slot;
+
+/* Protects the reference counts. */
+static spinlock_t swap_slock;
+
+/* Held while a page is read from or written to the disk.  It is taken by
+   swap_reserve and held until the page is written, so that a page cannot be
+   read back before it is on the disk. */
+static semaphore_t *swap_io_sem;
+
+/* Statistics. */
+static uint32_t swap_writes;
+static uint32_t swap_reads;
+
+/**
+ * Initializes swapping on the disk given by the swapdisk boot
+ * argument, if any. A disk with a mounted filesystem is not used.
+ * Called once, after the devices are up and the filesystems mounted.
+ */
+void swap_init(void)
+{
+  char *arg = bootargs_get("swapdisk");
+  device_t *dev;
+  gbd_t *disk;
+  uint32_t block_size, page;
+
+  spinlock_reset(&swap_slock);
+  if (arg == NULL) {
+    return;
+  }
+
+  dev = device_get(YAMS_TYPECODE_DISK, atoi(arg));
+  if (dev == NULL || dev->generic_device == NULL) {
+    kprintf("Swap: no disk %s\n", arg);
+    return;
+  }
+  disk = (gbd_t *) dev->generic_device;
+  if (vfs_disk_mounted(disk)) {
+    kprintf("Swap: disk %s holds a mounted filesystem\n", arg);
+    return;
+  }
+
+  block_size = disk->block_size(disk);
+  if (block_size == 0 || PAGE_SIZE % block_size != 0) {
+    kprintf("Swap: unsupported block size %d\n", block_size);
+    return;
+  }
+  swap_blocks_per_slot = PAGE_SIZE / block_size;
+  swap_num_slots = MIN(disk->total_blocks(disk) / swap_blocks_per_slot,
+                       PAGE_SIZE);
+
+  page = pagepool_get_zeroed_phys_page();
+  swap_io_sem = semaphore_create(1);
+  if (page == 0 || swap_io_sem == NULL) {
+    kprintf("Swap: could not allocate memory\n");
+    return;
+  }
+  swap_refcounts = (uint8_t *) ADDR_PHYS_TO_KERNEL(page);
+  swap_next_slot = 0;
+
+  kprintf("Swap: %d pages on disk %s\n", swap_num_slots, arg);
+  swap_disk = disk;
+}
+
+/**
+ * Reserves a slot to write a page to, and takes the swap I/O lock.
+ * The lock is held until the page is written with swap_write, or the
+ * slot given back with swap_cancel. May block.
+ *
+ * @return The slot, or SWAP_NO_DISK or SWAP_FULL. The lock is not held
+ * if there was no slot.
+ */
+int swap_reserve(void)
+{
+  interrupt_status_t intr_status;
+  int i, slot = SWAP_FULL;
+
+  if (swap_disk == NULL) {
+    return SWAP_NO_DISK;
+  }
+
+  semaphore_P(swap_io_sem);
+
+  intr_status = _interrupt_disable();
+  spinlock_acquire(&swap_slock);
+  for (i = 0; i < swap_num_slots; i++) {
+    if (swap_refcounts[swap_next_slot] == 0) {
+      slot = swap_next_slot;
+      swap_refcounts[slot] = 1;
+      break;
+    }
+    swap_next_slot = (swap_next_slot + 1) % swap_num_slots;
+  }
+  spinlock_release(&swap_slock);
+  _interrupt_set_state(intr_status);
+
+  if (slot < 0) {
+    semaphore_V(swap_io_sem);
+  }
+  return slot;
+}
+
+/* Read or write the page at `phys_addr` from or to `slot`, one block at a
+   time.  The I/O lock must be held.  Returns 0, or SWAP_IO_ERROR. */
+static int swap_transfer(int slot, uint32_t phys_addr, bool write)
+{
+  gbd_request_t req;
+  uint32_t i, block_size = PAGE_SIZE / swap_blocks_per_slot;
+  int r;
+
+  for (i = 0; i < swap_blocks_per_slot; i++) {
+    req.block = slot * swap_blocks_per_slot + i;
+    req.buf = phys_addr + i * block_size;
+    req.sem = NULL;
+    if (write) {
+      r = swap_disk->write_block(swap_disk, &req);
+    } else {
+      r = swap_disk->read_block(swap_disk, &req);
+    }
+    if (r == 0) {
+      return SWAP_IO_ERROR;
+    }
+  }
+  return 0;
+}
+
+/**
+ * Writes a page to the slot reserved for it by swap_reserve, and
+ * releases the swap I/O lock. Blocks until the page is written.
+ *
+ * @param slot The reserved slot.
+ *
+ * @param phys_addr Page to write. It may be freed afterwards.
+ *
+ * @return 0, or SWAP_IO_ERROR. A slot that could not be written
+ * should not be freed, so that it stays reserved and is not used
+ * again.
+ */
+int swap_write(int slot, uint32_t phys_addr)
+{
+  int result;
+
+  KERNEL_ASSERT(slot >= 0 && slot < swap_num_slots);
+  result = swap_transfer(slot, phys_addr, true);
+  swap_writes++;
+  semaphore_V(swap_io_sem);
+  return result;
+}
+
+/**
+ * Gives back a slot reserved by swap_reserve without writing to it,
+ * and releases the swap I/O lock.
+ *
+ * @param slot The reserved slot.
+ */
+void swap_cancel(int slot)
+{
+  swap_free(slot);
+  semaphore_V(swap_io_sem);
+}
+
+/**
+ * Reads a page back from a slot. Blocks until the page is read, and
+ * until any write to the slot has finished. Does not free the slot.
+ *
+ * @param slot Slot to read.
+ *
+ * @param phys_addr Page to read into.
+ *
+ * @return 0, or SWAP_IO_ERROR.
+ */
+int swap_read(int slot, uint32_t phys_addr)
+{
+  int result;
+
+  KERNEL_ASSERT(slot >= 0 && slot < swap_num_slots);
+  semaphore_P(swap_io_sem);
+  result = swap_transfer(slot, phys_addr, false);
+  swap_reads++;
+  semaphore_V(swap_io_sem);
+  return result;
+}
+
+/**
+ * Adds a reference to a slot in use, when a pagetable entry pointing
+ * to it is copied.
+ *
+ * @param slot Slot to share.
+ */
+void swap_ref(int slot)
+{
+  interrupt_status_t intr_status;
+
+  KERNEL_ASSERT(slot >= 0 && slot < swap_num_slots);
+
+  intr_status = _interrupt_disable();
+  spinlock_acquire(&swap_slock);
+  KERNEL_ASSERT(swap_refcounts[slot] > 0 && swap_refcounts[slot] < 0xff);
+  swap_refcounts[slot]++;
+  spinlock_release(&swap_slock);
+  _interrupt_set_state(intr_status);
+}
+
+/**
+ * Drops a reference to a slot, and frees it if it was the last one.
+ *
+ * @param slot Slot to free.
+ */
+void swap_free(int slot)
+{
+  interrupt_status_t intr_status;
+
+  KERNEL_ASSERT(slot >= 0 && slot < swap_num_slots);
+
+  intr_status = _interrupt_disable();
+  spinlock_acquire(&swap_slock);
+  KERNEL_ASSERT(swap_refcounts[slot] > 0);
+  swap_refcounts[slot]--;
+  spinlock_release(&swap_slock);
+  _interrupt_set_state(intr_status);
+}
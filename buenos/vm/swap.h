@@ -0,0 +1,25 @@
+#ifndef BUENOS_VM_SWAP_H
+#define BUENOS_VM_SWAP_H
+
+#include "lib/types.h"
+
+/* User pages can be written out to a swap disk when memory runs out.  The
+   disk is given with the swapdisk boot argument, as the number of a disk
+   device, and must not hold a mounted filesystem.  It is divided into page-sized
+   slots; a slot is shared like a page when a process with swapped out pages
+   forks, and freed when its last reference is dropped. */
+
+/* Error codes. */
+#define SWAP_NO_DISK -1
+#define SWAP_FULL -2
+#define SWAP_IO_ERROR -3
+
+void swap_init(void);
+int swap_reserve(void);
+int swap_write(int slot, uint32_t phys_addr);
+void swap_cancel(int slot);
+int swap_read(int slot, uint32_t phys_addr);
+void swap_ref(int slot);
+void swap_free(int slot);
+
+#endif /* BUENOS_VM_SWAP_H */
@@ -40,7 +40,57 @@
 #include "vm/tlb.h"
 #include "vm/pagetable.h"
 #include "kernel/thread.h"
+#include "kernel/interrupt.h"
+#include "kernel/config.h"
+#include "kernel/percpu.h"
+#include "kernel/spinlock.h"
+#include "drivers/device.h"
+#include "drivers/metadev.h"
+#include "drivers/yams.h"
 #include "lib/libc.h"
+#include "lib/bitmap.h"
+
+/* Number of distinct hardware ASIDs.  ASID 0 is used by threads without an
+   address space, and the others are handed out to pagetables. */
+#define TLB_ASID_BITS 8
+#define TLB_ASID_COUNT (1 << TLB_ASID_BITS)
+
+/* ASID allocation state of one CPU.  Each CPU hands out its hardware ASIDs to
+   pagetables as they are activated on it.  An ASID that its pagetable gives
+   up, because the pagetable is destroyed or its entries invalidated, is
+   retired: its entries may still be in the TLB, so it is only handed out
+   again after they have been purged.  That is done for all retired ASIDs at
+   once, when the CPU runs out of free ones.  If none are retired either, a
+   new generation starts: the TLB is flushed, and every ASID handed out in an
+   earlier generation becomes stale, to be replaced by a fresh one when its
+   pagetable is next activated.  The TLB is thus not flushed on context
+   switches. */
+typedef struct {
+  /* Protects the sets below and the shootdown requests.  Taken by this CPU
+     when it activates a pagetable, and by any CPU retiring one of its
+     ASIDs. */
+  spinlock_t slock;
+  /* Current generation, starting from 1, or 0 before the first activation
+     on this CPU. */
+  uint32_t generation;
+  /* Hardware ASIDs handed out in this generation and not yet purged.  ASID 0
+     is always in the set. */
+  bitmap_t used[TLB_ASID_COUNT / 32];
+  /* ASIDs retired in this generation, whose entries are yet to be purged. */
+  bitmap_t retired[TLB_ASID_COUNT / 32];
+
+  /* Number of the last shootdown requested of this CPU, and of the last one
+     it has done (see tlb_shootdown). */
+  uint32_t shootdowns_requested;
+  volatile uint32_t shootdowns_done;
+
+  /* Statistics. */
+  uint32_t flushes;
+  uint32_t rollovers;
+  uint32_t purges;
+} tlb_asid_state_t;
+
+static tlb_asid_state_t tlb_asid_state[CONFIG_MAX_CPUS];
 
 static void tlb_error(bool is_userland, char* msg)
 {
@@ -57,45 +107,87 @@ static void tlb_error(bool is_userland, char* msg)
   }
 }
 
-void tlb_modified_exception(bool is_userland)
+/* Write the pagetable entry for the page pair of the exception address to the
+   TLB.  The refill handler may have put an invalid or write-protected entry
+   for it there already.  Replace it if so, or else place the entry somewhere
+   in TLB. */
+static void tlb_update(pagetable_t *ptable, tlb_exception_state_t *tes)
 {
-  tlb_error(is_userland, "TLB modified exception.");
+  pagetable_entry_t *pentry;
+  tlb_entry_t entry;
+  uint32_t asid;
+  int index;
+
+  /* The ASID of this CPU, which the thread may have moved to while the page
+     was read in.  Another CPU may have taken it away meanwhile, and the
+     entry would then go in with ASID 0, which the threads without a
+     pagetable run with.  The pagetable gets a fresh ASID when it is next
+     activated here, and the access just faults again. */
+  asid = ptable->asid[_interrupt_getcpu()];
+  if (asid == 0) {
+    return;
+  }
+
+  pentry = vm_lookup(ptable, tes->badvaddr);
+  KERNEL_ASSERT(pentry != NULL);
+
+  entry.VPN2 = tes->badvpn2;
+  entry.dummy1 = 0;
+  entry.ASID = asid & (TLB_ASID_COUNT - 1);
+  memcopy(sizeof(pagetable_entry_t), (uint32_t*) &entry + 1, pentry);
+  index = _tlb_probe(&entry);
+  if (index >= 0) {
+    _tlb_write(&entry, index, 1);
+  } else {
+    _tlb_write_random(&entry);
+  }
 }
 
-/* Get valid bit from TLB entry corresponding to the given virtual address. */
-static bool tlb_entry_is_valid(tlb_entry_t* entry, uint32_t vaddr)
+void tlb_modified_exception(bool is_userland)
 {
-  if (ADDR_IS_ON_ODD_PAGE(vaddr)) {
-    return entry->V1;
-  } else {
-    return entry->V0;
+  tlb_exception_state_t tes;
+  _tlb_get_exception_state(&tes);
+
+  pagetable_t *ptable = thread_get_current_thread_entry()->pagetable;
+  if (ptable == NULL || tes.badvaddr >= 0x80000000 ||
+      !process_copy_on_write(tes.badvaddr)) {
+    tlb_error(is_userland, "TLB modified exception.");
+    return;
   }
+  tlb_update(ptable, &tes);
 }
 
 static void tlb_access_exception(bool is_userland)
 {
   tlb_exception_state_t tes;
+  pagetable_entry_t *pentry;
   _tlb_get_exception_state(&tes);
 
   pagetable_t *ptable = thread_get_current_thread_entry()->pagetable;
   if(ptable == NULL) {
     tlb_error(is_userland, "No pagetable associated with current thread.");
+    return;
   }
-  for (uint32_t i = 0; i < ptable->valid_count; i++) {
-    tlb_entry_t *entry = &ptable->entries[i];
-    if (entry->VPN2 == tes.badvpn2) {
-      /* The virtual address matches a page's virtual address. */
-      if (tlb_entry_is_valid(entry, tes.badvaddr)) {
-        /* Place matching TLB entry somewhere in TLB. */
-        _tlb_write_random(&ptable->entries[i]);
-        return;
-      }
-      else {
-        tlb_error(is_userland, "Found an invalid TLB entry while handling a TLB miss exception.");
-      }
+  if(tes.badvaddr >= 0x80000000) {
+    tlb_error(is_userland, "TLB miss outside of user address space.");
+    return;
+  }
+
+  pentry = vm_lookup(ptable, tes.badvaddr);
+  if (pentry == NULL ||
+      !(ADDR_IS_ON_ODD_PAGE(tes.badvaddr) ? pentry->V1 : pentry->V0)) {
+    /* Pages are mapped on first touch.  Reading one from the executable may
+       block, which is only allowed if the faulting code ran with interrupts
+       enabled. */
+    thread_table_t *thread = thread_get_current_thread_entry();
+    bool may_block = is_userland ||
+      (thread->context->status & INTERRUPT_MASK_MASTER);
+    if (!process_demand_page(tes.badvaddr, may_block)) {
+      tlb_error(is_userland, "Access to an unmapped page.");
+      return;
     }
   }
-  KERNEL_PANIC("Page not found in pagetable.");
+  tlb_update(ptable, &tes);
 }
 
 void tlb_load_exception(bool is_userland)
@@ -107,3 +199,309 @@ void tlb_store_exception(bool is_userland)
 {
   tlb_access_exception(is_userland);
 }
+
+/* Invalidate every entry in the TLB of the calling CPU.  Each slot gets a
+   distinct kernel segment VPN2, which is never looked up in the TLB, so that no
+   two entries match the same address. */
+void tlb_flush(void)
+{
+  tlb_entry_t entry;
+  uint32_t i, max;
+
+  memoryset(&entry, 0, sizeof(entry));
+  max = _tlb_get_maxindex();
+  for (i = 0; i <= max; i++) {
+    entry.VPN2 = (0x80000000 >> 13) + i;
+    _tlb_write(&entry, i, 1);
+  }
+  tlb_asid_state[_interrupt_getcpu()].flushes++;
+}
+
+/* Remove the entries tagged with a retired ASID from the TLB of the calling
+   CPU, and make those ASIDs free to be handed out again.  Returns false if
+   none were retired.  The CPU's state lock is held. */
+static bool tlb_purge_retired(tlb_asid_state_t *state)
+{
+  tlb_entry_t entry;
+  uint32_t i, max;
+
+  if (bitmap_count(state->retired, TLB_ASID_COUNT) == 0) {
+    return false;
+  }
+
+  max = _tlb_get_maxindex();
+  for (i = 0; i <= max; i++) {
+    _tlb_read(&entry, i, 1);
+    if (bitmap_get(state->retired, entry.ASID)) {
+      /* Overwrite it like tlb_flush does. */
+      memoryset(&entry, 0, sizeof(entry));
+      entry.VPN2 = (0x80000000 >> 13) + i;
+      _tlb_write(&entry, i, 1);
+    }
+  }
+  for (i = 0; i < TLB_ASID_COUNT / 32; i++) {
+    state->used[i] &= ~state->retired[i];
+    state->retired[i] = 0;
+  }
+  state->purges++;
+  return true;
+}
+
+/* Hand out an ASID of the calling CPU, purging the retired ones or starting a
+   new generation if there are no free ones.  The CPU's state lock is held. */
+static uint32_t tlb_new_asid(tlb_asid_state_t *state)
+{
+  int asid = -1;
+
+  if (state->generation != 0) {
+    asid = bitmap_findnset(state->used, TLB_ASID_COUNT);
+    if (asid < 0 && tlb_purge_retired(state)) {
+      asid = bitmap_findnset(state->used, TLB_ASID_COUNT);
+    }
+  }
+  if (asid < 0) {
+    /* Out of ASIDs, or the first activation on this CPU. */
+    tlb_flush();
+    state->generation++;
+    bitmap_init(state->used, TLB_ASID_COUNT);
+    bitmap_init(state->retired, TLB_ASID_COUNT);
+    bitmap_set(state->used, 0, 1);
+    state->rollovers++;
+    asid = bitmap_findnset(state->used, TLB_ASID_COUNT);
+  }
+  return (state->generation << TLB_ASID_BITS) | asid;
+}
+
+/* Make `pagetable` the address space of the calling CPU, which is also where
+   the TLB refill handler looks up missing entries.  The pagetable keeps its
+   ASID, and so its TLB entries, for as long as the CPU stays in the same
+   generation and the ASID is not dropped; otherwise it gets a new one.  The
+   pagetable is made active and its ASID read under the CPU's state lock, so
+   that tlb_shootdown either drops the ASID before it is read, or sees the
+   pagetable active here.  Must be called with interrupts disabled. */
+void tlb_activate(pagetable_t *pagetable)
+{
+  int cpu = _interrupt_getcpu();
+  tlb_asid_state_t *state = &tlb_asid_state[cpu];
+  uint32_t asid;
+
+  spinlock_acquire(&state->slock);
+  percpu_area[cpu].pagetable = pagetable;
+  asid = pagetable->asid[cpu];
+  if (asid == 0 || asid >> TLB_ASID_BITS != state->generation) {
+    asid = tlb_new_asid(state);
+    pagetable->asid[cpu] = asid;
+  }
+  spinlock_release(&state->slock);
+  _tlb_set_asid(asid & (TLB_ASID_COUNT - 1));
+}
+
+/* Take the ASID on `cpu` away from `pagetable`.  An ASID of the current
+   generation of the CPU is retired, so that its entries are purged before it
+   is handed out again; older ones were flushed already.  The ASID is read and
+   retired under the CPU's state lock, so that it cannot be retired twice.  The
+   CPU may still be running the pagetable with the ASID, but it only hands the
+   ASID out again when it switches to another address space.  If it is, and
+   `shootdown` is not NULL, a shootdown is requested of the CPU and its number
+   stored in `shootdown`.  Returns whether one was. */
+static bool tlb_drop_asid(pagetable_t *pagetable, int cpu, uint32_t *shootdown)
+{
+  tlb_asid_state_t *state = &tlb_asid_state[cpu];
+  interrupt_status_t intr_status;
+  uint32_t asid;
+  bool requested = false;
+
+  intr_status = _interrupt_disable();
+  spinlock_acquire(&state->slock);
+  asid = pagetable->asid[cpu];
+  pagetable->asid[cpu] = 0;
+  if (asid != 0 && asid >> TLB_ASID_BITS == state->generation) {
+    bitmap_set(state->retired, asid & (TLB_ASID_COUNT - 1), 1);
+  }
+  if (shootdown != NULL && percpu_area[cpu].pagetable == pagetable) {
+    *shootdown = ++state->shootdowns_requested;
+    requested = true;
+  }
+  spinlock_release(&state->slock);
+  _interrupt_set_state(intr_status);
+  return requested;
+}
+
+/* Drop the ASIDs of `pagetable` on every CPU, so that the TLB entries made
+   from it are no longer used, and each CPU gives it a fresh ASID the next
+   time it activates it.  The old entries linger, unreachable, until their
+   ASIDs are purged or the next generation flushes them.  Used after
+   write-protecting pages of a live pagetable. */
+void tlb_invalidate(pagetable_t *pagetable)
+{
+  for (int cpu = 0; cpu < CONFIG_MAX_CPUS; cpu++) {
+    tlb_drop_asid(pagetable, cpu, NULL);
+  }
+}
+
+/* Like tlb_invalidate, but also make the CPUs that are running `pagetable`
+   switch to a fresh ASID, and wait for them to do so.  On return, no TLB
+   holds an entry made from the pagetable before the call that can still be
+   used, so pages unmapped or write-protected in it before the call may be
+   freed or shared.  The other CPUs are interrupted through their CPU status
+   devices, and handle the request in tlb_shootdown_handle.  Must be called
+   with interrupts enabled and no spinlocks held, since the CPUs waited for
+   may be waiting for a spinlock or a shootdown as well. */
+void tlb_shootdown(pagetable_t *pagetable)
+{
+  interrupt_status_t intr_status;
+  uint32_t shootdown[CONFIG_MAX_CPUS];
+  bool requested[CONFIG_MAX_CPUS];
+  int this_cpu;
+
+  intr_status = _interrupt_disable();
+  KERNEL_ASSERT(intr_status & INTERRUPT_MASK_MASTER);
+  this_cpu = _interrupt_getcpu();
+  for (int cpu = 0; cpu < CONFIG_MAX_CPUS; cpu++) {
+    requested[cpu] = tlb_drop_asid(pagetable, cpu,
+                                   cpu == this_cpu ? NULL : &shootdown[cpu]);
+    if (requested[cpu]) {
+      cpustatus_generate_irq(device_get(YAMS_TYPECODE_CPUSTATUS | cpu, 0));
+    }
+  }
+  if (percpu_area[this_cpu].pagetable == pagetable) {
+    tlb_activate(pagetable);
+  }
+  _interrupt_set_state(intr_status);
+
+  for (int cpu = 0; cpu < CONFIG_MAX_CPUS; cpu++) {
+    while (requested[cpu] &&
+           (int32_t)(tlb_asid_state[cpu].shootdowns_done - shootdown[cpu]) < 0) {
+      /* Spin with interrupts enabled, handling any shootdown requested of
+         this CPU meanwhile. */
+    }
+  }
+}
+
+/* Do the shootdowns requested of the calling CPU: switch the active
+   pagetable to a fresh ASID if tlb_shootdown dropped its old one.  Called by
+   the interrupt handler of the CPU status device, with interrupts
+   disabled. */
+void tlb_shootdown_handle(void)
+{
+  int cpu = _interrupt_getcpu();
+  tlb_asid_state_t *state = &tlb_asid_state[cpu];
+  pagetable_t *pagetable;
+  uint32_t requested;
+
+  spinlock_acquire(&state->slock);
+  requested = state->shootdowns_requested;
+  pagetable = percpu_area[cpu].pagetable;
+  spinlock_release(&state->slock);
+
+  if (pagetable != NULL) {
+    tlb_activate(pagetable);
+  }
+  state->shootdowns_done = requested;
+}
+
+/* Remove the entry for the page pair of `vaddr` in `pagetable` from the TLB of
+   the calling CPU.  Returns whether there was one.  Must be called with
+   interrupts disabled. */
+static bool tlb_remove(pagetable_t *pagetable, uint32_t vaddr)
+{
+  int cpu = _interrupt_getcpu();
+  uint32_t asid = pagetable->asid[cpu];
+  tlb_exception_state_t tes;
+  tlb_entry_t entry;
+  int index;
+
+  if (asid == 0 || asid >> TLB_ASID_BITS != tlb_asid_state[cpu].generation) {
+    /* The TLB holds nothing tagged with a current ASID of the pagetable. */
+    return false;
+  }
+
+  /* Probing overwrites EntryHi, so remember the ASID in it. */
+  _tlb_get_exception_state(&tes);
+
+  memoryset(&entry, 0, sizeof(entry));
+  entry.VPN2 = vaddr >> 13;
+  entry.ASID = asid & (TLB_ASID_COUNT - 1);
+  index = _tlb_probe(&entry);
+  if (index >= 0) {
+    /* Overwrite it like tlb_flush does. */
+    memoryset(&entry, 0, sizeof(entry));
+    entry.VPN2 = (0x80000000 >> 13) + index;
+    _tlb_write(&entry, index, 1);
+  }
+
+  _tlb_set_asid(tes.asid);
+  return index >= 0;
+}
+
+/* Whether the page at `vaddr` in `pagetable` has been used on this CPU since
+   the last call, as far as the TLB tells: its entry is removed, so that it is
+   only found again if the page is touched in the meantime.  This is the
+   reference bit of the page replacement clock.  Must be called with interrupts
+   disabled. */
+bool tlb_referenced(pagetable_t *pagetable, uint32_t vaddr)
+{
+  return tlb_remove(pagetable, vaddr);
+}
+
+/* Remove the page at `vaddr` in `pagetable` from the TLB of this CPU, and drop
+   the ASIDs of the pagetable on the others, which may still hold the page.
+   That only helps on the CPUs that are not running the pagetable, which is
+   checked under each CPU's state lock, like tlb_activate makes it active.
+   Returns false if another CPU is running it, and may still use the page
+   through its TLB.  Used after unmapping or write-protecting a page without
+   a shootdown.  Must be called with interrupts disabled. */
+bool tlb_evict(pagetable_t *pagetable, uint32_t vaddr)
+{
+  int this_cpu = _interrupt_getcpu();
+  tlb_asid_state_t *state;
+  uint32_t asid;
+  bool evicted = true;
+
+  tlb_remove(pagetable, vaddr);
+  for (int cpu = 0; cpu < CONFIG_MAX_CPUS; cpu++) {
+    if (cpu == this_cpu) {
+      continue;
+    }
+    state = &tlb_asid_state[cpu];
+    spinlock_acquire(&state->slock);
+    if (percpu_area[cpu].pagetable == pagetable) {
+      evicted = false;
+    } else {
+      asid = pagetable->asid[cpu];
+      pagetable->asid[cpu] = 0;
+      if (asid != 0 && asid >> TLB_ASID_BITS == state->generation) {
+        bitmap_set(state->retired, asid & (TLB_ASID_COUNT - 1), 1);
+      }
+    }
+    spinlock_release(&state->slock);
+  }
+  return evicted;
+}
+
+/* Whether `pagetable` is the active address space of another CPU than the
+   calling one.  Only a hint, since another CPU may activate it right after;
+   see tlb_evict. */
+bool tlb_active_elsewhere(pagetable_t *pagetable)
+{
+  int this_cpu = _interrupt_getcpu();
+
+  for (int cpu = 0; cpu < CONFIG_MAX_CPUS; cpu++) {
+    if (cpu != this_cpu && percpu_area[cpu].pagetable == pagetable) {
+      return true;
+    }
+  }
+  return false;
+}
+
+/* Drop the ASIDs of `pagetable`, and forget it as the active address space on
+   every CPU, so that the refill handler no longer walks it. */
+void tlb_forget(pagetable_t *pagetable)
+{
+  tlb_invalidate(pagetable);
+  for (int cpu = 0; cpu < CONFIG_MAX_CPUS; cpu++) {
+    if (percpu_area[cpu].pagetable == pagetable) {
+      percpu_area[cpu].pagetable = NULL;
+    }
+  }
+}
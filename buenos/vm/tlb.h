@@ -50,7 +50,8 @@ typedef struct {
   unsigned int VPN2:19    __attribute__ ((packed));
   unsigned int dummy1:5   __attribute__ ((packed));
   /* Address space identifier. When ASID matches CP0 setted ASID
-     this entry is valid. In Buenos, we use mapping ASID = Thread Id. */
+     this entry is valid. In Buenos, ASIDs are handed out to pagetables
+     by each CPU (see tlb_activate). */
   unsigned int ASID:8     __attribute__ ((packed));
 
   unsigned int dummy2:6   __attribute__ ((packed));
@@ -108,5 +109,21 @@ int _tlb_read(tlb_entry_t *entries, uint32_t index, uint32_t num);
 int _tlb_write(tlb_entry_t *entries, uint32_t index, uint32_t num);
 void _tlb_write_random(tlb_entry_t *entry);
 
+/* The TLB refill handler, copied to the refill vector by interrupt_init.
+   These only mark its start and end. */
+void _tlb_refill_code(void);
+void _tlb_refill_code_end(void);
+
+/* TLB management */
+void tlb_flush(void);
+void tlb_activate(struct pagetable_struct_t *pagetable);
+void tlb_invalidate(struct pagetable_struct_t *pagetable);
+void tlb_shootdown(struct pagetable_struct_t *pagetable);
+void tlb_shootdown_handle(void);
+void tlb_forget(struct pagetable_struct_t *pagetable);
+bool tlb_referenced(struct pagetable_struct_t *pagetable, uint32_t vaddr);
+bool tlb_evict(struct pagetable_struct_t *pagetable, uint32_t vaddr);
+bool tlb_active_elsewhere(struct pagetable_struct_t *pagetable);
+
 
 #endif /* BUENOS_VM_TLB_H */
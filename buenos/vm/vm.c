@@ -37,6 +37,8 @@
 #include "vm/pagetable.h"
 #include "vm/vm.h"
 #include "vm/pagepool.h"
+#include "vm/pagecache.h"
+#include "vm/swap.h"
 #include "kernel/kmalloc.h"
 #include "kernel/assert.h"
 
@@ -62,21 +64,28 @@ void vm_init(void)
      in this form. */
   KERNEL_ASSERT(sizeof(tlb_entry_t) == 12);
 
+  /* Pagetable leaves must fill a page exactly, and the directory must fit
+     on one.  The TLB refill handler in vm/_tlb.S hardcodes the layout. */
+  KERNEL_ASSERT(sizeof(pagetable_entry_t) == 1 << PAGETABLE_ENTRY_SHIFT);
+  KERNEL_ASSERT(sizeof(pagetable_leaf_t) == PAGE_SIZE);
+  KERNEL_ASSERT(sizeof(pagetable_t) <= PAGE_SIZE);
+  KERNEL_ASSERT((uint32_t) &((pagetable_t *) 0)->leaves
+                == PAGETABLE_LEAVES_OFFSET);
+
   pagepool_init();
+  pagecache_init();
   kmalloc_disable();
 }
 
 /**
- *  Creates a new page table. Reserves memory (one page) for the table
- *  and sets the address space identifier for the created page table.
- *
- *  @param asid Address space identifier
+ *  Creates a new page table. Reserves memory (one page) for the table.
+ *  Its address space identifiers are assigned by tlb_activate.
  *
  *  @return The created page table
  *
  */
 
-pagetable_t *vm_create_pagetable(uint32_t asid)
+pagetable_t *vm_create_pagetable(void)
 {
   pagetable_t *table;
   uint32_t addr;
@@ -92,15 +101,18 @@ pagetable_t *vm_create_pagetable(uint32_t asid)
      physical memory. */
   table = (pagetable_t *) (ADDR_PHYS_TO_KERNEL(addr));
 
-  table->ASID        = asid;
   table->valid_count = 0;
+  memoryset(table->leaves, 0, sizeof(table->leaves));
+  memoryset(table->asid, 0, sizeof(table->asid));
 
   return table;
 }
 
 /**
- * Destroys given pagetable. Frees the memory (one page) allocated for
- * the pagetable. Does not remove mappings from the TLB.
+ * Destroys given pagetable. Frees the memory allocated for the
+ * pagetable and its leaves, and drops the references to the mapped
+ * pages and swap slots. Does not remove mappings from the TLB, but makes sure
+ * they are flushed before its ASID is used by another pagetable.
  *
  * @param pagetable Page table to destroy
  *
@@ -108,7 +120,110 @@ pagetable_t *vm_create_pagetable(uint32_t asid)
 
 void vm_destroy_pagetable(pagetable_t *pagetable)
 {
-  pagepool_free_phys_page(ADDR_KERNEL_TO_PHYS((uint32_t) pagetable));
+  pagetable_leaf_t *leaf;
+  pagetable_entry_t entry;
+  uint32_t *pages;
+  int i, j, count, leaves;
+
+  tlb_forget(pagetable);
+
+  /* Free the mapped pages one leaf at a time.  Their addresses are gathered
+     at the start of the leaf itself, which never overwrites an entry that is
+     still to be read, since every entry is two words and holds at most two
+     pages. */
+  leaves = 0;
+  for (i = 0; i < PAGETABLE_LEAVES; i++) {
+    leaf = pagetable->leaves[i];
+    if (leaf == NULL) {
+      continue;
+    }
+    pages = (uint32_t *) leaf;
+    count = 0;
+    for (j = 0; j < PAGETABLE_LEAF_ENTRIES; j++) {
+      entry = leaf->entries[j];
+      if (entry.V0) {
+        pages[count++] = entry.PFN0 << 12;
+      } else if (entry.SWAP0) {
+        swap_free(entry.PFN0);
+      }
+      if (entry.V1) {
+        pages[count++] = entry.PFN1 << 12;
+      } else if (entry.SWAP1) {
+        swap_free(entry.PFN1);
+      }
+    }
+    pagepool_free_phys_pages(pages, count);
+
+    /* Likewise gather the leaves in the directory. */
+    ((uint32_t *) pagetable->leaves)[leaves++] =
+      ADDR_KERNEL_TO_PHYS((uint32_t) leaf);
+  }
+
+  /* The directory has room for one more address after the leaves. */
+  pages = (uint32_t *) pagetable->leaves;
+  pages[leaves++] = ADDR_KERNEL_TO_PHYS((uint32_t) pagetable);
+  pagepool_free_phys_pages(pages, leaves);
+}
+
+/**
+ * Finds the leaf entry covering given virtual address.
+ *
+ * @param pagetable Pagetable to look in
+ *
+ * @param vaddr Virtual address in kuseg
+ *
+ * @return The entry, or NULL if no page in its leaf has been mapped.
+ */
+pagetable_entry_t *vm_lookup(pagetable_t *pagetable, uint32_t vaddr)
+{
+  pagetable_leaf_t *leaf;
+
+  KERNEL_ASSERT(vaddr < 0x80000000);
+
+  leaf = pagetable->leaves[PAGETABLE_LEAF_INDEX(vaddr)];
+  if (leaf == NULL) {
+    return NULL;
+  }
+  return &leaf->entries[PAGETABLE_ENTRY_INDEX(vaddr)];
+}
+
+/* Find the leaf entry covering `vaddr`, creating its leaf if needed.  Returns
+   NULL if there is no memory for the leaf. */
+static pagetable_entry_t *vm_lookup_create(pagetable_t *pagetable,
+                                           uint32_t vaddr)
+{
+  pagetable_leaf_t *leaf;
+  uint32_t addr;
+
+  KERNEL_ASSERT(vaddr < 0x80000000);
+
+  leaf = pagetable->leaves[PAGETABLE_LEAF_INDEX(vaddr)];
+  if (leaf == NULL) {
+    /* First mapping in this part of the address space. */
+    addr = pagepool_get_zeroed_phys_page();
+    if (addr == 0) {
+      return NULL;
+    }
+    leaf = (pagetable_leaf_t *) ADDR_PHYS_TO_KERNEL(addr);
+    pagetable->leaves[PAGETABLE_LEAF_INDEX(vaddr)] = leaf;
+  }
+  return &leaf->entries[PAGETABLE_ENTRY_INDEX(vaddr)];
+}
+
+/**
+ * Creates the pagetable leaf covering given virtual address, if it
+ * is not there yet. Once created, a leaf stays until the pagetable
+ * is destroyed, so mapping a page in it cannot fail afterwards.
+ *
+ * @param pagetable Pagetable to create the leaf in
+ *
+ * @param vaddr Virtual address in kuseg
+ *
+ * @return 1 if the leaf is there, 0 if there was no memory for it.
+ */
+int vm_create_leaf(pagetable_t *pagetable, uint32_t vaddr)
+{
+  return vm_lookup_create(pagetable, vaddr) != NULL;
 }
 
 /**
@@ -127,91 +242,138 @@ void vm_destroy_pagetable(pagetable_t *pagetable)
  * page is not dirty (write-protected). The terminology comes
  * from hardware, in reality, this is write enabling bit.
  *
+ * @return 1 if the page was mapped, 0 if there was no memory for
+ * the pagetable leaf it goes in. The page is not referenced then.
  */
-
-void vm_map(pagetable_t *pagetable,
-            uint32_t physaddr,
-            uint32_t vaddr,
-            int dirty)
+int vm_map(pagetable_t *pagetable,
+           uint32_t physaddr,
+           uint32_t vaddr,
+           int dirty)
 {
-  unsigned int i;
+  pagetable_entry_t *entry;
 
   KERNEL_ASSERT(dirty == 0 || dirty == 1);
 
-  for(i=0; i<pagetable->valid_count; i++) {
-    if(pagetable->entries[i].VPN2 == (vaddr >> 13)) {
-      /* TLB has separate mappings for even and odd
-         virtual pages. Let's handle them separately here,
-         and we have much more fun when updating the TLB later.*/
-      if(ADDR_IS_ON_EVEN_PAGE(vaddr)) {
-        if(pagetable->entries[i].V0 == 1) {
-          KERNEL_PANIC("Tried to re-map same virtual page");
-        } else {
-          /* Map the page on a pair entry */
-          pagetable->entries[i].PFN0 = physaddr >> 12;
-          pagetable->entries[i].V0 = 1;
-          pagetable->entries[i].G0 = 0;
-          pagetable->entries[i].D0 = dirty;
-          return;
-        }
-      } else {
-        if(pagetable->entries[i].V1 == 1) {
-          KERNEL_PANIC("Tried to re-map same virtual page");
-        } else {
-          /* Map the page on a pair entry */
-          pagetable->entries[i].PFN1 = physaddr >> 12;
-          pagetable->entries[i].V1 = 1;
-          pagetable->entries[i].G1 = 0;
-          pagetable->entries[i].D1 = dirty;
-          return;
-        }
-      }
-    }
-  }
-  /* No previous or pairing mapping was found */
-
-  /* Make sure that pagetable is not full */
-  if(pagetable->valid_count >= PAGETABLE_ENTRIES) {
-    kprintf("Thread with ASID=%d run out of pagetable mapping entries\n",
-            pagetable->ASID);
-    kprintf("during an attempt to map vaddr 0x%8.8x => phys 0x%8.8x.\n",
-            vaddr, physaddr);
-    KERNEL_PANIC("Thread run out of pagetable mapping entries.");
+  entry = vm_lookup_create(pagetable, vaddr);
+  if (entry == NULL) {
+    return 0;
   }
 
-  /* Map the page on a new entry */
-
-  pagetable->entries[pagetable->valid_count].VPN2 = vaddr >> 13;
-  pagetable->entries[pagetable->valid_count].ASID = pagetable->ASID;
-
+  /* TLB has separate mappings for even and odd virtual pages. Let's
+     handle them separately here, and we have much more fun when
+     updating the TLB later.*/
   if(ADDR_IS_ON_EVEN_PAGE(vaddr)) {
-    pagetable->entries[pagetable->valid_count].PFN0 = physaddr >> 12;
-    pagetable->entries[pagetable->valid_count].D0   = dirty;
-    pagetable->entries[pagetable->valid_count].V0   = 1;
-    pagetable->entries[pagetable->valid_count].G0   = 0;
-    pagetable->entries[pagetable->valid_count].V1   = 0;
+    if(entry->V0 == 1 || entry->SWAP0 == 1) {
+      KERNEL_PANIC("Tried to re-map same virtual page");
+    }
+    entry->PFN0 = physaddr >> 12;
+    entry->D0   = dirty;
+    entry->G0   = 0;
+    entry->V0   = 1;
   } else {
-    pagetable->entries[pagetable->valid_count].PFN1 = physaddr >> 12;
-    pagetable->entries[pagetable->valid_count].D1   = dirty;
-    pagetable->entries[pagetable->valid_count].V1   = 1;
-    pagetable->entries[pagetable->valid_count].G1   = 0;
-    pagetable->entries[pagetable->valid_count].V0   = 0;
+    if(entry->V1 == 1 || entry->SWAP1 == 1) {
+      KERNEL_PANIC("Tried to re-map same virtual page");
+    }
+    entry->PFN1 = physaddr >> 12;
+    entry->D1   = dirty;
+    entry->G1   = 0;
+    entry->V1   = 1;
   }
 
   pagetable->valid_count++;
+  return 1;
 }
 
 /**
- * Unmaps given virtual address from given pagetable.
+ * Unmaps given virtual address from given pagetable. If the page is
+ * swapped out, the reference to its swap slot is dropped. Otherwise
+ * the reference to the physical page mapped there passes to the
+ * caller, who drops it with pagepool_free_phys_page once no TLB can
+ * hold the page anymore. Does not modify TLB.
  *
  * @param pagetable Pagetable to operate on
  *
  * @param vaddr Virtual address to unmap
  *
+ * @return The physical page that was mapped, or 0 if it was swapped
+ * out.
  */
 
-void vm_unmap(UNUSED pagetable_t *pagetable, UNUSED uint32_t vaddr) {
-  /* Not implemented. */
+uint32_t vm_unmap(pagetable_t *pagetable, uint32_t vaddr)
+{
+  pagetable_entry_t *entry;
+  uint32_t physaddr;
+  int swapped;
+
+  entry = vm_lookup(pagetable, vaddr);
+  if (entry == NULL) {
+    KERNEL_PANIC("Tried to unmap an unmapped page");
+  }
+
+  if(ADDR_IS_ON_EVEN_PAGE(vaddr)) {
+    if(entry->V0 == 0 && entry->SWAP0 == 0) {
+      KERNEL_PANIC("Tried to unmap an unmapped page");
+    }
+    swapped = entry->SWAP0;
+    physaddr = entry->PFN0 << 12;
+    entry->PFN0 = 0;
+    entry->COW0 = 0;
+    entry->SWAP0 = 0;
+    entry->D0   = 0;
+    entry->V0   = 0;
+  } else {
+    if(entry->V1 == 0 && entry->SWAP1 == 0) {
+      KERNEL_PANIC("Tried to unmap an unmapped page");
+    }
+    swapped = entry->SWAP1;
+    physaddr = entry->PFN1 << 12;
+    entry->PFN1 = 0;
+    entry->COW1 = 0;
+    entry->SWAP1 = 0;
+    entry->D1   = 0;
+    entry->V1   = 0;
+  }
+
+  if (swapped) {
+    swap_free(physaddr >> 12);
+    return 0;
+  }
+  pagetable->valid_count--;
+  return physaddr;
+}
+
+/**
+ * Translates given virtual address to a physical address using the
+ * mappings in given pagetable. Does not consult the TLB.
+ *
+ * @param pagetable Pagetable to look the mapping up in
+ *
+ * @param vaddr Virtual address to translate
+ *
+ * @return The physical address corresponding to vaddr, or 0 if vaddr
+ * is not mapped in the pagetable.
+ */
+uint32_t vm_translate(pagetable_t *pagetable, uint32_t vaddr)
+{
+  pagetable_entry_t *entry;
+
+  if (vaddr >= 0x80000000) {
+    return 0;
+  }
+  entry = vm_lookup(pagetable, vaddr);
+  if (entry == NULL) {
+    return 0;
+  }
+
+  if(ADDR_IS_ON_EVEN_PAGE(vaddr)) {
+    if(entry->V0 == 0)
+      return 0;
+    return (entry->PFN0 << 12) | (vaddr & ~PAGE_SIZE_MASK);
+  } else {
+    if(entry->V1 == 0)
+      return 0;
+    return (entry->PFN1 << 12) | (vaddr & ~PAGE_SIZE_MASK);
+  }
 }
 
 /**
@@ -228,35 +390,293 @@ void vm_unmap(UNUSED pagetable_t *pagetable, UNUSED uint32_t vaddr) {
  */
 void vm_set_dirty(pagetable_t *pagetable, uint32_t vaddr, int dirty)
 {
-  unsigned int i;
+  pagetable_entry_t *entry;
 
   KERNEL_ASSERT(dirty == 0 || dirty == 1);
 
-  for(i=0; i<pagetable->valid_count; i++) {
-    if(pagetable->entries[i].VPN2 == (vaddr >> 13)) {
-      /* Check whether this is an even or odd page */
-      if(ADDR_IS_ON_EVEN_PAGE(vaddr)) {
-        if(pagetable->entries[i].V0 == 0) {
-          KERNEL_PANIC("Tried to set dirty bit of an unmapped "
-                       "entry");
-        } else {
-          pagetable->entries[i].D0 = dirty;
-          return;
-        }
-      } else {
-        if(pagetable->entries[i].V1 == 0) {
-          KERNEL_PANIC("Tried to set dirty bit of an unmapped "
-                       "entry");
-        } else {
-          pagetable->entries[i].D1 = dirty;
-          return;
-        }
-      }
+  entry = vm_lookup(pagetable, vaddr);
+  if (entry == NULL) {
+    KERNEL_PANIC("Tried to set dirty bit of an unmapped entry");
+  }
+
+  /* Check whether this is an even or odd page */
+  if(ADDR_IS_ON_EVEN_PAGE(vaddr)) {
+    if(entry->V0 == 0) {
+      KERNEL_PANIC("Tried to set dirty bit of an unmapped "
+                   "entry");
+    }
+    entry->D0 = dirty;
+  } else {
+    if(entry->V1 == 0) {
+      KERNEL_PANIC("Tried to set dirty bit of an unmapped "
+                   "entry");
+    }
+    entry->D1 = dirty;
+  }
+}
+
+/**
+ * Write-protects the page at given virtual address. A writable page
+ * is marked copy-on-write, so that the next write to it makes it
+ * writable again, see vm_copy_on_write. Does not modify TLB.
+ *
+ * @param pagetable The pagetable where the mapping resides.
+ *
+ * @param vaddr The virtual address of the page, which must be mapped.
+ */
+void vm_write_protect(pagetable_t *pagetable, uint32_t vaddr)
+{
+  pagetable_entry_t *entry;
+
+  entry = vm_lookup(pagetable, vaddr);
+  KERNEL_ASSERT(entry != NULL);
+
+  if(ADDR_IS_ON_EVEN_PAGE(vaddr)) {
+    KERNEL_ASSERT(entry->V0 == 1);
+    entry->COW0 |= entry->D0;
+    entry->D0 = 0;
+  } else {
+    KERNEL_ASSERT(entry->V1 == 1);
+    entry->COW1 |= entry->D1;
+    entry->D1 = 0;
+  }
+}
+
+/**
+ * Maps the page at the given virtual address in one pagetable to the
+ * same virtual address in another, sharing the physical page. A
+ * writable page is write-protected in both pagetables and marked
+ * copy-on-write. A swapped out page shares its swap slot instead, and
+ * each pagetable gets its own copy when swapping it in. Does not
+ * modify TLB, so stale writable entries of `from` must be flushed by
+ * the caller.
+ *
+ * @param to Pagetable to map the page in.
+ *
+ * @param from Pagetable in which the page is already mapped.
+ *
+ * @param vaddr The virtual address of the page.
+ *
+ * @return 1 if the page was shared, 0 if there was no memory for
+ * the pagetable leaf it goes in. Neither pagetable is changed then.
+ */
+int vm_share_page(pagetable_t *to, pagetable_t *from, uint32_t vaddr)
+{
+  pagetable_entry_t *entry, *from_entry;
+  uint32_t physaddr;
+  int cow;
+
+  /* Make room in `to` first, so that nothing needs undoing if there is no
+     memory. */
+  if (vm_lookup_create(to, vaddr) == NULL) {
+    return 0;
+  }
+
+  entry = vm_lookup(from, vaddr);
+  KERNEL_ASSERT(entry != NULL);
+
+  if (ADDR_IS_ON_EVEN_PAGE(vaddr) ? entry->SWAP0 : entry->SWAP1) {
+    from_entry = entry;
+    entry = vm_lookup(to, vaddr);
+    if(ADDR_IS_ON_EVEN_PAGE(vaddr)) {
+      KERNEL_ASSERT(entry->V0 == 0 && entry->SWAP0 == 0);
+      entry->PFN0 = from_entry->PFN0;
+      entry->COW0 = from_entry->COW0;
+      entry->D0 = from_entry->D0;
+      entry->SWAP0 = 1;
+      swap_ref(entry->PFN0);
+    } else {
+      KERNEL_ASSERT(entry->V1 == 0 && entry->SWAP1 == 0);
+      entry->PFN1 = from_entry->PFN1;
+      entry->COW1 = from_entry->COW1;
+      entry->D1 = from_entry->D1;
+      entry->SWAP1 = 1;
+      swap_ref(entry->PFN1);
     }
+    return 1;
+  }
+
+  if(ADDR_IS_ON_EVEN_PAGE(vaddr)) {
+    KERNEL_ASSERT(entry->V0 == 1);
+    cow = entry->D0 | entry->COW0;
+    entry->D0 = 0;
+    entry->COW0 = cow;
+    physaddr = entry->PFN0 << 12;
+  } else {
+    KERNEL_ASSERT(entry->V1 == 1);
+    cow = entry->D1 | entry->COW1;
+    entry->D1 = 0;
+    entry->COW1 = cow;
+    physaddr = entry->PFN1 << 12;
+  }
+
+  pagepool_ref_phys_page(physaddr);
+  vm_map(to, physaddr, vaddr, 0);
+
+  entry = vm_lookup(to, vaddr);
+  if(ADDR_IS_ON_EVEN_PAGE(vaddr)) {
+    entry->COW0 = cow;
+  } else {
+    entry->COW1 = cow;
+  }
+  return 1;
+}
+
+/**
+ * Makes a copy-on-write page writable after a write to it has
+ * faulted. The page is copied unless this pagetable holds the only
+ * reference to it. Does not modify TLB.
+ *
+ * @param pagetable The pagetable where the mapping resides.
+ *
+ * @param vaddr The virtual address that was written to.
+ *
+ * @return 1 if the page is now writable, 0 if it is not a
+ * copy-on-write page or there was no memory for the copy.
+ */
+int vm_copy_on_write(pagetable_t *pagetable, uint32_t vaddr)
+{
+  pagetable_entry_t *entry;
+  uint32_t physaddr, copy;
+  int even = ADDR_IS_ON_EVEN_PAGE(vaddr);
+
+  entry = vm_lookup(pagetable, vaddr);
+  if (entry == NULL || !(even ? entry->V0 : entry->V1)) {
+    return 0;
+  }
+  if (even ? entry->D0 : entry->D1) {
+    /* Another thread of the process got here first. */
+    return 1;
+  }
+  if (!(even ? entry->COW0 : entry->COW1)) {
+    return 0;
+  }
+
+  /* The other holders of the page may drop their references meanwhile, but
+     with the vm lock of the process held, none can be added. */
+  physaddr = (even ? entry->PFN0 : entry->PFN1) << 12;
+  if (pagepool_phys_page_refs(physaddr) > 1) {
+    copy = pagepool_get_phys_page();
+    if (copy == 0) {
+      return 0;
+    }
+    memcopy_page((void *) ADDR_PHYS_TO_KERNEL(copy),
+                 (void *) ADDR_PHYS_TO_KERNEL(physaddr));
+    pagepool_free_phys_page(physaddr);
+    physaddr = copy;
+  }
+
+  if (even) {
+    entry->PFN0 = physaddr >> 12;
+    entry->COW0 = 0;
+    entry->D0 = 1;
+  } else {
+    entry->PFN1 = physaddr >> 12;
+    entry->COW1 = 0;
+    entry->D1 = 1;
   }
-  /* No mapping was found */
+  return 1;
+}
+
+/**
+ * Returns the swap slot of the page at given virtual address, if it
+ * is swapped out.
+ *
+ * @param pagetable The pagetable where the mapping resides.
+ *
+ * @param vaddr The virtual address of the page.
+ *
+ * @return The swap slot, or -1 if the page is not swapped out.
+ */
+int vm_swap_slot(pagetable_t *pagetable, uint32_t vaddr)
+{
+  pagetable_entry_t *entry;
 
-  KERNEL_PANIC("Tried to set dirty bit of an unmapped entry");
+  if (vaddr >= 0x80000000) {
+    return -1;
+  }
+  entry = vm_lookup(pagetable, vaddr);
+  if (entry == NULL) {
+    return -1;
+  }
+  if(ADDR_IS_ON_EVEN_PAGE(vaddr)) {
+    return entry->SWAP0 ? (int) entry->PFN0 : -1;
+  } else {
+    return entry->SWAP1 ? (int) entry->PFN1 : -1;
+  }
+}
+
+/**
+ * Marks the page at given virtual address as swapped out to given
+ * slot. The mapping is removed, but its dirty and copy-on-write bits
+ * are kept for when the page is swapped in. Does not modify TLB.
+ *
+ * @param pagetable The pagetable where the mapping resides.
+ *
+ * @param vaddr The virtual address of the page.
+ *
+ * @param slot The swap slot the page is written to.
+ *
+ * @return The physical page that was mapped. The reference to it
+ * passes to the caller.
+ */
+uint32_t vm_swap_out(pagetable_t *pagetable, uint32_t vaddr, int slot)
+{
+  pagetable_entry_t *entry;
+  uint32_t physaddr;
+
+  entry = vm_lookup(pagetable, vaddr);
+  KERNEL_ASSERT(entry != NULL);
+
+  if(ADDR_IS_ON_EVEN_PAGE(vaddr)) {
+    KERNEL_ASSERT(entry->V0 == 1);
+    physaddr = entry->PFN0 << 12;
+    entry->PFN0 = slot;
+    entry->V0 = 0;
+    entry->SWAP0 = 1;
+  } else {
+    KERNEL_ASSERT(entry->V1 == 1);
+    physaddr = entry->PFN1 << 12;
+    entry->PFN1 = slot;
+    entry->V1 = 0;
+    entry->SWAP1 = 1;
+  }
+
+  pagetable->valid_count--;
+  return physaddr;
+}
+
+/**
+ * Maps a page read back from swap at given virtual address, with the
+ * dirty and copy-on-write bits it was swapped out with. Does not free
+ * the swap slot, nor modify TLB.
+ *
+ * @param pagetable The pagetable where the page is swapped out.
+ *
+ * @param physaddr The page holding the contents read back.
+ *
+ * @param vaddr The virtual address of the page.
+ */
+void vm_swap_in(pagetable_t *pagetable, uint32_t physaddr, uint32_t vaddr)
+{
+  pagetable_entry_t *entry;
+
+  entry = vm_lookup(pagetable, vaddr);
+  KERNEL_ASSERT(entry != NULL);
+
+  if(ADDR_IS_ON_EVEN_PAGE(vaddr)) {
+    KERNEL_ASSERT(entry->SWAP0 == 1);
+    entry->PFN0 = physaddr >> 12;
+    entry->SWAP0 = 0;
+    entry->V0 = 1;
+  } else {
+    KERNEL_ASSERT(entry->SWAP1 == 1);
+    entry->PFN1 = physaddr >> 12;
+    entry->SWAP1 = 0;
+    entry->V1 = 1;
+  }
+
+  pagetable->valid_count++;
 }
 
 /** @} */
@@ -47,13 +47,23 @@
 
 void vm_init(void);
 
-pagetable_t *vm_create_pagetable(uint32_t asid);
+pagetable_t *vm_create_pagetable(void);
 void vm_destroy_pagetable(pagetable_t *pagetable);
 
-void vm_map(pagetable_t *pagetable, uint32_t physaddr,
-            uint32_t vaddr, int dirty);
-void vm_unmap(pagetable_t *pagetable, uint32_t vaddr);
+int vm_map(pagetable_t *pagetable, uint32_t physaddr,
+           uint32_t vaddr, int dirty);
+uint32_t vm_unmap(pagetable_t *pagetable, uint32_t vaddr);
 
+pagetable_entry_t *vm_lookup(pagetable_t *pagetable, uint32_t vaddr);
+int vm_create_leaf(pagetable_t *pagetable, uint32_t vaddr);
 void vm_set_dirty(pagetable_t *pagetable, uint32_t vaddr, int dirty);
+void vm_write_protect(pagetable_t *pagetable, uint32_t vaddr);
+int vm_share_page(pagetable_t *to, pagetable_t *from, uint32_t vaddr);
+int vm_copy_on_write(pagetable_t *pagetable, uint32_t vaddr);
+uint32_t vm_translate(pagetable_t *pagetable, uint32_t vaddr);
+
+int vm_swap_slot(pagetable_t *pagetable, uint32_t vaddr);
+uint32_t vm_swap_out(pagetable_t *pagetable, uint32_t vaddr, int slot);
+void vm_swap_in(pagetable_t *pagetable, uint32_t physaddr, uint32_t vaddr);
 
 #endif /* BUENOS_VM_VM_H */